@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#include "batch.h"
+#include "common.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 //older libc headers do not know about the offload options yet
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+#define GSO_CTRL_SIZE CMSG_SPACE(sizeof(uint16_t)) //room for one UDP_SEGMENT control message
+#define GRO_CTRL_SIZE CMSG_SPACE(sizeof(int))      //room for one UDP_GRO control message
+#define TXTIME_CTRL_SIZE CMSG_SPACE(sizeof(uint64_t)) //room for one SCM_TXTIME control message
+
+/*
+ * batch_init: allocate a batch of capacity message slots, each with slot_size bytes of storage
+ */
+void batch_init(Batch *b, int sockfd, int capacity, int slot_size)
+{
+    if (capacity < 1) capacity = 1; //clamp the batch size to something the kernel accepts
+    if (capacity > MAX_BATCH_SIZE) capacity = MAX_BATCH_SIZE;
+
+    memset(b, 0, sizeof(*b));
+    b->sockfd = sockfd;
+    b->capacity = capacity;
+    b->slot_size = slot_size;
+    b->msgs = calloc(capacity, sizeof(struct mmsghdr));
+    b->iovs = calloc(2 * capacity, sizeof(struct iovec));
+    b->addrs = calloc(capacity, sizeof(struct sockaddr_in));
+    b->slots = malloc((size_t)capacity * slot_size);
+    b->seg_data = malloc(capacity * sizeof(char *)); //one segment per message until GRO is turned on
+    b->seg_len = malloc(capacity * sizeof(int));
+    b->seg_msg = malloc(capacity * sizeof(int));
+    if (b->msgs == NULL || b->iovs == NULL || b->addrs == NULL || b->slots == NULL ||
+        b->seg_data == NULL || b->seg_len == NULL || b->seg_msg == NULL)
+        error("batch_init");
+}
+
+void batch_free(Batch *b)
+{
+    free(b->msgs);
+    free(b->iovs);
+    free(b->addrs);
+    free(b->slots);
+    free(b->gso_msgs);
+    free(b->gso_ctrl);
+    free(b->seg_data);
+    free(b->seg_len);
+    free(b->seg_msg);
+    free(b->tx_at);
+    free(b->tx_ctrl);
+    memset(b, 0, sizeof(*b));
+}
+
+/*
+ * batch_enable_gso: check that the kernel supports UDP_SEGMENT and if so let batch_flush coalesce runs of
+ * gso_size datagrams into one send, the kernel (or the NIC) cuts them back into gso_size datagrams on the wire
+ */
+int batch_enable_gso(Batch *b, int gso_size)
+{
+    int val = gso_size;
+    if (setsockopt(b->sockfd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) < 0) { //probe, kernels before 4.18 reject the option
+        perror("UDP_SEGMENT not supported, falling back to plain batching");
+        return 0;
+    }
+    val = 0; //we pass the segment size per send with a control message, so turn the socket wide default back off
+    setsockopt(b->sockfd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val));
+
+    b->gso_msgs = calloc(b->capacity, sizeof(struct mmsghdr));
+    b->gso_ctrl = calloc(b->capacity, GSO_CTRL_SIZE + TXTIME_CTRL_SIZE); //the segment size and maybe a departure time
+    if (b->gso_msgs == NULL || b->gso_ctrl == NULL)
+        error("batch_enable_gso");
+    b->gso_size = gso_size;
+    return 1;
+}
+
+/*
+ * batch_enable_gro: ask the kernel to coalesce consecutive datagrams of one flow, each receive slot grows to
+ * 64KB and batch_recv splits what comes in back into packets using the segment size the kernel reports
+ */
+int batch_enable_gro(Batch *b)
+{
+    int on = 1;
+    if (setsockopt(b->sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0) { //kernels before 5.0 reject the option
+        perror("UDP_GRO not supported, falling back to plain batching");
+        return 0;
+    }
+
+    int max_segs = b->capacity * GSO_MAX_SEGMENTS; //worst case every message carries a full 64 segment train
+    free(b->slots);
+    b->slot_size = GRO_SLOT_SIZE;
+    b->slots = malloc((size_t)b->capacity * (GRO_SLOT_SIZE + GRO_CTRL_SIZE)); //datagram storage followed by control space
+    b->seg_data = realloc(b->seg_data, max_segs * sizeof(char *));
+    b->seg_len = realloc(b->seg_len, max_segs * sizeof(int));
+    b->seg_msg = realloc(b->seg_msg, max_segs * sizeof(int));
+    if (b->slots == NULL || b->seg_data == NULL || b->seg_len == NULL || b->seg_msg == NULL)
+        error("batch_enable_gro");
+    b->gro = 1;
+    return 1;
+}
+
+/*
+ * batch_enable_txtime: let the kernel pace for us, every datagram carries the time (CLOCK_MONOTONIC) it may
+ * leave at and the fq qdisc holds it until then. Without fq on the interface the kernel sends right away,
+ * so the sender keeps its own bucket and only hands over what it would have sent anyway
+ */
+int batch_enable_txtime(Batch *b)
+{
+    struct sock_txtime cfg = { .clockid = CLOCK_MONOTONIC, .flags = 0 };
+    if (setsockopt(b->sockfd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg)) < 0) { //kernels before 4.19 reject the option
+        perror("SO_TXTIME not supported, pacing in user space only");
+        return 0;
+    }
+
+    b->tx_at = calloc(b->capacity, sizeof(uint64_t));
+    b->tx_ctrl = calloc(b->capacity, TXTIME_CTRL_SIZE);
+    if (b->tx_at == NULL || b->tx_ctrl == NULL)
+        error("batch_enable_txtime");
+    b->txtime = 1;
+    return 1;
+}
+
+void batch_set_txtime(Batch *b, uint64_t at_ns)
+{
+    b->next_txtime = at_ns;
+}
+
+//append an SCM_TXTIME control message for departure time at to the control buffer of mh
+static void add_txtime(struct msghdr *mh, char *ctrl, uint64_t at)
+{
+    struct cmsghdr *cm = (struct cmsghdr *)(ctrl + mh->msg_controllen);
+    memset(cm, 0, TXTIME_CTRL_SIZE);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_TXTIME;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+    memcpy(CMSG_DATA(cm), &at, sizeof(at));
+    mh->msg_control = ctrl;
+    mh->msg_controllen += TXTIME_CTRL_SIZE;
+}
+
+/*
+ * batch_add: queue one datagram, the header is copied into the slot so it can live on the caller's stack,
+ * the payload is only referenced. A full batch is flushed before the new message is queued.
+ */
+void batch_add(Batch *b, const void *hdr, int hdr_len, const void *data, int data_len, const struct sockaddr_in *addr)
+{
+    if (b->count == b->capacity)
+        batch_flush(b);
+
+    int i = b->count++;
+    char *slot = b->slots + (size_t)i * b->slot_size;
+    if (hdr_len > b->slot_size) { //a header bigger than the slot is a programming error
+        fprintf(stderr, "batch_add: header of %d bytes does not fit slot of %d\n", hdr_len, b->slot_size);
+        exit(1);
+    }
+    memcpy(slot, hdr, hdr_len);
+    b->addrs[i] = *addr;
+
+    //always two iovecs (the second may be empty) so the iovecs of consecutive slots form one
+    //contiguous array that a coalesced GSO send can point at directly
+    struct iovec *iov = &b->iovs[2 * i];
+    iov[0].iov_base = slot;
+    iov[0].iov_len = hdr_len;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = data_len;
+
+    struct msghdr *mh = &b->msgs[i].msg_hdr;
+    memset(mh, 0, sizeof(*mh));
+    mh->msg_name = &b->addrs[i];
+    mh->msg_namelen = sizeof(struct sockaddr_in);
+    mh->msg_iov = iov;
+    mh->msg_iovlen = 2;
+    if (b->txtime && b->next_txtime != 0) {
+        b->tx_at[i] = b->next_txtime;
+        add_txtime(mh, b->tx_ctrl + (size_t)i * TXTIME_CTRL_SIZE, b->next_txtime);
+    } else if (b->txtime) {
+        b->tx_at[i] = 0;
+    }
+}
+
+static int msg_bytes(const Batch *b, int i)
+{
+    return b->iovs[2 * i].iov_len + b->iovs[2 * i + 1].iov_len;
+}
+
+static void send_plain(Batch *b, int first, int count)
+{
+    int sent = 0;
+    while (sent < count) {
+        int n = sendmmsg(b->sockfd, b->msgs + first + sent, count - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR) //interrupted by the retransmission timer, just try again
+                continue;
+            error("sendmmsg");
+        }
+        b->calls++;
+        b->messages += n;
+        b->segments += n;
+        sent += n;
+    }
+}
+
+/*
+ * send_gso: group the queued datagrams into runs of gso_size datagrams (the last one of a run may be shorter)
+ * going to the same peer (and leaving at the same time with SO_TXTIME) and send each run as a single
+ * UDP_SEGMENT datagram
+ */
+static void send_gso(Batch *b)
+{
+    int max_segs = GSO_MAX_BYTES / b->gso_size;
+    if (max_segs > GSO_MAX_SEGMENTS) max_segs = GSO_MAX_SEGMENTS;
+
+    int first_of[MAX_BATCH_SIZE]; //first queued message of each super datagram
+    int segs_of[MAX_BATCH_SIZE];  //number of queued messages it covers
+    int ngso = 0;
+
+    for (int i = 0; i < b->count; ) {
+        int j = i + 1;
+        if (msg_bytes(b, i) == b->gso_size) { //only full sized datagrams can be followed by more segments
+            while (j < b->count && j - i < max_segs &&
+                   b->addrs[j].sin_addr.s_addr == b->addrs[i].sin_addr.s_addr &&
+                   b->addrs[j].sin_port == b->addrs[i].sin_port &&
+                   (!b->txtime || b->tx_at[j] == b->tx_at[i]) &&
+                   msg_bytes(b, j) <= b->gso_size) {
+                j++;
+                if (msg_bytes(b, j - 1) < b->gso_size) //a short datagram ends the run
+                    break;
+            }
+        }
+
+        struct msghdr *mh = &b->gso_msgs[ngso].msg_hdr;
+        memset(mh, 0, sizeof(*mh));
+        mh->msg_name = &b->addrs[i];
+        mh->msg_namelen = sizeof(struct sockaddr_in);
+        mh->msg_iov = &b->iovs[2 * i];
+        mh->msg_iovlen = 2 * (j - i);
+        char *ctrl = b->gso_ctrl + (size_t)ngso * (GSO_CTRL_SIZE + TXTIME_CTRL_SIZE);
+        if (j - i > 1) { //attach the segment size, a single datagram goes out as is
+            memset(ctrl, 0, GSO_CTRL_SIZE);
+            mh->msg_control = ctrl;
+            mh->msg_controllen = GSO_CTRL_SIZE;
+            struct cmsghdr *cm = CMSG_FIRSTHDR(mh);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            *(uint16_t *)CMSG_DATA(cm) = b->gso_size;
+        }
+        if (b->txtime && b->tx_at[i] != 0) { //the whole run leaves at the time of its first datagram
+            add_txtime(mh, ctrl, b->tx_at[i]);
+        }
+        first_of[ngso] = i;
+        segs_of[ngso] = j - i;
+        ngso++;
+        i = j;
+    }
+
+    int sent = 0;
+    while (sent < ngso) {
+        int n = sendmmsg(b->sockfd, b->gso_msgs + sent, ngso - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOPROTOOPT) {
+                //the device can not do checksum offload for segmentation or the kernel changed its mind,
+                //send the rest the plain way and stay there
+                perror("UDP_SEGMENT send failed, falling back to plain batching");
+                b->gso_size = 0;
+                send_plain(b, first_of[sent], b->count - first_of[sent]);
+                return;
+            }
+            error("sendmmsg");
+        }
+        b->calls++;
+        for (int k = sent; k < sent + n; k++) {
+            b->messages++;
+            b->segments += segs_of[k];
+        }
+        sent += n;
+    }
+}
+
+/*
+ * batch_flush: push every queued datagram to the kernel
+ * returns the number of datagrams sent
+ */
+int batch_flush(Batch *b)
+{
+    int queued = b->count;
+    if (queued == 0)
+        return 0;
+    if (b->gso_size > 0)
+        send_gso(b);
+    else
+        send_plain(b, 0, queued);
+    b->count = 0;
+    return queued;
+}
+
+/*
+ * batch_recv: block until at least one datagram is available then take everything else already queued
+ * in the socket (MSG_WAITFORONE), returns the number of packets received or -1 if interrupted by a signal
+ */
+int batch_recv(Batch *b)
+{
+    size_t stride = b->gro ? (size_t)b->slot_size + GRO_CTRL_SIZE : (size_t)b->slot_size;
+    for (int i = 0; i < b->capacity; i++) { //rearm every slot, the kernel overwrites the lengths
+        char *slot = b->slots + i * stride;
+        struct iovec *iov = &b->iovs[2 * i];
+        iov[0].iov_base = slot;
+        iov[0].iov_len = b->slot_size;
+
+        struct msghdr *mh = &b->msgs[i].msg_hdr;
+        memset(mh, 0, sizeof(*mh));
+        mh->msg_name = &b->addrs[i];
+        mh->msg_namelen = sizeof(struct sockaddr_in);
+        mh->msg_iov = iov;
+        mh->msg_iovlen = 1;
+        if (b->gro) {
+            mh->msg_control = slot + b->slot_size;
+            mh->msg_controllen = GRO_CTRL_SIZE;
+        }
+    }
+
+    int n = recvmmsg(b->sockfd, b->msgs, b->capacity, MSG_WAITFORONE, NULL);
+    if (n < 0) {
+        if (errno == EINTR)
+            return -1;
+        error("recvmmsg");
+    }
+    b->calls++;
+    b->messages += n;
+    b->count = n;
+
+    //split every datagram into packets, without GRO (or when the kernel did not coalesce) it is one each
+    b->nsegs = 0;
+    for (int i = 0; i < n; i++) {
+        char *data = b->iovs[2 * i].iov_base;
+        int len = b->msgs[i].msg_len;
+        int seg_size = len;
+        if (b->gro) {
+            struct msghdr *mh = &b->msgs[i].msg_hdr;
+            for (struct cmsghdr *cm = CMSG_FIRSTHDR(mh); cm != NULL; cm = CMSG_NXTHDR(mh, cm)) {
+                if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+                    seg_size = *(int *)CMSG_DATA(cm);
+            }
+            if (seg_size <= 0) seg_size = len;
+        }
+        for (int off = 0; off < len; off += seg_size) {
+            b->seg_data[b->nsegs] = data + off;
+            b->seg_len[b->nsegs] = (len - off < seg_size) ? len - off : seg_size;
+            b->seg_msg[b->nsegs] = i;
+            b->nsegs++;
+        }
+    }
+    b->segments += b->nsegs;
+    return b->nsegs;
+}
+
+/*
+ * batch_recv_scatter: like batch_recv, but the first hdr_len bytes of every datagram land in its slot and the
+ * rest straight in the caller's memory (the output file mapping), message i at payload + i * payload_len.
+ * No GRO here, a coalesced datagram would interleave headers with the payload.
+ */
+int batch_recv_scatter(Batch *b, int hdr_len, char *payload, int payload_len)
+{
+    for (int i = 0; i < b->capacity; i++) {
+        struct iovec *iov = &b->iovs[2 * i];
+        iov[0].iov_base = b->slots + (size_t)i * b->slot_size;
+        iov[0].iov_len = hdr_len;
+        iov[1].iov_base = payload + (size_t)i * payload_len;
+        iov[1].iov_len = payload_len;
+
+        struct msghdr *mh = &b->msgs[i].msg_hdr;
+        memset(mh, 0, sizeof(*mh));
+        mh->msg_name = &b->addrs[i];
+        mh->msg_namelen = sizeof(struct sockaddr_in);
+        mh->msg_iov = iov;
+        mh->msg_iovlen = 2;
+    }
+
+    int n = recvmmsg(b->sockfd, b->msgs, b->capacity, MSG_WAITFORONE, NULL);
+    if (n < 0) {
+        if (errno == EINTR)
+            return -1;
+        error("recvmmsg");
+    }
+    b->calls++;
+    b->messages += n;
+    b->segments += n;
+    b->count = n;
+    for (int i = 0; i < n; i++) {
+        b->seg_data[i] = b->iovs[2 * i].iov_base;
+        b->seg_len[i] = b->msgs[i].msg_len;
+        b->seg_msg[i] = i;
+    }
+    b->nsegs = n;
+    return n;
+}
+
+char* batch_payload(Batch *b, int i)
+{
+    return b->iovs[2 * b->seg_msg[i] + 1].iov_base;
+}
+
+char* batch_data(Batch *b, int i)
+{
+    return b->seg_data[i];
+}
+
+int batch_len(Batch *b, int i)
+{
+    return b->seg_len[i];
+}
+
+struct sockaddr_in* batch_addr(Batch *b, int i)
+{
+    return &b->addrs[b->seg_msg[i]];
+}
+
+//average number of datagrams per syscall, the closer to the batch size the better
+double batch_avg_fill(const Batch *b)
+{
+    return b->calls ? (double)b->messages / b->calls : 0.0;
+}
+
+void batch_print_stats(const char *name, const Batch *b)
+{
+    printf("%s: %lu datagrams in %lu calls, avg batch fill %.2f / %d",
+           name, b->messages, b->calls, batch_avg_fill(b), b->capacity);
+    if (b->segments != b->messages) //offload was in use, show how many packets each datagram carried
+        printf(", %lu segments (%.2f per datagram)", b->segments, b->messages ? (double)b->segments / b->messages : 0.0);
+    printf("\n");
+}
@@ -0,0 +1,67 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "packet.h"
+
+#define DEFAULT_BATCH_SIZE 32 //how many datagrams we move per sendmmsg/recvmmsg call by default
+#define MAX_BATCH_SIZE 1024   //upper limit, the kernel will not take more than UIO_MAXIOV messages per call anyway
+#define GSO_MAX_SEGMENTS 64   //the kernel refuses a UDP_SEGMENT send with more segments than this (UDP_MAX_SEGMENTS)
+#define GSO_MAX_BYTES 65507   //largest UDP payload over IPv4, a coalesced datagram can not be bigger
+#define GRO_SLOT_SIZE 65536   //with UDP_GRO a single receive can hand us up to 64KB of coalesced segments
+
+typedef struct {
+    struct mmsghdr *msgs;          //one message header per slot, handed straight to sendmmsg/recvmmsg
+    struct iovec *iovs;            //two iovecs per slot: [0] is the header, [1] is the payload
+    struct sockaddr_in *addrs;     //per slot peer address (destination when sending, source when receiving)
+    char *slots;                   //per slot storage: a copied header when sending, a whole datagram when receiving
+    int slot_size;                 //size of each storage slot in bytes
+    int capacity;                  //batch size, max number of messages per syscall
+    int count;                     //number of messages currently queued (send) or received (recv)
+    int sockfd;                    //socket the batch is flushed to / filled from
+    unsigned long calls;           //number of syscalls issued so far
+    unsigned long messages;        //number of datagrams moved by those syscalls
+
+    int gso_size;                  //send side: segment size for UDP_SEGMENT offload, 0 when not in use
+    struct mmsghdr *gso_msgs;      //send side: coalesced super datagrams built at flush time
+    char *gso_ctrl;                //send side: one UDP_SEGMENT control message per super datagram
+    int gro;                       //receive side: 1 when the socket hands us UDP_GRO coalesced datagrams
+    char **seg_data;               //receive side: every segment found in the last batch, after splitting
+    int *seg_len;
+    int *seg_msg;                  //index of the message each segment came from (for its source address)
+    int nsegs;
+    unsigned long segments;        //number of segments the datagrams carried (equal to messages without offload)
+
+    int txtime;                    //send side: 1 when SO_TXTIME is on, every message carries its departure time
+    uint64_t next_txtime;          //nanoseconds of CLOCK_MONOTONIC, stamped on the messages queued from now on (0 = now)
+    uint64_t *tx_at;               //per slot departure time
+    char *tx_ctrl;                 //per slot SCM_TXTIME control message for plain sends
+} Batch;
+
+void batch_init(Batch *b, int sockfd, int capacity, int slot_size);
+void batch_free(Batch *b);
+int batch_enable_gso(Batch *b, int gso_size); //returns 1 when the kernel takes UDP_SEGMENT, 0 when we fall back to plain batching
+int batch_enable_gro(Batch *b);               //returns 1 when the kernel takes UDP_GRO, 0 when we fall back to plain batching
+int batch_enable_txtime(Batch *b);            //returns 1 when the kernel takes SO_TXTIME, 0 when we pace in user space only
+void batch_set_txtime(Batch *b, uint64_t at_ns); //departure time for the datagrams queued after this call
+
+//send side: queue a header (copied) + payload (referenced, must stay valid until the flush) for addr
+void batch_add(Batch *b, const void *hdr, int hdr_len, const void *data, int data_len, const struct sockaddr_in *addr);
+int batch_flush(Batch *b);
+
+//receive side: block for at least one datagram then drain whatever else is pending, up to capacity.
+//returns the number of segments, coalesced GRO datagrams are already split so each index is one packet
+int batch_recv(Batch *b);
+int batch_recv_scatter(Batch *b, int hdr_len, char *payload, int payload_len); //header into the slot, payload of message i at payload + i * payload_len
+char* batch_data(Batch *b, int i);
+char* batch_payload(Batch *b, int i); //where batch_recv_scatter put the payload of packet i
+int batch_len(Batch *b, int i);
+struct sockaddr_in* batch_addr(Batch *b, int i);
+
+double batch_avg_fill(const Batch *b);
+void batch_print_stats(const char *name, const Batch *b);
+
+#endif /* BATCH_H */
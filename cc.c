@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+#include "cc.h"
+
+/*
+ * Congestion control front end: the sender only talks to these wrappers, they keep the rtt estimates every
+ * algorithm needs, call into the selected one and keep cwnd inside [1, max_cwnd]
+ */
+
+static const CongestionOps *algorithms[] = { &cc_reno, &cc_cubic, &cc_bbr };
+#define NUM_ALGORITHMS (sizeof(algorithms) / sizeof(algorithms[0]))
+
+const CongestionOps* cc_find(const char *name)
+{
+    for (size_t i = 0; i < NUM_ALGORITHMS; i++) {
+        if (strcmp(algorithms[i]->name, name) == 0)
+            return algorithms[i];
+    }
+    return NULL;
+}
+
+const char* cc_names(void)
+{
+    static char names[64];
+    if (names[0] == '\0') {
+        for (size_t i = 0; i < NUM_ALGORITHMS; i++) {
+            if (i > 0)
+                strcat(names, "|");
+            strcat(names, algorithms[i]->name);
+        }
+    }
+    return names;
+}
+
+#define ABC_LIMIT 2 //RFC 3465 L: slow start grows by at most this many segments per ack
+
+/*
+ * cc_slow_start: one segment more per acked segment, but at most ABC_LIMIT per ack, an ack can cover a lot (after
+ * an rto the first one takes in the whole SACKed range) and that must not turn into a line rate burst. Growth stops
+ * at ssthresh, the state is congestion avoidance from there and what is left of the ack is returned for it
+ */
+int cc_slow_start(CongestionControl *cc, int acked)
+{
+    int grow = acked < ABC_LIMIT ? acked : ABC_LIMIT;
+    double room = cc->ssthresh - cc->cwnd;
+
+    if (grow < room) {
+        cc->cwnd += grow;
+        return 0;
+    }
+    cc->state = CC_CONGESTION_AVOIDANCE;
+    if (room > 0) {
+        cc->cwnd = cc->ssthresh;
+        return (int)(grow - room);
+    }
+    return grow;
+}
+
+static void clamp(CongestionControl *cc)
+{
+    if (cc->cwnd < 1)
+        cc->cwnd = 1;
+    if (cc->cwnd > cc->max_cwnd)
+        cc->cwnd = cc->max_cwnd;
+}
+
+void cc_init(CongestionControl *cc, const CongestionOps *ops, int ssthresh, int max_cwnd, int mss)
+{
+    memset(cc, 0, sizeof(*cc));
+    cc->ops = ops;
+    cc->cwnd = 1;
+    cc->ssthresh = ssthresh;
+    cc->state = CC_SLOW_START;
+    cc->max_cwnd = max_cwnd;
+    cc->mss = mss;
+    ops->init(cc);
+}
+
+void cc_on_ack(CongestionControl *cc, int acked, int64_t ackno, int64_t next_seqno, uint64_t now)
+{
+    if (cc->in_recovery) //partial acks only deflate, the window grows again after recovery
+        return;
+    cc->ops->on_ack(cc, acked, ackno, next_seqno, now);
+    clamp(cc);
+}
+
+void cc_on_loss(CongestionControl *cc, uint64_t now)
+{
+    cc->ops->on_loss(cc, now);
+    clamp(cc);
+}
+
+void cc_on_timeout(CongestionControl *cc, uint64_t now)
+{
+    cc->in_recovery = false; //an rto ends fast recovery, the window restarts from the algorithm's timeout value
+    cc->ops->on_timeout(cc, now);
+    clamp(cc);
+}
+
+/*
+ * NewReno fast recovery (RFC 6582) on top of any algorithm: the algorithm decides the reduction in on_loss,
+ * the window is then inflated by every dup ack (each one is a segment that left the network) so new data keeps
+ * flowing during recovery, and deflated back to ssthresh once everything outstanding at the loss is acked
+ */
+void cc_enter_recovery(CongestionControl *cc, int dup_acks, uint64_t now)
+{
+    cc->ops->on_loss(cc, now);
+    if (!cc->ops->fast_recovery) //model based, the window comes from the model and keeps following it
+        return;
+    cc->in_recovery = true;
+    cc->cwnd += dup_acks; //ssthresh + 3
+    clamp(cc);
+}
+
+void cc_on_dup_ack(CongestionControl *cc)
+{
+    if (!cc->in_recovery)
+        return;
+    cc->cwnd += 1;
+    clamp(cc);
+}
+
+void cc_on_partial_ack(CongestionControl *cc, int acked)
+{
+    if (!cc->in_recovery)
+        return;
+    cc->cwnd -= acked; //what was acked left the network, the retransmission of the next hole takes one back
+    cc->cwnd += 1;
+    clamp(cc);
+}
+
+void cc_exit_recovery(CongestionControl *cc)
+{
+    cc->in_recovery = false;
+    if (cc->cwnd > cc->ssthresh)
+        cc->cwnd = cc->ssthresh;
+    clamp(cc);
+}
+
+void cc_on_rtt_sample(CongestionControl *cc, uint64_t rtt_us, uint64_t now)
+{
+    if (rtt_us == 0) //below the clock's resolution, still the best lower bound we have
+        rtt_us = 1;
+    if (cc->min_rtt == 0 || rtt_us < cc->min_rtt)
+        cc->min_rtt = rtt_us;
+    cc->srtt = cc->srtt == 0 ? rtt_us : (7 * cc->srtt + rtt_us) / 8;
+    if (cc->ops->on_rtt_sample != NULL)
+        cc->ops->on_rtt_sample(cc, rtt_us, now);
+}
+
+int cc_cwnd(const CongestionControl *cc)
+{
+    return (int)cc->cwnd;
+}
+
+/*
+ * cc_pacing_rate: algorithms without a model of their own pace at cwnd per srtt, with some headroom so
+ * pacing never is what limits the window (twice that in slow start, like Linux does)
+ */
+double cc_pacing_rate(const CongestionControl *cc)
+{
+    if (cc->ops->pacing_rate != NULL)
+        return cc->ops->pacing_rate(cc);
+    if (cc->srtt == 0)
+        return 0;
+    double gain = cc->state == CC_SLOW_START ? 2.0 : 1.2;
+    return gain * cc->cwnd * cc->mss * 1e6 / cc->srtt;
+}
+
+void cc_on_rate_sample(CongestionControl *cc, const RateSample *rs, uint64_t now)
+{
+    if (cc->ops->on_rate_sample != NULL) {
+        cc->ops->on_rate_sample(cc, rs, now);
+        clamp(cc);
+    }
+}
+
+double cc_bandwidth(const CongestionControl *cc)
+{
+    return cc->ops->bandwidth != NULL ? cc->ops->bandwidth(cc) : 0;
+}
+
+const char* cc_current_state(const CongestionControl *cc)
+{
+    return cc->in_recovery ? "FAST_RECOVERY" : cc_state_name(cc->state);
+}
+
+const char* cc_state_name(int state)
+{
+    switch (state) {
+        case CC_SLOW_START:
+            return "SLOW_START";
+        case CC_CONGESTION_AVOIDANCE:
+            return "CONGESTION_AVOIDANCE";
+        case CC_STARTUP:
+            return "STARTUP";
+        case CC_DRAIN:
+            return "DRAIN";
+        case CC_PROBE_BW:
+            return "PROBE_BW";
+        case CC_PROBE_RTT:
+            return "PROBE_RTT";
+        default:
+            return "UNKNOWN";
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef CC_H
+#define CC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//congestion states, shared by every algorithm so the sender can log them
+#define CC_SLOW_START 0
+#define CC_CONGESTION_AVOIDANCE 1
+#define CC_STARTUP 2            //model based (BBR) states from here on
+#define CC_DRAIN 3
+#define CC_PROBE_BW 4
+#define CC_PROBE_RTT 5
+
+typedef struct CongestionControl CongestionControl;
+
+typedef struct { //delivery rate sample, one per ack that delivered data (see the sender's mark_delivered)
+    double delivery_rate;   //segments per second over the interval
+    long delivered;         //segments delivered over the interval
+    long prior_delivered;   //total delivered when the newest acked segment was sent, rounds are counted with it
+    long total_delivered;   //total delivered right now
+    uint64_t interval;      //microseconds
+    int in_flight;          //segments still in flight after this ack
+} RateSample;
+
+typedef struct {
+    const char *name;
+    void (*init)(CongestionControl *cc);
+    void (*on_ack)(CongestionControl *cc, int acked, int64_t ackno, int64_t next_seqno, uint64_t now); //acked segments newly covered by a cumulative ack
+    void (*on_loss)(CongestionControl *cc, uint64_t now);      //fast retransmit, the network dropped a packet but acks still flow
+    void (*on_timeout)(CongestionControl *cc, uint64_t now);   //rto, nothing came back for a whole rto
+    void (*on_rtt_sample)(CongestionControl *cc, uint64_t rtt_us, uint64_t now); //optional, called after min/smoothed rtt were updated
+    double (*pacing_rate)(const CongestionControl *cc);       //optional, bytes per second, NULL derives it from cwnd and srtt
+    void (*on_rate_sample)(CongestionControl *cc, const RateSample *rs, uint64_t now); //optional, for model based algorithms
+    double (*bandwidth)(const CongestionControl *cc);         //optional, the algorithm's bottleneck bandwidth estimate in bytes per second
+    bool fast_recovery;     //window based algorithms: the front end runs NewReno fast recovery around on_loss
+} CongestionOps;
+
+typedef struct { //CUBIC (RFC 9438) state
+    double w_max;           //window right before the last reduction
+    double k;               //seconds the cubic function takes to grow back to w_max
+    double origin;          //plateau of the cubic function
+    double w_est;           //what Reno would have by now, CUBIC never grows slower than this
+    uint64_t epoch_start;   //start of the current congestion avoidance epoch, 0 when none
+    //HyStart: leave slow start when the acks of a round form a train as long as half the rtt, or the rtt grows
+    bool found;             //slow start exit point found
+    int64_t round_end;      //a round ends when this byte is acked
+    uint64_t round_start;
+    uint64_t last_ack;
+    uint64_t curr_rtt;      //smallest rtt in the first samples of this round
+    int samples;
+} CubicState;
+
+#define BBR_BW_ROUNDS 10 //bottleneck bandwidth is the max delivery rate of this many rounds
+
+typedef struct { //BBR state
+    double btl_bw;                      //bottleneck bandwidth estimate, segments per second
+    double round_bw[BBR_BW_ROUNDS];     //max delivery rate seen in each of the last rounds
+    long round_count;
+    long next_round_delivered;          //a round ends once a segment sent after this much was delivered is acked
+    uint64_t min_rtt;                   //microseconds, windowed min (cc->min_rtt never expires)
+    uint64_t min_rtt_stamp;
+    double pacing_gain;
+    double cwnd_gain;
+    double full_bw;                     //startup ends when the bandwidth stops growing 25% per round
+    int full_bw_count;
+    bool filled_pipe;
+    int cycle_index;                    //PROBE_BW gain cycle position
+    uint64_t cycle_stamp;
+    uint64_t probe_rtt_done;            //end of the PROBE_RTT dwell, 0 while not started
+    uint64_t probe_rtt_min;             //smallest rtt seen during the dwell, the new min rtt once it is over
+    double prior_cwnd;                  //restored when PROBE_RTT is over
+    int in_flight;
+} BbrState;
+
+struct CongestionControl {
+    const CongestionOps *ops;
+    double cwnd;            //congestion window in segments, fractional so the growth per ack can be small
+    int ssthresh;           //slow start threshold in segments
+    int state;              //CC_SLOW_START or CC_CONGESTION_AVOIDANCE (CC_STARTUP... for bbr)
+    bool in_recovery;       //NewReno fast recovery: cwnd is inflated by dup acks and does not grow otherwise
+    int max_cwnd;           //cwnd is never allowed past this
+    int mss;                //payload bytes per segment, for the pacing rate
+    uint64_t min_rtt;       //microseconds, 0 until the first sample
+    uint64_t srtt;          //microseconds, smoothed like the rto's srtt but kept at full resolution
+    union {
+        CubicState cubic;
+        BbrState bbr;
+    } u;
+};
+
+extern const CongestionOps cc_reno;
+extern const CongestionOps cc_cubic;
+extern const CongestionOps cc_bbr;
+
+const CongestionOps* cc_find(const char *name); //NULL when there is no algorithm by that name
+const char* cc_names(void);                     //the algorithm names joined by '|', for usage messages
+void cc_init(CongestionControl *cc, const CongestionOps *ops, int ssthresh, int max_cwnd, int mss);
+void cc_on_ack(CongestionControl *cc, int acked, int64_t ackno, int64_t next_seqno, uint64_t now);
+int cc_slow_start(CongestionControl *cc, int acked); //for the algorithms' on_ack: the acked segments left for congestion avoidance
+void cc_on_loss(CongestionControl *cc, uint64_t now);
+void cc_enter_recovery(CongestionControl *cc, int dup_acks, uint64_t now); //fast retransmit: on_loss, then inflate by the dup acks
+void cc_on_dup_ack(CongestionControl *cc);                 //in recovery: one more segment left the network
+void cc_on_partial_ack(CongestionControl *cc, int acked);  //in recovery: deflate by what was acked, the retransmission is in flight
+void cc_exit_recovery(CongestionControl *cc);              //full ack: deflate to ssthresh
+void cc_on_timeout(CongestionControl *cc, uint64_t now);
+void cc_on_rtt_sample(CongestionControl *cc, uint64_t rtt_us, uint64_t now);
+int cc_cwnd(const CongestionControl *cc);       //whole segments the sender may have in flight
+double cc_pacing_rate(const CongestionControl *cc);
+void cc_on_rate_sample(CongestionControl *cc, const RateSample *rs, uint64_t now);
+double cc_bandwidth(const CongestionControl *cc); //bytes per second, 0 for algorithms without a model
+const char* cc_state_name(int state);
+const char* cc_current_state(const CongestionControl *cc); //state name, FAST_RECOVERY while in recovery
+
+#endif /* CC_H */
@@ -0,0 +1,229 @@
+#include <stddef.h>
+#include "cc.h"
+
+/*
+ * BBR-like model based congestion control. Instead of reacting to loss it keeps a model of the path: the
+ * bottleneck bandwidth (max delivery rate over the last rounds) and the propagation delay (min rtt over the
+ * last 10 seconds). The pacing rate is a gain times the bandwidth, cwnd is a gain times the bandwidth delay
+ * product. STARTUP doubles the rate every round until the bandwidth stops growing, DRAIN empties the queue that
+ * built up, PROBE_BW cycles the gain around 1 to find more bandwidth and PROBE_RTT briefly shrinks the window to
+ * remeasure the min rtt. Random loss does not touch the model, so it does not cost throughput.
+ */
+
+#define BBR_HIGH_GAIN 2.885             //2/ln(2), doubles the sending rate every round
+#define BBR_CWND_GAIN 2.0
+#define BBR_FULL_BW_THRESH 1.25         //bandwidth has to grow this much per round to stay in STARTUP
+#define BBR_FULL_BW_ROUNDS 3
+#define BBR_MIN_RTT_WINDOW 10000000     //microseconds a min rtt sample stays valid
+#define BBR_PROBE_RTT_TIME 200000       //microseconds spent in PROBE_RTT
+#define BBR_MIN_CWND 4                  //segments, also the PROBE_RTT window
+#define BBR_CYCLE_LEN 8
+
+static const double pacing_cycle[BBR_CYCLE_LEN] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+static double bdp(const CongestionControl *cc) //bandwidth delay product in segments
+{
+    const BbrState *b = &cc->u.bbr;
+    return b->btl_bw * b->min_rtt / 1e6;
+}
+
+static void enter_startup(CongestionControl *cc)
+{
+    cc->state = CC_STARTUP;
+    cc->u.bbr.pacing_gain = BBR_HIGH_GAIN;
+    cc->u.bbr.cwnd_gain = BBR_HIGH_GAIN;
+}
+
+static void enter_probe_bw(CongestionControl *cc, uint64_t now)
+{
+    BbrState *b = &cc->u.bbr;
+    cc->state = CC_PROBE_BW;
+    b->cwnd_gain = BBR_CWND_GAIN;
+    b->cycle_index = 2; //start in a neutral phase rather than probing right after the drain
+    b->cycle_stamp = now;
+    b->pacing_gain = pacing_cycle[b->cycle_index];
+}
+
+static void bbr_init(CongestionControl *cc)
+{
+    BbrState *b = &cc->u.bbr;
+    b->btl_bw = 0;
+    for (int i = 0; i < BBR_BW_ROUNDS; i++)
+        b->round_bw[i] = 0;
+    b->round_count = 0;
+    b->next_round_delivered = 0;
+    b->min_rtt = 0;
+    b->min_rtt_stamp = 0;
+    b->full_bw = 0;
+    b->full_bw_count = 0;
+    b->filled_pipe = false;
+    b->probe_rtt_done = 0;
+    b->probe_rtt_min = 0;
+    b->prior_cwnd = 0;
+    b->in_flight = 0;
+    cc->ssthresh = cc->max_cwnd; //not used by BBR, logged as "no threshold"
+    cc->cwnd = BBR_MIN_CWND;
+    enter_startup(cc);
+}
+
+static void update_bandwidth(CongestionControl *cc, const RateSample *rs)
+{
+    BbrState *b = &cc->u.bbr;
+    bool round_start = false;
+
+    if (rs->prior_delivered >= b->next_round_delivered) { //the acked segment was sent after the last round ended
+        b->next_round_delivered = rs->total_delivered;
+        b->round_count++;
+        b->round_bw[b->round_count % BBR_BW_ROUNDS] = 0; //forget the oldest round
+        round_start = true;
+    }
+    double *slot = &b->round_bw[b->round_count % BBR_BW_ROUNDS];
+    if (rs->delivery_rate > *slot)
+        *slot = rs->delivery_rate;
+    b->btl_bw = 0;
+    for (int i = 0; i < BBR_BW_ROUNDS; i++) {
+        if (b->round_bw[i] > b->btl_bw)
+            b->btl_bw = b->round_bw[i];
+    }
+
+    if (round_start && !b->filled_pipe) { //STARTUP is over once three rounds in a row brought less than 25% more
+        if (b->btl_bw >= b->full_bw * BBR_FULL_BW_THRESH) {
+            b->full_bw = b->btl_bw;
+            b->full_bw_count = 0;
+        } else if (++b->full_bw_count >= BBR_FULL_BW_ROUNDS) {
+            b->filled_pipe = true;
+        }
+    }
+}
+
+static void update_state(CongestionControl *cc, uint64_t now)
+{
+    BbrState *b = &cc->u.bbr;
+
+    if (cc->state == CC_STARTUP && b->filled_pipe) {
+        cc->state = CC_DRAIN;
+        b->pacing_gain = 1.0 / BBR_HIGH_GAIN;
+        b->cwnd_gain = BBR_HIGH_GAIN;
+    }
+    if (cc->state == CC_DRAIN && b->in_flight <= bdp(cc)) //the startup queue is gone
+        enter_probe_bw(cc, now);
+    if (cc->state == CC_PROBE_BW && now - b->cycle_stamp > b->min_rtt) { //one phase per min rtt
+        b->cycle_index = (b->cycle_index + 1) % BBR_CYCLE_LEN;
+        b->cycle_stamp = now;
+        b->pacing_gain = pacing_cycle[b->cycle_index];
+    }
+
+    if (cc->state != CC_PROBE_RTT && b->min_rtt_stamp != 0 && now - b->min_rtt_stamp > BBR_MIN_RTT_WINDOW) {
+        cc->state = CC_PROBE_RTT; //the min rtt is stale, drain the queue for a moment to measure it again
+        b->pacing_gain = 1;
+        b->prior_cwnd = cc->cwnd;
+        b->probe_rtt_done = 0;
+        b->probe_rtt_min = 0;
+    }
+    if (cc->state == CC_PROBE_RTT) {
+        if (b->probe_rtt_done == 0 && b->in_flight <= BBR_MIN_CWND) {
+            b->probe_rtt_done = now + BBR_PROBE_RTT_TIME;
+        } else if (b->probe_rtt_done != 0 && now >= b->probe_rtt_done) {
+            if (b->probe_rtt_min != 0 && now - b->min_rtt_stamp > BBR_MIN_RTT_WINDOW) //measured with the queue drained,
+                b->min_rtt = b->probe_rtt_min;                                       //even when that is more than the old min
+            b->min_rtt_stamp = now;
+            if (cc->cwnd < b->prior_cwnd)
+                cc->cwnd = b->prior_cwnd;
+            if (b->filled_pipe)
+                enter_probe_bw(cc, now);
+            else
+                enter_startup(cc);
+        }
+    }
+}
+
+static void bbr_on_rate_sample(CongestionControl *cc, const RateSample *rs, uint64_t now)
+{
+    BbrState *b = &cc->u.bbr;
+
+    b->in_flight = rs->in_flight;
+    update_bandwidth(cc, rs);
+    update_state(cc, now);
+
+    if (cc->state == CC_PROBE_RTT) {
+        if (cc->cwnd > BBR_MIN_CWND)
+            cc->cwnd = BBR_MIN_CWND;
+        return;
+    }
+    double target = b->cwnd_gain * bdp(cc);
+    if (target < BBR_MIN_CWND)
+        target = BBR_MIN_CWND;
+    if (b->filled_pipe) { //grow towards the target as data is delivered, shrink to it right away
+        cc->cwnd += rs->delivered;
+        if (cc->cwnd > target)
+            cc->cwnd = target;
+    } else if (cc->cwnd < target || b->btl_bw == 0) { //STARTUP, never shrink while the model is still building up
+        cc->cwnd += rs->delivered;
+    }
+}
+
+/*
+ * bbr_on_rtt_sample: only a lower sample refreshes the min rtt. Once it is BBR_MIN_RTT_WINDOW old the next rate
+ * sample enters PROBE_RTT, samples that arrive meanwhile carry the queue and must not replace it. The one that
+ * does is the smallest sample of the PROBE_RTT dwell, when at most BBR_MIN_CWND segments are in flight
+ */
+static void bbr_on_rtt_sample(CongestionControl *cc, uint64_t rtt_us, uint64_t now)
+{
+    BbrState *b = &cc->u.bbr;
+    if (b->min_rtt == 0 || rtt_us <= b->min_rtt) {
+        b->min_rtt = rtt_us;
+        b->min_rtt_stamp = now;
+    }
+    if (cc->state == CC_PROBE_RTT && b->probe_rtt_done != 0 && (b->probe_rtt_min == 0 || rtt_us < b->probe_rtt_min))
+        b->probe_rtt_min = rtt_us;
+}
+
+static void bbr_on_ack(CongestionControl *cc, int acked, int64_t ackno, int64_t next_seqno, uint64_t now)
+{
+    //everything happens per rate sample
+    (void)cc;
+    (void)acked;
+    (void)ackno;
+    (void)next_seqno;
+    (void)now;
+}
+
+static void bbr_on_loss(CongestionControl *cc, uint64_t now)
+{
+    //loss is not a signal for the model, the retransmission is all that happens
+    (void)cc;
+    (void)now;
+}
+
+static void bbr_on_timeout(CongestionControl *cc, uint64_t now)
+{
+    (void)now;
+    cc->u.bbr.prior_cwnd = cc->cwnd; //conservation after an rto, the rate samples grow it back to the model
+    cc->cwnd = 1;
+}
+
+static double bbr_pacing_rate(const CongestionControl *cc)
+{
+    const BbrState *b = &cc->u.bbr;
+    if (b->btl_bw == 0) { //no sample yet, pace the initial window over the rtt we know of
+        return cc->srtt > 0 ? BBR_HIGH_GAIN * cc->cwnd * cc->mss * 1e6 / cc->srtt : 0;
+    }
+    return b->pacing_gain * b->btl_bw * cc->mss;
+}
+
+static double bbr_bandwidth(const CongestionControl *cc)
+{
+    return cc->u.bbr.btl_bw * cc->mss;
+}
+
+const CongestionOps cc_bbr = {
+    .name = "bbr",
+    .init = bbr_init,
+    .on_ack = bbr_on_ack,
+    .on_loss = bbr_on_loss,
+    .on_timeout = bbr_on_timeout,
+    .on_rtt_sample = bbr_on_rtt_sample,
+    .pacing_rate = bbr_pacing_rate,
+    .on_rate_sample = bbr_on_rate_sample,
+    .bandwidth = bbr_bandwidth,
+};
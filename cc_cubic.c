@@ -0,0 +1,163 @@
+#include <stddef.h>
+#include <math.h>
+#include "cc.h"
+
+/*
+ * CUBIC (RFC 9438): in congestion avoidance the window follows a cubic function of the time since the last
+ * reduction, so it grows back to where it was quickly and only probes carefully around it. The growth does not
+ * depend on the rtt, which is what makes long fat pipes fill up in seconds rather than minutes. Slow start is
+ * left early with HyStart when the window already covers the path, before it causes a burst of losses.
+ */
+
+#define CUBIC_C 0.4                 //scaling constant, segments per second^3
+#define CUBIC_BETA 0.7              //window kept on a loss
+#define HYSTART_LOW_WINDOW 16       //HyStart only looks at windows at least this big
+#define HYSTART_ACK_DELTA 2000      //microseconds, acks closer than this are part of one train
+#define HYSTART_MIN_SAMPLES 8       //rtt samples per round before the delay check
+#define HYSTART_DELAY_MIN 4000      //microseconds, bounds of the rtt increase that ends slow start
+#define HYSTART_DELAY_MAX 16000
+
+static void hystart_reset(CubicState *c, int64_t next_seqno, uint64_t now)
+{
+    c->round_end = next_seqno;
+    c->round_start = now;
+    c->last_ack = now;
+    c->curr_rtt = 0;
+    c->samples = 0;
+}
+
+static void exit_slow_start(CongestionControl *cc)
+{
+    cc->u.cubic.found = true;
+    cc->ssthresh = (int)cc->cwnd;
+    cc->state = CC_CONGESTION_AVOIDANCE;
+}
+
+static void cubic_init(CongestionControl *cc)
+{
+    CubicState *c = &cc->u.cubic;
+    c->w_max = 0;
+    c->epoch_start = 0;
+    c->found = false;
+    hystart_reset(c, 0, 0);
+}
+
+static void hystart_on_ack(CongestionControl *cc, int64_t ackno, int64_t next_seqno, uint64_t now)
+{
+    CubicState *c = &cc->u.cubic;
+
+    if (ackno > c->round_end) //everything sent in the last round is acked, start timing a new one
+        hystart_reset(c, next_seqno, now);
+
+    if (now - c->last_ack <= HYSTART_ACK_DELTA) { //still the same ack train
+        c->last_ack = now;
+        if (cc->min_rtt > 0 && now - c->round_start > cc->min_rtt / 2) //the train is as long as half an rtt, the pipe is full
+            exit_slow_start(cc);
+    }
+}
+
+static void cubic_on_rtt_sample(CongestionControl *cc, uint64_t rtt_us, uint64_t now)
+{
+    CubicState *c = &cc->u.cubic;
+    (void)now;
+
+    if (cc->state != CC_SLOW_START || c->found || cc->cwnd < HYSTART_LOW_WINDOW)
+        return;
+    if (c->samples < HYSTART_MIN_SAMPLES) {
+        if (c->curr_rtt == 0 || rtt_us < c->curr_rtt)
+            c->curr_rtt = rtt_us;
+        c->samples++;
+        return;
+    }
+    uint64_t eta = cc->min_rtt / 8; //a queue is building once this round's rtt is clearly above the minimum
+    if (eta < HYSTART_DELAY_MIN)
+        eta = HYSTART_DELAY_MIN;
+    if (eta > HYSTART_DELAY_MAX)
+        eta = HYSTART_DELAY_MAX;
+    if (c->curr_rtt >= cc->min_rtt + eta)
+        exit_slow_start(cc);
+}
+
+static void cubic_on_ack(CongestionControl *cc, int acked, int64_t ackno, int64_t next_seqno, uint64_t now)
+{
+    CubicState *c = &cc->u.cubic;
+
+    if (cc->state == CC_SLOW_START) {
+        if (!c->found && cc->cwnd >= HYSTART_LOW_WINDOW)
+            hystart_on_ack(cc, ackno, next_seqno, now);
+        if (cc->state == CC_SLOW_START) {
+            acked = cc_slow_start(cc, acked);
+            if (acked == 0)
+                return;
+        }
+    }
+
+    if (c->epoch_start == 0) { //first ack of a congestion avoidance epoch, anchor the cubic function here
+        c->epoch_start = now;
+        c->w_est = cc->cwnd;
+        if (cc->cwnd < c->w_max) {
+            c->k = cbrt((c->w_max - cc->cwnd) / CUBIC_C);
+            c->origin = c->w_max;
+        } else {
+            c->k = 0;
+            c->origin = cc->cwnd;
+        }
+    }
+
+    double t = (double)(now - c->epoch_start + cc->min_rtt) / 1e6; //where the window should be one rtt from now
+    double target = c->origin + CUBIC_C * (t - c->k) * (t - c->k) * (t - c->k);
+    if (target > 1.5 * cc->cwnd) //never more than 50% growth per rtt
+        target = 1.5 * cc->cwnd;
+
+    if (target > cc->cwnd)
+        cc->cwnd += acked * (target - cc->cwnd) / cc->cwnd;
+    else
+        cc->cwnd += acked * 0.01 / cc->cwnd; //plateau, creep up very slowly
+
+    //Reno friendly region: with a short rtt Reno would grow faster than the cubic curve, follow it then
+    c->w_est += acked * (3.0 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA)) / cc->cwnd;
+    if (c->w_est > cc->cwnd)
+        cc->cwnd = c->w_est;
+}
+
+static void reduce(CongestionControl *cc)
+{
+    CubicState *c = &cc->u.cubic;
+
+    if (cc->cwnd < c->w_max) //fast convergence, a flow that keeps losing below its old maximum leaves room for others
+        c->w_max = cc->cwnd * (1 + CUBIC_BETA) / 2;
+    else
+        c->w_max = cc->cwnd;
+    cc->ssthresh = (int)(cc->cwnd * CUBIC_BETA);
+    if (cc->ssthresh < 2)
+        cc->ssthresh = 2;
+    c->epoch_start = 0;
+}
+
+static void cubic_on_loss(CongestionControl *cc, uint64_t now)
+{
+    (void)now;
+    reduce(cc);
+    cc->cwnd = cc->ssthresh; //multiplicative decrease by beta, no restart from 1
+    cc->state = CC_CONGESTION_AVOIDANCE;
+}
+
+static void cubic_on_timeout(CongestionControl *cc, uint64_t now)
+{
+    reduce(cc);
+    cc->cwnd = 1;
+    cc->state = CC_SLOW_START;
+    cc->u.cubic.found = false; //slow start again, HyStart may end it again
+    hystart_reset(&cc->u.cubic, 0, now);
+}
+
+const CongestionOps cc_cubic = {
+    .name = "cubic",
+    .fast_recovery = true,
+    .init = cubic_init,
+    .on_ack = cubic_on_ack,
+    .on_loss = cubic_on_loss,
+    .on_timeout = cubic_on_timeout,
+    .on_rtt_sample = cubic_on_rtt_sample,
+    .pacing_rate = NULL,
+};
@@ -0,0 +1,53 @@
+#include <stddef.h>
+#include "cc.h"
+
+/*
+ * The original algorithm of this sender: slow start up to ssthresh, then +1/cwnd per ack. A fast retransmit
+ * halves the window (the front end runs NewReno fast recovery around it), an rto halves ssthresh and restarts
+ * slow start from a window of 1.
+ */
+
+static void reno_init(CongestionControl *cc)
+{
+    (void)cc;
+}
+
+static void reno_on_ack(CongestionControl *cc, int acked, int64_t ackno, int64_t next_seqno, uint64_t now)
+{
+    (void)ackno;
+    (void)next_seqno;
+    (void)now;
+    if (cc->state == CC_SLOW_START) {
+        acked = cc_slow_start(cc, acked); //the window doubles every rtt
+    }
+    for (int i = 0; i < acked; i++) {
+        cc->cwnd += 1.0 / cc->cwnd; //one segment more per window worth of acks
+    }
+}
+
+static void reno_on_loss(CongestionControl *cc, uint64_t now)
+{
+    (void)now;
+    int half_window = (int)cc->cwnd / 2;
+    cc->ssthresh = half_window > 2 ? half_window : 2; //enforcing min ssthresh of 2
+    cc->cwnd = cc->ssthresh;
+    cc->state = CC_CONGESTION_AVOIDANCE;
+}
+
+static void reno_on_timeout(CongestionControl *cc, uint64_t now)
+{
+    reno_on_loss(cc, now);
+    cc->cwnd = 1;
+    cc->state = CC_SLOW_START;
+}
+
+const CongestionOps cc_reno = {
+    .name = "reno",
+    .fast_recovery = true,
+    .init = reno_init,
+    .on_ack = reno_on_ack,
+    .on_loss = reno_on_loss,
+    .on_timeout = reno_on_timeout,
+    .on_rtt_sample = NULL,
+    .pacing_rate = NULL,
+};
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include "cc.h"
+
+/*
+ * cc_test: drives the congestion control modules the way the sender does, without a network. Exits non zero
+ * when one of the checks fails
+ */
+
+#define MSS 1420
+#define ACK_INTERVAL 75 //microseconds between acks
+
+static int failures;
+
+static void check(bool ok, const char *what)
+{
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+//after an rto the first cumulative ack can cover the whole SACKed range, slow start must not jump with it
+static void slow_start_after_timeout(const CongestionOps *ops)
+{
+    CongestionControl cc;
+    char what[128];
+    uint64_t now = 0;
+
+    cc_init(&cc, ops, 64, 1000, MSS);
+    for (int i = 0; i < 40; i++)
+        cc_on_ack(&cc, 1, 0, 0, now += ACK_INTERVAL);
+    cc_on_timeout(&cc, now);
+    double before = cc.cwnd;
+    cc_on_ack(&cc, 74, 0, 0, now += ACK_INTERVAL);
+    snprintf(what, sizeof(what), "%s: one ack of 74 segments after an rto grows cwnd %.2f -> %.2f, by at most 2",
+             ops->name, before, cc.cwnd);
+    check(cc.cwnd <= before + 2, what);
+}
+
+/*
+ * bbr: 1 ms of path delay, after half a second a standing queue adds 0.5 ms to every sample. Once the min rtt
+ * is 10 s old BBR has to go to PROBE_RTT, keep the 1 ms until then and come back out after the dwell, where the
+ * drained queue shows the 1 ms again
+ */
+static void bbr_probe_rtt(void)
+{
+    CongestionControl cc;
+    RateSample rs = {0};
+    uint64_t entered = 0, left = 0, min_rtt_before = 0;
+
+    cc_init(&cc, &cc_bbr, 64, 1000, MSS);
+    for (uint64_t now = ACK_INTERVAL; now < 11000000; now += ACK_INTERVAL) {
+        bool drained = cc.state == CC_PROBE_RTT || now < 500000;
+        cc_on_rtt_sample(&cc, drained ? 1000 : 1500, now); //the sender's order: rtt sample first, then the rate sample
+        rs.total_delivered++;
+        rs.prior_delivered = rs.total_delivered - 10;
+        rs.delivered = 1;
+        rs.delivery_rate = 10000; //segments per second
+        rs.in_flight = cc_cwnd(&cc);
+        cc_on_rate_sample(&cc, &rs, now);
+        if (cc.state == CC_PROBE_RTT && entered == 0) {
+            entered = now;
+            min_rtt_before = cc.u.bbr.min_rtt;
+        }
+        if (entered != 0 && left == 0 && cc.state != CC_PROBE_RTT)
+            left = now;
+    }
+    check(entered != 0 && entered < 11000000, "bbr: enters PROBE_RTT once the min rtt is 10 s old");
+    check(min_rtt_before == 1000, "bbr: queued samples do not replace the min rtt before PROBE_RTT");
+    check(left != 0 && left - entered < 500000, "bbr: leaves PROBE_RTT after the dwell");
+    check(cc.u.bbr.min_rtt == 1000, "bbr: min rtt after PROBE_RTT is the drained 1 ms");
+}
+
+int main()
+{
+    slow_start_after_timeout(&cc_reno);
+    slow_start_after_timeout(&cc_cubic);
+    bbr_probe_rtt();
+    return failures != 0;
+}
@@ -2,7 +2,7 @@
 #include <stdlib.h>
 #include"common.h"
 
-int verbose = ALL;
+int verbose = INFO | WARNING; //-v adds the per packet / per ack DEBUG lines
 /*
  * error - wrapper for perror
  */
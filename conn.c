@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "conn.h"
+#include "common.h"
+
+/*
+ * Chained hash table of the connections a receiver worker serves. Each worker owns its table (SO_REUSEPORT
+ * sends all packets of a client to the same socket), so there is no locking here
+ */
+
+static unsigned int conn_hash(const struct sockaddr_in *addr, unsigned int id)
+{
+    unsigned int h = addr->sin_addr.s_addr * 2654435761u; //Knuth's multiplicative hash, then mix in port and id
+    h ^= ((unsigned int)addr->sin_port << 16) | addr->sin_port;
+    h ^= id * 0x9e3779b9u;
+    return h ^ (h >> 15);
+}
+
+static bool conn_matches(const Connection *c, const struct sockaddr_in *addr, unsigned int id)
+{
+    return c->id == id && c->addr.sin_addr.s_addr == addr->sin_addr.s_addr && c->addr.sin_port == addr->sin_port;
+}
+
+void conn_table_init(ConnTable *t)
+{
+    t->nbuckets = CONN_TABLE_INITIAL;
+    t->count = 0;
+    t->buckets = calloc(t->nbuckets, sizeof(Connection *));
+    if (t->buckets == NULL)
+        error("conn_table_init");
+}
+
+void conn_table_free(ConnTable *t)
+{
+    free(t->buckets);
+    t->buckets = NULL;
+    t->nbuckets = 0;
+    t->count = 0;
+}
+
+Connection* conn_lookup(const ConnTable *t, const struct sockaddr_in *addr, unsigned int id)
+{
+    Connection *c = t->buckets[conn_hash(addr, id) & (t->nbuckets - 1)];
+    while (c != NULL && !conn_matches(c, addr, id))
+        c = c->next;
+    return c;
+}
+
+static void grow(ConnTable *t)
+{
+    int nbuckets = t->nbuckets * 2;
+    Connection **buckets = calloc(nbuckets, sizeof(Connection *));
+    if (buckets == NULL)
+        error("conn_table grow");
+
+    for (int i = 0; i < t->nbuckets; i++) { //rehash every chain into the bigger array
+        Connection *c = t->buckets[i];
+        while (c != NULL) {
+            Connection *next = c->next;
+            unsigned int b = conn_hash(&c->addr, c->id) & (nbuckets - 1);
+            c->next = buckets[b];
+            buckets[b] = c;
+            c = next;
+        }
+    }
+    free(t->buckets);
+    t->buckets = buckets;
+    t->nbuckets = nbuckets;
+}
+
+void conn_insert(ConnTable *t, Connection *c)
+{
+    if (t->count >= t->nbuckets)
+        grow(t);
+    unsigned int b = conn_hash(&c->addr, c->id) & (t->nbuckets - 1);
+    c->next = t->buckets[b];
+    t->buckets[b] = c;
+    t->count++;
+}
+
+void conn_remove(ConnTable *t, Connection *c)
+{
+    Connection **p = &t->buckets[conn_hash(&c->addr, c->id) & (t->nbuckets - 1)];
+    while (*p != NULL && *p != c)
+        p = &(*p)->next;
+    if (*p == c) {
+        *p = c->next;
+        c->next = NULL;
+        t->count--;
+    }
+}
+
+/*
+ * Output files are shared by all workers, flows of one transfer can hash onto different sockets. A transfer
+ * opens its file once and holds a handful of them at a time, so a list under one lock is plenty
+ */
+static OutputFile *outputs = NULL;
+static pthread_mutex_t outputs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * output_get: with a journal that belongs to this transfer the file is kept as it is and the journal says
+ * which parts of it are good, otherwise the file starts empty
+ */
+OutputFile* output_get(const struct in_addr *host, unsigned int id, int flows, const char *path, bool journal)
+{
+    OutputFile *f;
+
+    pthread_mutex_lock(&outputs_lock);
+    for (f = outputs; f != NULL; f = f->next) {
+        if (f->id == id && f->host.s_addr == host->s_addr)
+            break;
+    }
+    if (f == NULL) { //first flow of the transfer, create an empty file or overwrite an existing one
+        f = calloc(1, sizeof(OutputFile));
+        if (f == NULL)
+            error("output_get");
+        if (journal) {
+            journal_path(f->journal, sizeof(f->journal), path);
+            if (journal_load(f->journal, id, &f->done) == 0)
+                f->resumed = f->size = ranges_end(&f->done);
+        }
+        f->fd = open(path, O_RDWR | O_CREAT | (f->resumed > 0 ? 0 : O_TRUNC), 0644);
+        if (f->fd < 0) {
+            perror(path);
+            ranges_free(&f->done);
+            free(f);
+            pthread_mutex_unlock(&outputs_lock);
+            return NULL;
+        }
+        f->host = *host;
+        f->id = id;
+        f->flows = flows > 0 ? flows : 1;
+        snprintf(f->path, sizeof(f->path), "%s", path);
+        pthread_mutex_init(&f->lock, NULL);
+        if (f->resumed > 0)
+            printf("resuming %s: %llu bytes in %d ranges already there\n", path, (unsigned long long)ranges_bytes(&f->done), f->done.count);
+        f->next = outputs;
+        outputs = f;
+    }
+    f->refs++;
+    pthread_mutex_unlock(&outputs_lock);
+    return f;
+}
+
+bool output_put(OutputFile *f, size_t end, bool finished)
+{
+    bool last;
+
+    pthread_mutex_lock(&outputs_lock);
+    if (end > f->size)
+        f->size = end;
+    f->finished += finished;
+    f->refs--;
+    //wait for the flows that have not shown up yet, unless this one gave up, then nobody is coming back
+    last = f->refs == 0 && (f->finished >= f->flows || !finished);
+    if (last) {
+        OutputFile **p = &outputs;
+        while (*p != f)
+            p = &(*p)->next;
+        *p = f->next;
+    }
+    pthread_mutex_unlock(&outputs_lock);
+
+    if (!last)
+        return false;
+    if (ftruncate(f->fd, f->size) < 0) //scatter receive preallocates past the real end
+        perror("ftruncate");
+    if (fsync(f->fd) < 0)
+        perror("fsync");
+    if (f->journal[0] != '\0' && f->finished >= f->flows) { //complete, nothing to resume
+        unlink(f->journal);
+    } else if (f->journal[0] != '\0') {
+        journal_save(f->journal, f->id, &f->done);
+        printf("%s incomplete, %llu bytes in %d ranges kept in %s\n", f->path, (unsigned long long)ranges_bytes(&f->done),
+               f->done.count, f->journal);
+    }
+    close(f->fd);
+    pthread_mutex_destroy(&f->lock);
+    ranges_free(&f->done);
+    free(f);
+    return true;
+}
+
+/*
+ * output_checkpoint: the data has to be on disk before the journal says so, one fdatasync covers the writes
+ * of every flow. Only ever waits for the disk every checkpoint interval
+ */
+void output_checkpoint(OutputFile *f, const RangeSet *landed)
+{
+    if (f->journal[0] == '\0')
+        return;
+    pthread_mutex_lock(&f->lock);
+    if (fdatasync(f->fd) < 0)
+        perror("fdatasync");
+    ranges_merge(&f->done, landed);
+    journal_save(f->journal, f->id, &f->done);
+    f->checkpoints++;
+    pthread_mutex_unlock(&f->lock);
+}
+
+int output_progress(const struct in_addr *host, unsigned int id, const char *path, char *buf, int cap)
+{
+    char journal[PATH_MAX + 16];
+    RangeSet done;
+    OutputFile *f;
+    int len;
+
+    pthread_mutex_lock(&outputs_lock);
+    for (f = outputs; f != NULL; f = f->next) {
+        if (f->id == id && f->host.s_addr == host->s_addr)
+            break;
+    }
+    if (f != NULL) { //a flow of it is still open (the sender died, not us), what it checkpointed is good
+        pthread_mutex_lock(&f->lock);
+        len = ranges_pack(&f->done, buf, cap);
+        pthread_mutex_unlock(&f->lock);
+        pthread_mutex_unlock(&outputs_lock);
+        return len;
+    }
+    pthread_mutex_unlock(&outputs_lock);
+    ranges_init(&done);
+    journal_path(journal, sizeof(journal), path);
+    journal_load(journal, id, &done);
+    len = ranges_pack(&done, buf, cap);
+    ranges_free(&done);
+    return len;
+}
@@ -0,0 +1,105 @@
+#ifndef CONN_H
+#define CONN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include "reorder.h"
+#include "writer.h"
+#include "filemap.h"
+#include "fec.h"
+#include "zstream.h"
+#include "journal.h"
+
+#define CONN_TABLE_INITIAL 64 //buckets, the table doubles when it holds more connections than buckets
+
+enum ack_reason { //why an ack left, the receiver prints the split at the end
+    ACK_EVERY,        //ack_every in order segments arrived
+    ACK_DELAYED,      //the delayed ack timer ran out
+    ACK_OUT_OF_ORDER, //a segment above a hole, the sender needs the dup ack and SACK right away
+    ACK_GAP_FILL,     //a segment that filled (part of) a hole
+    ACK_DUPLICATE,    //a segment we already had, the sender may have lost our ack
+    ACK_EOF,
+    ACK_REASONS
+};
+
+/*
+ * The output file of a transfer. A striped transfer has several flows, each its own connection (and maybe on
+ * another worker), that all write into the one file by offset. They find it here by client host and conn_id
+ */
+typedef struct OutputFile {
+    struct in_addr host;
+    unsigned int id;
+    int flows;                     //flows the sender stripes the file over, 1 for a plain transfer
+    char path[PATH_MAX];
+    int fd;
+    int refs;                      //connections writing into it right now
+    int finished;                  //flows that got to their eof
+    size_t size;                   //end of the highest byte any flow wrote, the file is cut to it in the end
+    char journal[PATH_MAX + 16];   //progress journal, empty when the receiver keeps none
+    pthread_mutex_t lock;          //journal: done, checkpoints
+    RangeSet done;                 //journal: byte ranges known to be on disk
+    size_t resumed;                //end of what an earlier run left in the file, 0 for a new one
+    unsigned long checkpoints;
+    struct OutputFile *next;
+} OutputFile;
+
+/*
+ * One flow of an inbound transfer, everything that used to be global in the receiver. A connection is identified by the
+ * client's address and port plus the conn_id the sender stamps on every packet, so a sender that restarts
+ * from the same port is a new transfer and not a continuation of the old one
+ */
+typedef struct Connection {
+    struct sockaddr_in addr;       //client, acks go back here
+    unsigned int id;               //conn_id of the client's packets, echoed in our acks
+    struct Connection *next;       //hash chain
+
+    int64_t expectedseq;           //next byte we expect, everything below is in the output file (or on its way there)
+    int seg_size;                  //the sender's full segment, from its first packet
+    int64_t last_ack_sent;
+    unsigned int ts_recent;        //tsval of the packet being handled, echoed in the acks it triggers
+    int recent_seg;                //segment of the last out of order packet, its SACK range is reported first
+    ReorderBuf reorder;            //out of order segments, in scatter mode only the bitmap and lengths are used
+    FecDecoder *fec;               //NULL unless the sender sends parity
+    ZReader *z;                    //NULL unless the sender compresses
+
+    OutputFile *out;               //shared with the other flows of a striped transfer
+    Writer writer;                 //each flow has its own writer on out->fd
+    bool scatter;                  //payloads are received straight into output_map
+    FileMap output_map;            //this flow's mapping of out->fd
+    size_t highest_end;            //file offset one past the highest byte written so far, in scatter mode the next batch is received right here
+    RangeSet landed;               //journal: byte ranges written since the last checkpoint
+    unsigned long scatter_direct;  //payloads that landed at their final offset straight from the socket
+    unsigned long scatter_copies;  //payloads that had to be copied once (loss, reordering)
+
+    bool eof_received;             //after the eof we only linger for retransmissions
+    uint64_t opened;               //microseconds of the monotonic clock, first packet from the client
+    uint64_t last_active;          //last packet from the client
+    int unacked_segments;          //in order segments received since the last ack
+    uint64_t ack_deadline;         //when the held back ack has to go, 0 if none
+
+    unsigned long data_packets;    //stats, acks per data packet is what the delayed acks save
+    unsigned long acks_sent[ACK_REASONS];
+    unsigned long long ack_bytes;  //reverse path bytes, headers and SACK ranges
+} Connection;
+
+typedef struct {
+    Connection **buckets;
+    int nbuckets;                  //power of two
+    int count;
+} ConnTable;
+
+void conn_table_init(ConnTable *t);
+void conn_table_free(ConnTable *t); //only the buckets, connections are closed by their owner first
+Connection* conn_lookup(const ConnTable *t, const struct sockaddr_in *addr, unsigned int id); //NULL when unknown
+void conn_insert(ConnTable *t, Connection *c); //addr and id must be set
+void conn_remove(ConnTable *t, Connection *c);
+
+OutputFile* output_get(const struct in_addr *host, unsigned int id, int flows, const char *path, bool journal); //open (or join) the transfer's file, NULL if it can not be created
+bool output_put(OutputFile *f, size_t end, bool finished); //a flow is done with the file, true when it was the last one and the file is complete and closed
+void output_checkpoint(OutputFile *f, const RangeSet *landed); //landed is written (not necessarily synced), make it durable and record it
+int output_progress(const struct in_addr *host, unsigned int id, const char *path, char *buf, int cap); //what a returning sender may skip, packed ranges
+
+#endif /* CONN_H */
@@ -0,0 +1,262 @@
+#include <string.h>
+#include "crc32c.h"
+
+#define POLY 0x82f63b78 //Castagnoli polynomial, bit reflected
+
+/*
+ * Portable version: slicing by 8, eight table lookups per 8 bytes. The x86 version uses the SSE4.2 crc32
+ * instruction on three independent streams at once (it has a latency of 3 cycles but a throughput of 1)
+ * and joins the three crcs with PCLMULQDQ. That tops out at 8 bytes a cycle, where AVX-512 VPCLMULQDQ is
+ * there a segment is instead folded 256 bytes at a time with carry-less multiplies. The implementation is
+ * picked on the first call
+ */
+
+static uint32_t table[8][256];
+
+static void make_table(void)
+{
+    for (int i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+        table[0][i] = c;
+    }
+    for (int i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+}
+
+static uint32_t crc_table(uint32_t c, const unsigned char *p, size_t len)
+{
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v ^= c; //little endian, like everything this builds on
+        c = table[7][v & 0xff] ^ table[6][(v >> 8) & 0xff] ^ table[5][(v >> 16) & 0xff] ^ table[4][(v >> 24) & 0xff] ^
+            table[3][(v >> 32) & 0xff] ^ table[2][(v >> 40) & 0xff] ^ table[1][(v >> 48) & 0xff] ^ table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        c = (c >> 8) ^ table[0][(c ^ *p++) & 0xff];
+    return c;
+}
+
+/*
+ * multmodp: a * b mod P with both in the bit reflected representation (x^0 is the top bit), as in zlib
+ */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31, p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+    }
+    return p;
+}
+
+static uint32_t xpowmodp(unsigned n) //x^n mod P
+{
+    uint32_t r = 1u << 31, sq = 1u << 30; //1 and x
+    for (; n; n >>= 1) {
+        if (n & 1)
+            r = multmodp(r, sq);
+        sq = multmodp(sq, sq);
+    }
+    return r;
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+#define LONG_BLOCK 256  //bytes per stream, three of these per round while there is that much left
+#define SHORT_BLOCK 64  //then rounds of three of these, a packet's payload mostly goes through the two
+
+#define FOLD_BLOCK 256  //bytes per round of the VPCLMULQDQ version, four 64 byte registers
+
+static uint32_t k_long, k_short; //multipliers that move a crc over LONG_BLOCK / SHORT_BLOCK zero bytes
+static uint64_t k_fold[3][2];    //fold constants for the low and high half of a 128 bit lane, 256, 64 and 16 bytes ahead
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t c, const unsigned char *p, size_t len)
+{
+    uint64_t c64 = c;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c64 = _mm_crc32_u64(c64, v);
+        p += 8;
+        len -= 8;
+    }
+    c = c64;
+    while (len-- > 0)
+        c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+
+/*
+ * shift: the crc of a block followed by n zero bytes. The carry-less product with x^(8n - 33) is 64 bits
+ * wide and the crc32 instruction reduces it (it multiplies by x^32 and the reflection costs one more)
+ */
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t shift(uint32_t c, uint32_t k)
+{
+    __m128i prod = _mm_clmulepi64_si128(_mm_cvtsi32_si128(c), _mm_cvtsi32_si128(k), 0);
+    return _mm_crc32_u64(0, _mm_cvtsi128_si64(prod));
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc_round(uint32_t c, const unsigned char *p, size_t block, uint32_t k)
+{
+    uint64_t a = c, b = 0, d = 0;
+    for (size_t i = 0; i < block; i += 8) {
+        uint64_t va, vb, vd;
+        memcpy(&va, p + i, 8);
+        memcpy(&vb, p + block + i, 8);
+        memcpy(&vd, p + 2 * block + i, 8);
+        a = _mm_crc32_u64(a, va);
+        b = _mm_crc32_u64(b, vb);
+        d = _mm_crc32_u64(d, vd);
+    }
+    return shift(shift(a, k) ^ (uint32_t)b, k) ^ (uint32_t)d;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc_pclmul(uint32_t c, const unsigned char *p, size_t len)
+{
+    while (len >= 3 * LONG_BLOCK) {
+        c = crc_round(c, p, LONG_BLOCK, k_long);
+        p += 3 * LONG_BLOCK;
+        len -= 3 * LONG_BLOCK;
+    }
+    while (len >= 3 * SHORT_BLOCK) {
+        c = crc_round(c, p, SHORT_BLOCK, k_short);
+        p += 3 * SHORT_BLOCK;
+        len -= 3 * SHORT_BLOCK;
+    }
+    return crc_sse42(c, p, len);
+}
+
+/*
+ * Folding: 128 bits of the message with bit 0 the highest power are worth the same mod P as its low half
+ * times x^(n + 64) plus its high half times x^n once they are moved n bits further on. One carry-less product
+ * of a half with x^(n + 63) mod P, resp. x^(n - 1), lands exactly there (the bit reflection costs one power).
+ * The crc that came in is xored into the first bytes, so what is left after folding is 16 message bytes after
+ * a crc of 0, which the crc32 instruction takes from there
+ */
+static void fold_constants(uint64_t k[2], unsigned bytes)
+{
+    k[0] = (uint64_t)xpowmodp(8 * bytes + 63) << 32;
+    k[1] = (uint64_t)xpowmodp(8 * bytes - 1) << 32;
+}
+
+__attribute__((target("avx512f,vpclmulqdq")))
+static inline __m512i fold512(__m512i x, __m512i k, __m512i next)
+{
+    return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00), _mm512_clmulepi64_epi128(x, k, 0x11), next, 0x96); //a ^ b ^ c
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static inline __m128i fold128(__m128i x, __m128i k, __m128i next)
+{
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), next);
+}
+
+__attribute__((target("avx512f,vpclmulqdq,sse4.2,pclmul")))
+static uint32_t crc_vpclmul(uint32_t c, const unsigned char *p, size_t len)
+{
+    if (len < FOLD_BLOCK) {
+        return crc_pclmul(c, p, len);
+    }
+    __m512i k = _mm512_broadcast_i32x4(_mm_set_epi64x(k_fold[0][1], k_fold[0][0]));
+    __m512i a0 = _mm512_xor_si512(_mm512_loadu_si512(p), _mm512_zextsi128_si512(_mm_cvtsi32_si128(c)));
+    __m512i a1 = _mm512_loadu_si512(p + 64);
+    __m512i a2 = _mm512_loadu_si512(p + 128);
+    __m512i a3 = _mm512_loadu_si512(p + 192);
+    p += FOLD_BLOCK;
+    len -= FOLD_BLOCK;
+    while (len >= FOLD_BLOCK) { //four independent chains hide the latency of the multiplies
+        a0 = fold512(a0, k, _mm512_loadu_si512(p));
+        a1 = fold512(a1, k, _mm512_loadu_si512(p + 64));
+        a2 = fold512(a2, k, _mm512_loadu_si512(p + 128));
+        a3 = fold512(a3, k, _mm512_loadu_si512(p + 192));
+        p += FOLD_BLOCK;
+        len -= FOLD_BLOCK;
+    }
+    k = _mm512_broadcast_i32x4(_mm_set_epi64x(k_fold[1][1], k_fold[1][0]));
+    a3 = fold512(fold512(fold512(a0, k, a1), k, a2), k, a3);
+    while (len >= 64) {
+        a3 = fold512(a3, k, _mm512_loadu_si512(p));
+        p += 64;
+        len -= 64;
+    }
+    __m128i k16 = _mm_set_epi64x(k_fold[2][1], k_fold[2][0]);
+    __m128i x = _mm512_extracti32x4_epi32(a3, 0);
+    x = fold128(x, k16, _mm512_extracti32x4_epi32(a3, 1));
+    x = fold128(x, k16, _mm512_extracti32x4_epi32(a3, 2));
+    x = fold128(x, k16, _mm512_extracti32x4_epi32(a3, 3));
+    while (len >= 16) {
+        x = fold128(x, k16, _mm_loadu_si128((const __m128i *)p));
+        p += 16;
+        len -= 16;
+    }
+    c = _mm_crc32_u64(_mm_crc32_u64(0, _mm_cvtsi128_si64(x)), _mm_extract_epi64(x, 1));
+    return crc_sse42(c, p, len);
+}
+#endif
+
+static uint32_t crc_pick(uint32_t c, const unsigned char *p, size_t len);
+static uint32_t (*crc_impl)(uint32_t, const unsigned char *, size_t) = crc_pick;
+static const char *impl_name = "table";
+
+static uint32_t crc_pick(uint32_t c, const unsigned char *p, size_t len)
+{
+    uint32_t (*impl)(uint32_t, const unsigned char *, size_t) = crc_table;
+
+    make_table();
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+        k_long = xpowmodp(8 * LONG_BLOCK - 33);
+        k_short = xpowmodp(8 * SHORT_BLOCK - 33);
+        impl = crc_pclmul;
+        impl_name = "sse4.2 + pclmul";
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq")) {
+            fold_constants(k_fold[0], FOLD_BLOCK);
+            fold_constants(k_fold[1], 64);
+            fold_constants(k_fold[2], 16);
+            impl = crc_vpclmul;
+            impl_name = "vpclmulqdq";
+        }
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        impl = crc_sse42;
+        impl_name = "sse4.2";
+    }
+#endif
+    crc_impl = impl; //racing threads all pick the same one
+    return impl(c, p, len);
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    return ~crc_impl(~crc, buf, len);
+}
+
+uint32_t crc32c_portable(uint32_t crc, const void *buf, size_t len)
+{
+    if (crc_impl == crc_pick)
+        crc_pick(0, NULL, 0);
+    return ~crc_table(~crc, buf, len);
+}
+
+const char* crc32c_impl(void)
+{
+    if (crc_impl == crc_pick)
+        crc_pick(0, NULL, 0);
+    return impl_name;
+}
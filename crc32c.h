@@ -0,0 +1,15 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * CRC-32C (Castagnoli, the iSCSI / SCTP / ext4 checksum). crc32c(0, buf, len) checksums buf and
+ * crc32c(crc32c(0, a, n), b, m) is the checksum of a and b back to back, like zlib's crc32
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);          //fastest implementation the cpu has
+uint32_t crc32c_portable(uint32_t crc, const void *buf, size_t len); //table driven, any cpu
+const char* crc32c_impl(void);                                      //name of the one crc32c uses
+
+#endif /* CRC32C_H */
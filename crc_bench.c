@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crc32c.h"
+#include "packet.h"
+
+#define ROUNDS 200000
+
+/*
+ * crc_bench: checks the accelerated crc32c against the table version, then times both on
+ * full segments and prints what share of one core the checksum costs at common line rates
+ */
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench(uint32_t (*fn)(uint32_t, const void *, size_t), const char *buf, size_t len, uint32_t *sink)
+{
+    uint32_t crc = 0;
+    double start = seconds();
+    for (int i = 0; i < ROUNDS; i++) {
+        crc = fn(crc, buf, len); //chained so the calls can not be hoisted
+    }
+    *sink ^= crc;
+    return (seconds() - start) / ROUNDS;
+}
+
+int main()
+{
+    static const int rates[] = {10, 25, 40, 100}; //Gbit/s
+    static char buf[MSS_SIZE];
+    uint32_t sink = 0;
+
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = rand();
+    }
+    for (size_t len = 0; len <= sizeof(buf); len++) { //every length, so each tail path is covered
+        if (crc32c(0, buf, len) != crc32c_portable(0, buf, len)) {
+            printf("crc32c mismatch at length %zu\n", len);
+            return 1;
+        }
+    }
+
+    printf("%d byte segments\n", MSS_SIZE);
+    const char *names[] = {crc32c_impl(), "table"};
+    uint32_t (*fns[])(uint32_t, const void *, size_t) = {crc32c, crc32c_portable};
+    for (int f = 0; f < 2; f++) {
+        double per = bench(fns[f], buf, sizeof(buf), &sink);
+        printf("%-16s %6.2f GB/s %8.1f ns/packet  core share at", names[f], sizeof(buf) / per / 1e9, per * 1e9);
+        for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+            double pps = rates[r] * 1e9 / 8 / MSS_SIZE;
+            printf(" %dG %.1f%%", rates[r], pps * per * 100);
+        }
+        printf("\n");
+    }
+    return sink == 1; //keeps the results live
+}
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "fec.h"
+#include "common.h"
+
+#define GF_POLY 0x11d //x^8 + x^4 + x^3 + x^2 + 1, the usual Reed-Solomon field
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t gf_mul[256][256]; //a row per factor, region_mul_add is then one lookup per byte
+static pthread_once_t gf_once = PTHREAD_ONCE_INIT;
+
+static void gf_init(void)
+{
+    int x = 1;
+    for (int i = 0; i < 255; i++) {
+        gf_exp[i] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= GF_POLY;
+    }
+    for (int i = 255; i < 512; i++) //so a product never needs the % 255
+        gf_exp[i] = gf_exp[i - 255];
+    for (int a = 1; a < 256; a++)
+        for (int b = 1; b < 256; b++)
+            gf_mul[a][b] = gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static uint8_t gf_inv(uint8_t a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+/*
+ * coef_init: x_r = r and y_i = FEC_MAX_M + i never meet, so 1 / (x_r + y_i) is a Cauchy matrix. Column i is
+ * scaled by x_0 + y_i, which makes row 0 all ones (plain XOR) and keeps every square submatrix invertible
+ */
+static void coef_init(uint8_t coef[FEC_MAX_M][FEC_MAX_K], int k, int m)
+{
+    pthread_once(&gf_once, gf_init);
+    for (int r = 0; r < m; r++) {
+        for (int i = 0; i < k; i++) {
+            uint8_t y = FEC_MAX_M + i;
+            coef[r][i] = gf_mul[gf_inv(r ^ y)][y];
+        }
+    }
+}
+
+/*
+ * region_mul_add: dst += c * src over GF(256). c = 1 is a plain XOR, the only case with m = 1
+ */
+static void region_mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, int len)
+{
+    int i = 0;
+
+    if (c == 0)
+        return;
+    if (c == 1) {
+        for (; i + 8 <= len; i += 8) {
+            uint64_t a, b;
+            memcpy(&a, dst + i, 8);
+            memcpy(&b, src + i, 8);
+            a ^= b;
+            memcpy(dst + i, &a, 8);
+        }
+        for (; i < len; i++)
+            dst[i] ^= src[i];
+        return;
+    }
+    const uint8_t *t = gf_mul[c];
+    for (; i < len; i++)
+        dst[i] ^= t[src[i]];
+}
+
+static void region_scale(uint8_t *buf, uint8_t c, int len)
+{
+    const uint8_t *t = gf_mul[c];
+    for (int i = 0; i < len; i++)
+        buf[i] = t[buf[i]];
+}
+
+static void meta_mul_add(FecMeta *dst, const FecMeta *src, uint8_t c)
+{
+    region_mul_add((uint8_t *)dst, (const uint8_t *)src, c, sizeof(FecMeta)); //byte by byte, so byte order does not matter
+}
+
+void fec_encoder_init(FecEncoder *e, int k, int m, int nsets, int seg_size)
+{
+    memset(e, 0, sizeof(*e));
+    e->k = k;
+    e->m = m;
+    e->seg_size = seg_size;
+    e->nsets = nsets < 2 ? 2 : nsets;
+    coef_init(e->coef, k, m);
+    e->parity = malloc((size_t)e->nsets * m * seg_size);
+    e->meta = malloc((size_t)e->nsets * m * sizeof(FecMeta));
+    if (e->parity == NULL || e->meta == NULL)
+        error("fec_encoder_init");
+}
+
+void fec_encoder_free(FecEncoder *e)
+{
+    free(e->parity);
+    free(e->meta);
+    e->parity = NULL;
+    e->meta = NULL;
+}
+
+static uint8_t* enc_row(const FecEncoder *e, int row)
+{
+    return e->parity + ((size_t)e->set * e->m + row) * e->seg_size;
+}
+
+bool fec_encode(FecEncoder *e, const tcp_header *hdr, const char *data)
+{
+    FecMeta meta = {hdr->offset, hdr->data_size, hdr->ctr_flags};
+    int len = hdr->data_size;
+
+    if (e->count == 0) { //the set is cleared only now, its last parity may have been in the batch until the flush
+        memset(enc_row(e, 0), 0, (size_t)e->m * e->seg_size);
+        memset(e->meta + e->set * e->m, 0, e->m * sizeof(FecMeta));
+        e->first_seqno = hdr->seqno;
+        e->first_offset = hdr->offset;
+        e->len = 0;
+    }
+    for (int r = 0; r < e->m; r++) {
+        uint8_t c = e->coef[r][e->count];
+        region_mul_add(enc_row(e, r), (const uint8_t *)data, c, len);
+        meta_mul_add(&e->meta[e->set * e->m + r], &meta, c);
+    }
+    if (len > e->len)
+        e->len = len;
+    e->count++;
+    return e->count == e->k;
+}
+
+void fec_parity(const FecEncoder *e, int row, tcp_header *hdr, const char **payload)
+{
+    const FecMeta *meta = &e->meta[e->set * e->m + row];
+
+    hdr->ctr_flags = PARITY;
+    hdr->seqno = e->first_seqno;
+    hdr->offset = e->first_offset;
+    hdr->data_size = e->len;
+    hdr->ackno = meta->offset;
+    hdr->rwnd = meta->len | (uint32_t)meta->type << 16;
+    hdr->tsecr = FEC_PARITY_INFO(e->k, e->m, row, e->count);
+    *payload = (const char *)enc_row(e, row);
+}
+
+bool fec_next_block(FecEncoder *e)
+{
+    e->blocks++;
+    e->parity_sent += e->m;
+    e->parity_bytes += (unsigned long long)e->m * e->len;
+    e->count = 0;
+    e->set = (e->set + 1) % e->nsets;
+    return e->set == 0;
+}
+
+void fec_encoder_print_stats(const FecEncoder *e)
+{
+    printf("fec: %d data + %d parity segments per block, %lu blocks, %lu parity packets (%llu bytes)\n",
+           e->k, e->m, e->blocks, e->parity_sent, e->parity_bytes);
+}
+
+int fec_decoder_init(FecDecoder *d, unsigned int geometry, int window, int seg_size)
+{
+    int k = FEC_K(geometry), m = FEC_M(geometry);
+
+    if (k < 1 || k > FEC_MAX_K || m < 1 || m > FEC_MAX_M)
+        return -1;
+    memset(d, 0, sizeof(*d));
+    d->k = k;
+    d->m = m;
+    d->seg_size = seg_size;
+    coef_init(d->coef, k, m);
+    d->nblocks = window / k + 2; //the window plus the partly acked block at its bottom and the one just past its top
+    d->blocks = calloc(d->nblocks, sizeof(FecBlock));
+    uint8_t *rows = calloc((size_t)d->nblocks * m, seg_size);
+    if (d->blocks == NULL || rows == NULL)
+        error("fec_decoder_init");
+    for (int i = 0; i < d->nblocks; i++) {
+        d->blocks[i].block = -1;
+        d->blocks[i].row = rows + (size_t)i * m * seg_size;
+    }
+    return 0;
+}
+
+void fec_decoder_free(FecDecoder *d)
+{
+    if (d->blocks != NULL)
+        free(d->blocks[0].row);
+    free(d->blocks);
+    d->blocks = NULL;
+}
+
+/*
+ * block_slot: the slot of block b, taken over from an older block when create is set. An older block that
+ * was not done by now lost more than it had parity for, the sender retransmits what it misses
+ */
+static FecBlock* block_slot(FecDecoder *d, int b, bool create)
+{
+    FecBlock *s = &d->blocks[b % d->nblocks];
+
+    if (s->block == b)
+        return s;
+    if (!create || s->block > b)
+        return NULL;
+    s->block = b;
+    s->count = d->k;
+    s->have = 0;
+    s->rows = 0;
+    s->done = false;
+    s->len = 0;
+    memset(s->row, 0, (size_t)d->m * d->seg_size);
+    memset(s->meta, 0, sizeof(s->meta));
+    return s;
+}
+
+static int missing(const FecBlock *s)
+{
+    uint64_t all = s->count == 64 ? ~0ULL : (1ULL << s->count) - 1;
+    return s->count - __builtin_popcountll(s->have & all);
+}
+
+static bool solvable(FecBlock *s)
+{
+    int holes = missing(s);
+
+    if (holes == 0)
+        s->done = true;
+    return !s->done && holes <= __builtin_popcount(s->rows);
+}
+
+bool fec_add_data(FecDecoder *d, int seg, const tcp_header *hdr, const char *data)
+{
+    FecMeta meta = {hdr->offset, hdr->data_size, hdr->ctr_flags};
+    int len = hdr->data_size;
+    int i = seg % d->k;
+    FecBlock *s = block_slot(d, seg / d->k, true);
+
+    if (s == NULL || (s->have & 1ULL << i))
+        return false;
+    s->have |= 1ULL << i;
+    if (s->done)
+        return false;
+    for (int r = 0; r < d->m; r++) {
+        region_mul_add(s->row + r * d->seg_size, (const uint8_t *)data, d->coef[r][i], len);
+        meta_mul_add(&s->meta[r], &meta, d->coef[r][i]);
+    }
+    if (len > s->len)
+        s->len = len;
+    return solvable(s);
+}
+
+bool fec_add_parity(FecDecoder *d, const tcp_header *hdr, const char *payload)
+{
+    unsigned int info = hdr->tsecr;
+    int row = FEC_ROW(info), count = FEC_COUNT(info);
+    int seg = hdr->seqno / d->seg_size;
+
+    if (FEC_K(info) != d->k || FEC_M(info) != d->m || row >= d->m || count < 1 || count > d->k ||
+        hdr->seqno % d->seg_size != 0 || seg % d->k != 0 || hdr->data_size > d->seg_size) {
+        return false; //not for the geometry this transfer started with
+    }
+    FecBlock *s = block_slot(d, seg / d->k, true);
+    if (s == NULL || (s->rows & 1 << row))
+        return false;
+    d->parity_received++;
+    s->rows |= 1 << row;
+    s->count = count;
+    if (s->done)
+        return false;
+    FecMeta meta = {hdr->ackno, (uint32_t)hdr->rwnd & 0xffff, (uint32_t)hdr->rwnd >> 16};
+    region_mul_add(s->row + row * d->seg_size, (const uint8_t *)payload, 1, hdr->data_size);
+    meta_mul_add(&s->meta[row], &meta, 1);
+    if (hdr->data_size > s->len)
+        s->len = hdr->data_size;
+    if (__builtin_popcount(s->rows) == d->m && missing(s) > d->m) { //every row is in and there are still too many holes
+        d->failed++;
+        s->done = true;
+        return false;
+    }
+    return solvable(s);
+}
+
+bool fec_pending(const FecDecoder *d, int seg)
+{
+    const FecBlock *s = &d->blocks[(seg / d->k) % d->nblocks];
+
+    if (s->block != seg / d->k) //nothing of the block here yet, its parity is still to come
+        return s->block < seg / d->k;
+    return !s->done && __builtin_popcount(s->rows) < d->m;
+}
+
+/*
+ * fec_rebuild: the rows picked (one per hole) are c * D = S with c the coefficients of the holes. Gauss-Jordan
+ * on c, with every row operation done on the row buffers too, leaves D in them
+ */
+int fec_rebuild(FecDecoder *d, int seg, FecSegment *out)
+{
+    FecBlock *s = block_slot(d, seg / d->k, false);
+    uint8_t c[FEC_MAX_M][FEC_MAX_M];
+    uint8_t *buf[FEC_MAX_M];
+    FecMeta *meta[FEC_MAX_M];
+    int holes[FEC_MAX_M];
+    int e = 0;
+
+    if (s == NULL || !solvable(s))
+        return 0;
+    for (int i = 0; i < s->count; i++) {
+        if (!(s->have & 1ULL << i))
+            holes[e++] = i;
+    }
+    for (int r = 0, a = 0; a < e; r++) {
+        if (!(s->rows & 1 << r))
+            continue;
+        for (int t = 0; t < e; t++)
+            c[a][t] = d->coef[r][holes[t]];
+        buf[a] = s->row + r * d->seg_size;
+        meta[a] = &s->meta[r];
+        a++;
+    }
+    for (int t = 0; t < e; t++) {
+        int p = t;
+        while (c[p][t] == 0) //there is a pivot, every square submatrix of the code is invertible
+            p++;
+        if (p != t) {
+            uint8_t tmp[FEC_MAX_M];
+            memcpy(tmp, c[p], e);
+            memcpy(c[p], c[t], e);
+            memcpy(c[t], tmp, e);
+            uint8_t *b = buf[p]; buf[p] = buf[t]; buf[t] = b;
+            FecMeta *mp = meta[p]; meta[p] = meta[t]; meta[t] = mp;
+        }
+        uint8_t inv = gf_inv(c[t][t]);
+        region_scale(c[t], inv, e);
+        region_scale(buf[t], inv, s->len);
+        region_scale((uint8_t *)meta[t], inv, sizeof(FecMeta));
+        for (int a = 0; a < e; a++) {
+            uint8_t f = c[a][t];
+            if (a == t || f == 0)
+                continue;
+            region_mul_add(c[a], c[t], f, e);
+            region_mul_add(buf[a], buf[t], f, s->len);
+            meta_mul_add(meta[a], meta[t], f);
+        }
+    }
+    s->done = true;
+    int n = 0;
+    for (int t = 0; t < e; t++) {
+        s->have |= 1ULL << holes[t];
+        if (meta[t]->len == 0 || meta[t]->len > d->seg_size || (int64_t)meta[t]->offset < 0 || //can only be a sender bug, the checksums passed
+            (meta[t]->type != DATA && meta[t]->type != ZDATA))
+            continue;
+        out[n].seg = s->block * d->k + holes[t];
+        out[n].offset = meta[t]->offset;
+        out[n].len = meta[t]->len;
+        out[n].type = meta[t]->type;
+        out[n].data = (const char *)buf[t];
+        n++;
+    }
+    d->recovered += n;
+    return n;
+}
+
+void fec_decoder_print_stats(const FecDecoder *d)
+{
+    printf("fec: %d data + %d parity segments per block, %lu parity packets, %lu segments rebuilt, %lu blocks beyond repair\n",
+           d->k, d->m, d->parity_received, d->recovered, d->failed);
+}
@@ -0,0 +1,110 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "packet.h"
+
+#define FEC_MAX_K 64   //data segments per block, the decoder keeps one bit per segment of a block in a uint64_t
+#define FEC_MAX_M 8    //parity segments per block
+
+/*
+ * Forward error correction over blocks of k data segments, m parity segments each. Parity row 0 is the plain
+ * XOR of the block, rows 1.. are the remaining rows of a Cauchy matrix over GF(256) scaled so row 0 is all
+ * ones. Every square submatrix of it is invertible, so any m losses in a block can be rebuilt (Reed-Solomon
+ * like), and with m = 1 the code is just XOR. The file offset and length of every segment are coded along
+ * with the payload, a rebuilt segment knows where it goes even when the file is striped.
+ *
+ * Block b of a flow is its segments b * k .. b * k + k - 1 (segment numbers as SEG() counts them). The
+ * sender puts FEC_GEOMETRY(k, m) in the tsecr field of its data packets, 0 without FEC. A PARITY packet has
+ * seqno = first byte of its block, tsecr = FEC_PARITY_INFO(k, m, row, count) where count is how many data
+ * segments the block has (less than k only for the last one), the coded offset in ackno and the coded length
+ * and packet type in rwnd. Its payload is as long as the longest data segment of the block.
+ */
+#define FEC_GEOMETRY(k, m) ((unsigned int)(k) | (unsigned int)(m) << 8)
+#define FEC_PARITY_INFO(k, m, row, count) (FEC_GEOMETRY(k, m) | (unsigned int)(row) << 16 | (unsigned int)(count) << 24)
+#define FEC_K(info) ((int)((info) & 0xff))
+#define FEC_M(info) ((int)((info) >> 8 & 0xff))
+#define FEC_ROW(info) ((int)((info) >> 16 & 0xff))
+#define FEC_COUNT(info) ((int)((info) >> 24 & 0xff))
+
+typedef struct {
+    uint64_t offset;            //coded file offsets of the block's segments
+    uint16_t len;               //coded lengths
+    uint16_t type;              //coded packet types, DATA or ZDATA
+} FecMeta;
+
+/*
+ * Sender side. Parity packets are queued on the send batch, which only references payloads, so a finished
+ * block's parity has to stay put until the batch is flushed. The encoder fills a ring of sets and the
+ * caller flushes before the ring wraps (fec_encoder_init takes how many blocks one batch can hold)
+ */
+typedef struct {
+    int k, m;
+    int seg_size;               //payload of a full segment, the parity rows are this long
+    uint8_t coef[FEC_MAX_M][FEC_MAX_K];
+    int nsets;
+    int set;                    //set the current block is coded into
+    uint8_t *parity;            //nsets * m rows of seg_size
+    FecMeta *meta;              //nsets * m
+    int count;                  //data segments coded into the current block so far
+    int64_t first_seqno;        //seqno of its first segment
+    int64_t first_offset;
+    int len;                    //longest payload of the block
+    unsigned long blocks;       //stats
+    unsigned long parity_sent;
+    unsigned long long parity_bytes;
+} FecEncoder;
+
+void fec_encoder_init(FecEncoder *e, int k, int m, int nsets, int seg_size);
+void fec_encoder_free(FecEncoder *e);
+bool fec_encode(FecEncoder *e, const tcp_header *hdr, const char *data); //add the next new segment, true when that completed a block
+void fec_parity(const FecEncoder *e, int row, tcp_header *hdr, const char **payload); //header fields and payload of parity row of the block just completed
+bool fec_next_block(FecEncoder *e); //start the next block, true when the ring wrapped and the batch has to be flushed first
+void fec_encoder_print_stats(const FecEncoder *e);
+
+/*
+ * Receiver side. Every row buffer of a block starts at zero and gets coef * payload of each data segment
+ * that arrives added to it, and the parity row itself once that arrives. Addition is XOR, so the order does
+ * not matter and nothing but the rows is kept: once parity row r is in, row r is the sum over the missing
+ * segments alone, and with as many rows as holes the holes are one small linear system away
+ */
+typedef struct {
+    int block;                  //block number this slot is about, -1 when unused
+    int count;                  //data segments in the block, k until a parity packet says otherwise
+    uint64_t have;              //bit i: data segment i arrived (or was rebuilt)
+    uint8_t rows;               //bit r: parity row r arrived
+    bool done;                  //nothing left to rebuild, or rebuilt already
+    int len;                    //longest payload folded in so far
+    uint8_t *row;               //m rows of seg_size
+    FecMeta meta[FEC_MAX_M];
+} FecBlock;
+
+typedef struct {
+    int k, m;
+    int seg_size;
+    uint8_t coef[FEC_MAX_M][FEC_MAX_K];
+    int nblocks;                //slots, enough for every block of the receive window
+    FecBlock *blocks;
+    unsigned long parity_received; //stats
+    unsigned long recovered;
+    unsigned long failed;       //blocks that got all their parity and still had more holes than rows
+} FecDecoder;
+
+typedef struct {                //one segment fec_rebuild got back
+    int seg;
+    int64_t offset;
+    int len;
+    int type;
+    const char *data;           //points into the block's rows, valid until the next call on the decoder
+} FecSegment;
+
+int fec_decoder_init(FecDecoder *d, unsigned int geometry, int window, int seg_size); //geometry from a packet's tsecr, -1 if it is not a valid one
+void fec_decoder_free(FecDecoder *d);
+bool fec_add_data(FecDecoder *d, int seg, const tcp_header *hdr, const char *data); //a new data segment, true when its block can now be rebuilt
+bool fec_add_parity(FecDecoder *d, const tcp_header *hdr, const char *payload); //true when the block can now be rebuilt
+bool fec_pending(const FecDecoder *d, int seg); //parity that may still fill the hole at seg is on its way
+int fec_rebuild(FecDecoder *d, int seg, FecSegment *out); //rebuild the holes of seg's block into out (m entries), how many
+void fec_decoder_print_stats(const FecDecoder *d);
+
+#endif /* FEC_H */
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "filemap.h"
+#include "common.h"
+
+/*
+ * filemap_open_read: map a whole file read only so packets can point straight into the page cache
+ * instead of copying every segment out with fread
+ */
+int filemap_open_read(FileMap *fm, const char *path)
+{
+    struct stat st;
+
+    fm->fd = open(path, O_RDONLY);
+    if (fm->fd < 0)
+        return -1;
+    if (fstat(fm->fd, &st) < 0) {
+        close(fm->fd);
+        return -1;
+    }
+    fm->size = st.st_size;
+    fm->base = NULL;
+    fm->advised = 0;
+    fm->released = 0;
+    if (fm->size == 0) //mmap refuses zero length mappings, an empty file just has no payload
+        return 0;
+
+    fm->base = mmap(NULL, fm->size, PROT_READ, MAP_SHARED, fm->fd, 0);
+    if (fm->base == MAP_FAILED) {
+        fm->base = NULL;
+        close(fm->fd);
+        return -1;
+    }
+    madvise(fm->base, fm->size, MADV_SEQUENTIAL); //we walk the file front to back, let the kernel read ahead aggressively
+    filemap_advance(fm, 0, 0); //and start pulling in the first chunk right away
+    return 0;
+}
+
+/*
+ * filemap_advance: keep one chunk of WILLNEED readahead in front of the send position and drop the pages
+ * of fully acknowledged chunks from our mapping, so a multi GB transfer does not keep the whole file resident
+ */
+void filemap_advance(FileMap *fm, size_t acked, size_t sent)
+{
+    if (fm->base == NULL)
+        return;
+
+    while (fm->advised < fm->size && fm->advised <= sent + FILEMAP_CHUNK) {
+        size_t len = fm->size - fm->advised < FILEMAP_CHUNK ? fm->size - fm->advised : FILEMAP_CHUNK;
+        madvise(fm->base + fm->advised, len, MADV_WILLNEED);
+        fm->advised += len;
+    }
+
+    while (fm->released + FILEMAP_CHUNK <= acked) { //only whole chunks, the offsets are page aligned this way
+        madvise(fm->base + fm->released, FILEMAP_CHUNK, MADV_DONTNEED);
+        fm->released += FILEMAP_CHUNK;
+    }
+}
+
+/*
+ * filemap_map_write: the receiver does not know the final size up front, so we reserve a large range of
+ * address space and back it with the file chunk by chunk as data arrives, the base pointer never moves.
+ * The file is opened (and in the end cut to size) by the caller, the flows of a striped transfer each map
+ * the same one
+ */
+int filemap_map_write(FileMap *fm, int fd)
+{
+    fm->fd = fd;
+    fm->size = 0;
+    fm->mapped = 0;
+    fm->advised = 0;
+    fm->released = 0;
+    fm->base = mmap(NULL, FILEMAP_MAX_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (fm->base == MAP_FAILED) {
+        fm->base = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void filemap_reserve(FileMap *fm, size_t end)
+{
+    if (end <= fm->mapped)
+        return;
+    if (end > FILEMAP_MAX_SIZE) {
+        fprintf(stderr, "filemap_reserve: offset %zu is past the reserved %llu bytes\n", end, FILEMAP_MAX_SIZE);
+        exit(1);
+    }
+
+    size_t grow_to = (end + FILEMAP_CHUNK - 1) / FILEMAP_CHUNK * FILEMAP_CHUNK; //whole chunks, keeps the mapping page aligned
+    if (grow_to > FILEMAP_MAX_SIZE) grow_to = FILEMAP_MAX_SIZE;
+    size_t len = grow_to - fm->mapped;
+
+    //preallocate the blocks so page faults on the mapping never hit ENOSPC (SIGBUS), ftruncate if the fs can not
+    //another mapping of the same file may have grown it further already, never shrink it
+    struct stat st;
+    if (fallocate(fm->fd, 0, fm->mapped, len) < 0 && fstat(fm->fd, &st) == 0 && (size_t)st.st_size < grow_to && ftruncate(fm->fd, grow_to) < 0)
+        error("ftruncate");
+    if (mmap(fm->base + fm->mapped, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fm->fd, fm->mapped) == MAP_FAILED)
+        error("mmap");
+    fm->mapped = grow_to;
+}
+
+/*
+ * filemap_unmap: the file stays open, the last chunk was preallocated past the real end so the owner cuts it
+ */
+void filemap_unmap(FileMap *fm)
+{
+    munmap(fm->base, FILEMAP_MAX_SIZE); //drops the file backed part and the rest of the reservation
+    fm->base = NULL;
+}
+
+void filemap_close(FileMap *fm)
+{
+    if (fm->base != NULL)
+        munmap(fm->base, fm->size);
+    close(fm->fd);
+    fm->base = NULL;
+    fm->size = 0;
+}
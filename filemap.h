@@ -0,0 +1,26 @@
+#ifndef FILEMAP_H
+#define FILEMAP_H
+
+#include <stddef.h>
+
+#define FILEMAP_CHUNK (16 * 1024 * 1024) //granularity of the readahead / release hints and of output growth, 16MB
+#define FILEMAP_MAX_SIZE (1ULL << 40)    //address space reserved for a growing output mapping, 1TB
+
+typedef struct {
+    int fd;              //file descriptor backing the mapping
+    char *base;          //start of the mapping, NULL for an empty file
+    size_t size;         //file size in bytes
+    size_t advised;      //everything below this offset has already been given a WILLNEED hint
+    size_t released;     //everything below this offset has already been given back with DONTNEED
+    size_t mapped;       //output mappings only: bytes of the reservation backed by the file so far
+} FileMap;
+
+int filemap_open_read(FileMap *fm, const char *path);
+void filemap_advance(FileMap *fm, size_t acked, size_t sent); //readahead in front of sent, release behind acked
+void filemap_close(FileMap *fm);
+
+int filemap_map_write(FileMap *fm, int fd); //reserve address space for an output file opened by the caller
+void filemap_reserve(FileMap *fm, size_t end); //make sure [0, end) is allocated in the file and mapped
+void filemap_unmap(FileMap *fm); //the file stays open, the caller cuts it to its final size
+
+#endif /* FILEMAP_H */
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include "journal.h"
+#include "crc32c.h"
+#include "common.h"
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t id;                //conn_id of the transfer
+    uint32_t count;             //ranges that follow, then a CRC-32C over all of it
+} journal_header;               //network byte order
+
+void ranges_init(RangeSet *s)
+{
+    memset(s, 0, sizeof(*s));
+}
+
+void ranges_free(RangeSet *s)
+{
+    free(s->r);
+    ranges_init(s);
+}
+
+void ranges_add(RangeSet *s, uint64_t start, uint64_t end)
+{
+    if (start >= end)
+        return;
+    if (s->count > 0 && s->r[s->count - 1].end == start) { //in order data just extends the last range
+        s->r[s->count - 1].end = end;
+        return;
+    }
+    if (s->count == s->cap) {
+        int cap = s->cap ? s->cap * 2 : 16;
+        ByteRange *r = realloc(s->r, cap * sizeof(ByteRange));
+        if (r == NULL)
+            error("ranges_add");
+        s->r = r;
+        s->cap = cap;
+    }
+    s->r[s->count].start = start;
+    s->r[s->count].end = end;
+    s->count++;
+}
+
+static int by_start(const void *a, const void *b)
+{
+    const ByteRange *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/*
+ * ranges_merge: append, sort and coalesce in place. Runs once per checkpoint, not per packet
+ */
+void ranges_merge(RangeSet *s, const RangeSet *more)
+{
+    for (int i = 0; i < more->count; i++)
+        ranges_add(s, more->r[i].start, more->r[i].end);
+    if (s->count < 2)
+        return;
+    qsort(s->r, s->count, sizeof(ByteRange), by_start);
+    int n = 0;
+    for (int i = 1; i < s->count; i++) {
+        if (s->r[i].start <= s->r[n].end) {
+            if (s->r[i].end > s->r[n].end)
+                s->r[n].end = s->r[i].end;
+        } else {
+            s->r[++n] = s->r[i];
+        }
+    }
+    s->count = n + 1;
+}
+
+bool ranges_cover(const RangeSet *s, uint64_t start, uint64_t end)
+{
+    int lo = 0, hi = s->count - 1;
+
+    while (lo <= hi) { //the last range that starts at or before start
+        int mid = (lo + hi) / 2;
+        if (s->r[mid].start <= start)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return hi >= 0 && s->r[hi].end >= end;
+}
+
+uint64_t ranges_bytes(const RangeSet *s)
+{
+    uint64_t bytes = 0;
+    for (int i = 0; i < s->count; i++)
+        bytes += s->r[i].end - s->r[i].start;
+    return bytes;
+}
+
+uint64_t ranges_end(const RangeSet *s)
+{
+    uint64_t end = 0;
+    for (int i = 0; i < s->count; i++)
+        if (s->r[i].end > end)
+            end = s->r[i].end;
+    return end;
+}
+
+int ranges_pack(const RangeSet *s, char *buf, int cap)
+{
+    int n = cap / (int)sizeof(ByteRange);
+    if (n > s->count)
+        n = s->count;
+    for (int i = 0; i < n; i++) {
+        ByteRange r = { htobe64(s->r[i].start), htobe64(s->r[i].end) };
+        memcpy(buf + i * sizeof(r), &r, sizeof(r));
+    }
+    return n * sizeof(ByteRange);
+}
+
+int ranges_unpack(RangeSet *s, const char *buf, int len)
+{
+    if (len % sizeof(ByteRange) != 0)
+        return -1;
+    for (int i = 0; i < len / (int)sizeof(ByteRange); i++) {
+        ByteRange r;
+        memcpy(&r, buf + i * sizeof(r), sizeof(r));
+        ranges_add(s, be64toh(r.start), be64toh(r.end));
+    }
+    return 0;
+}
+
+int journal_load(const char *path, unsigned int id, RangeSet *s)
+{
+    journal_header hdr;
+    uint32_t crc;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || ntohl(hdr.magic) != JOURNAL_MAGIC ||
+        ntohl(hdr.version) != JOURNAL_VERSION || ntohl(hdr.id) != id || ntohl(hdr.count) > (1u << 24)) {
+        close(fd);
+        return -1;
+    }
+    int len = ntohl(hdr.count) * sizeof(ByteRange);
+    char *buf = malloc(len + sizeof(crc));
+    if (buf == NULL)
+        error("journal_load");
+    int ok = read(fd, buf, len + sizeof(crc)) == (ssize_t)(len + sizeof(crc));
+    close(fd);
+    if (ok) {
+        memcpy(&crc, buf + len, sizeof(crc));
+        ok = ntohl(crc) == crc32c(crc32c(0, &hdr, sizeof(hdr)), buf, len);
+    }
+    if (ok) {
+        RangeSet loaded;
+        ranges_init(&loaded);
+        ranges_unpack(&loaded, buf, len);
+        ranges_merge(s, &loaded);
+        ranges_free(&loaded);
+    }
+    free(buf);
+    return ok ? 0 : -1;
+}
+
+int journal_save(const char *path, unsigned int id, const RangeSet *s)
+{
+    char tmp[PATH_MAX + 8];
+    journal_header hdr = { htonl(JOURNAL_MAGIC), htonl(JOURNAL_VERSION), htonl(id), htonl(s->count) };
+    int len = s->count * sizeof(ByteRange);
+    char *buf = malloc(sizeof(hdr) + len + sizeof(uint32_t));
+
+    if (buf == NULL)
+        error("journal_save");
+    memcpy(buf, &hdr, sizeof(hdr));
+    ranges_pack(s, buf + sizeof(hdr), len);
+    uint32_t crc = htonl(crc32c(0, buf, sizeof(hdr) + len));
+    memcpy(buf + sizeof(hdr) + len, &crc, sizeof(crc));
+    len += sizeof(hdr) + sizeof(crc);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ok = fd >= 0 && write(fd, buf, len) == len && fdatasync(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    if (!ok || rename(tmp, path) < 0) {
+        perror(path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void journal_path(char *buf, int size, const char *output)
+{
+    snprintf(buf, size, "%s.journal", output);
+}
@@ -0,0 +1,43 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define JOURNAL_MAGIC 0x524a4e4c //"RJNL"
+#define JOURNAL_VERSION 1
+
+/*
+ * Progress of a transfer as the byte ranges of the file that are known to be on disk. The receiver keeps them
+ * next to the output file in <file>.journal and rewrites that every checkpoint, a sender that comes back asks
+ * for them (QUERY, answered by PROGRESS) and only sends what is missing. The journal carries the transfer's
+ * conn_id, a resuming sender derives it from the file, so a journal is never applied to another transfer.
+ */
+typedef struct {
+    uint64_t start;             //first byte
+    uint64_t end;               //one past the last byte
+} ByteRange;
+
+typedef struct {
+    ByteRange *r;
+    int count;
+    int cap;
+} RangeSet;
+
+void ranges_init(RangeSet *s);
+void ranges_free(RangeSet *s);
+void ranges_add(RangeSet *s, uint64_t start, uint64_t end); //append, merged into the last range if it continues it
+void ranges_merge(RangeSet *s, const RangeSet *more); //s becomes the sorted, coalesced union of both
+bool ranges_cover(const RangeSet *s, uint64_t start, uint64_t end); //s must be merged, true if one range holds all of [start, end)
+uint64_t ranges_bytes(const RangeSet *s);
+uint64_t ranges_end(const RangeSet *s); //one past the highest byte, 0 when empty
+
+//on disk and on the wire the ranges are pairs of big endian uint64
+int ranges_pack(const RangeSet *s, char *buf, int cap); //as many ranges as fit, bytes used
+int ranges_unpack(RangeSet *s, const char *buf, int len); //appended to s, -1 if len is not whole ranges
+
+int journal_load(const char *path, unsigned int id, RangeSet *s); //-1 if there is none, it is damaged or it is another transfer's
+int journal_save(const char *path, unsigned int id, const RangeSet *s); //written aside and renamed over, a crash leaves the old or the new one
+void journal_path(char *buf, int size, const char *output);
+
+#endif /* JOURNAL_H */
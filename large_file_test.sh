@@ -0,0 +1,58 @@
+#!/bin/bash
+# Large file regression test: a sparse file past 4 GiB with random markers across the 2 GiB and 4 GiB
+# boundaries and at the end goes over loopback in mmap (-m), compressed (-z) and striped (-f) mode and
+# has to come out identical. The receiver throws away some datagrams (-L), so the sender must report
+# SACKed segments and no ack may fail its checksum.
+# usage: ./large_file_test.sh [port], run from this directory after make (make largetest does both)
+
+OBJDIR=../obj
+PORT=${1:-7700}
+LOSS=0.5
+SIZE=$((4 * 1024 * 1024 * 1024 + 64 * 1024 * 1024 + 4321)) #past 4 GiB, and not a multiple of a segment
+MARK=$((1024 * 1024))
+WORK=$(mktemp -d /tmp/rdt_large.XXXXXX)
+FAILED=0
+
+cleanup() {
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+# random bytes at offset $1, sparse everywhere else
+mark() {
+    dd if=/dev/urandom of="$WORK/in" bs=$MARK count=1 seek=$1 oflag=seek_bytes conv=notrunc status=none
+}
+
+truncate -s $SIZE "$WORK/in"
+mark $((2 * 1024 * 1024 * 1024 - MARK / 2))  #straddles 2 GiB, where 32 bit offsets went negative
+mark $((4 * 1024 * 1024 * 1024 - MARK / 2))  #straddles 4 GiB, where they wrap
+mark $((SIZE - MARK))
+
+# $1 name, $2 receiver options, $3 sender options
+run() {
+    rm -f "$WORK/out"
+    timeout 3600 $OBJDIR/rdt_receiver -L $LOSS $2 $PORT "$WORK/out" > "$WORK/recv.log" 2>&1 &
+    local receiver=$!
+    sleep 0.5
+    (cd "$WORK" && timeout 3600 $OBJDIR/rdt_sender $3 127.0.0.1 $PORT in > send.log 2>&1)
+    wait $receiver
+
+    local sacked=$(awk '/^SACK:/ { n += $2 } END { print n + 0 }' "$WORK/send.log")
+    local bad=$(awk '/^corrupt acks dropped:/ { n += $NF } END { print n + 0 }' "$WORK/send.log") #checksum is the last counter
+    if ! cmp -s "$WORK/in" "$WORK/out"; then
+        echo "FAIL $1: output differs"
+        FAILED=1
+    elif [ "$sacked" -eq 0 ] || [ "$bad" -ne 0 ]; then
+        echo "FAIL $1: $sacked segments SACKed, $bad acks dropped on checksum"
+        FAILED=1
+    else
+        echo "ok   $1: $sacked segments SACKed, 0 acks dropped on checksum"
+    fi
+    PORT=$((PORT + 1)) #a late FIN of this run must not reach the next receiver
+}
+
+OBJDIR=$(cd $OBJDIR && pwd)
+run "mmap"       "-m -M 9000" "-m -M 9000"
+run "compressed" ""           "-z 1024"
+run "striped"    "-M 9000"    "-f 3 -M 9000"
+exit $FAILED
@@ -0,0 +1,157 @@
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5   //the format wants the last bytes of a block to be literals
+#define MF_LIMIT 12       //and no match to start closer to the end than this
+#define MAX_DISTANCE 65535
+#define HASH_LOG 12       //16KB of table on the stack, fits in L1 next to the data
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static int hash(uint32_t v)
+{
+    return (int)((v * 2654435761U) >> (32 - HASH_LOG));
+}
+
+/*
+ * put_sequence: token, literal run, offset and match length of one sequence. match_len is without the
+ * MIN_MATCH every match has, and offset 0 means the closing sequence that has literals only. NULL when
+ * dst is full
+ */
+static uint8_t* put_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *lit, int lit_len, int offset, int match_len)
+{
+    //worst case: token, lit_len / 255 + 1 length bytes, the literals, offset and match_len / 255 + 1 length bytes
+    if (oend - op < 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1)
+        return NULL;
+    uint8_t *token = op++;
+    *token = (lit_len < 15 ? lit_len : 15) << 4;
+    if (lit_len >= 15) {
+        int n = lit_len - 15;
+        for (; n >= 255; n -= 255)
+            *op++ = 255;
+        *op++ = n;
+    }
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (offset == 0)
+        return op;
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    *token |= match_len < 15 ? match_len : 15;
+    if (match_len >= 15) {
+        int n = match_len - 15;
+        for (; n >= 255; n -= 255)
+            *op++ = 255;
+        *op++ = n;
+    }
+    return op;
+}
+
+/*
+ * lz_compress: greedy, one hash probe per position. Positions that found nothing for a while are skipped
+ * faster and faster, so data that does not compress costs little time before the caller stores it as is
+ */
+int lz_compress(const char *src, int len, char *dst, int cap)
+{
+    int table[1 << HASH_LOG];
+    const uint8_t *base = (const uint8_t *)src;
+    const uint8_t *ip = base, *anchor = base, *end = base + len;
+    uint8_t *op = (uint8_t *)dst;
+    const uint8_t *oend = op + cap;
+
+    memset(table, 0, sizeof(table)); //every entry points at src[0] for now, a candidate is compared before use anyway
+    if (len > MF_LIMIT) {
+        const uint8_t *mflimit = end - MF_LIMIT;
+        const uint8_t *match_limit = end - LAST_LITERALS;
+        ip++;
+        while (ip < mflimit) {
+            uint32_t seq = read32(ip);
+            int h = hash(seq);
+            const uint8_t *ref = base + table[h];
+            table[h] = (int)(ip - base);
+            if (ip - ref > MAX_DISTANCE || read32(ref) != seq) {
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) { //the match may have started earlier
+                ip--;
+                ref--;
+            }
+            const uint8_t *mp = ip + MIN_MATCH, *rp = ref + MIN_MATCH;
+            while (mp < match_limit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+            op = put_sequence(op, oend, anchor, (int)(ip - anchor), (int)(ip - ref), (int)(mp - ip - MIN_MATCH));
+            if (op == NULL)
+                return 0;
+            ip = anchor = mp;
+            if (ip - 2 > base) //the bytes just behind the match are a likely start of the next one
+                table[hash(read32(ip - 2))] = (int)(ip - 2 - base);
+        }
+    }
+    op = put_sequence(op, oend, anchor, (int)(end - anchor), 0, 0);
+    if (op == NULL)
+        return 0;
+    return (int)(op - (uint8_t *)dst);
+}
+
+static int get_length(const uint8_t **ip, const uint8_t *iend, int len)
+{
+    int b;
+    do {
+        if (*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+int lz_decompress(const char *src, int len, char *dst, int raw_len)
+{
+    const uint8_t *ip = (const uint8_t *)src, *iend = ip + len;
+    uint8_t *op = (uint8_t *)dst, *oend = op + raw_len;
+
+    while (ip < iend) {
+        int token = *ip++;
+        int lit_len = token >> 4;
+        if (lit_len == 15 && (lit_len = get_length(&ip, iend, lit_len)) < 0)
+            return -1;
+        if (lit_len > iend - ip || lit_len > oend - op)
+            return -1;
+        memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
+        if (ip == iend) //the closing sequence, literals only
+            break;
+        if (iend - ip < 2)
+            return -1;
+        int offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > op - (uint8_t *)dst)
+            return -1;
+        int match_len = token & 15;
+        if (match_len == 15 && (match_len = get_length(&ip, iend, match_len)) < 0)
+            return -1;
+        match_len += MIN_MATCH;
+        if (match_len > oend - op)
+            return -1;
+        const uint8_t *ref = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, ref, match_len);
+        } else {
+            for (int i = 0; i < match_len; i++) //overlapping, a run of the last offset bytes
+                op[i] = ref[i];
+        }
+        op += match_len;
+    }
+    return op == oend ? 0 : -1;
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include "pacer.h"
+
+/*
+ * Token bucket pacer. Tokens (bytes) flow in at the pacing rate and a send takes len of them, the bucket is
+ * PACER_BURST_US of the rate deep (at least PACER_MIN_BURST, at most max_burst segments) so a window that
+ * opens all at once leaves in bursts of that size spread over the rtt instead of back to back.
+ * Times are microseconds of the monotonic clock, the same base as the timer wheel that wakes the sender up.
+ */
+
+static void refill(Pacer *p, uint64_t now)
+{
+    if (now > p->last) {
+        p->tokens += p->rate * (now - p->last) / 1e6;
+        if (p->tokens > p->burst)
+            p->tokens = p->burst;
+    }
+    p->last = now;
+}
+
+void pacer_init(Pacer *p, int mss, int max_burst, uint64_t now)
+{
+    p->rate = 0;
+    p->mss = mss;
+    p->max_burst = max_burst > PACER_MIN_BURST ? max_burst : PACER_MIN_BURST;
+    p->burst = (double)PACER_MIN_BURST * mss;
+    p->tokens = p->burst;
+    p->last = now;
+    p->waits = 0;
+    p->bytes = 0;
+}
+
+void pacer_set_rate(Pacer *p, double rate, uint64_t now)
+{
+    refill(p, now);
+    p->rate = rate;
+
+    double burst = rate * PACER_BURST_US / 1e6;
+    if (burst < (double)PACER_MIN_BURST * p->mss)
+        burst = (double)PACER_MIN_BURST * p->mss;
+    if (burst > (double)p->max_burst * p->mss)
+        burst = (double)p->max_burst * p->mss;
+    p->burst = burst;
+    if (p->tokens > p->burst)
+        p->tokens = p->burst;
+}
+
+bool pacer_can_send(Pacer *p, int bytes, uint64_t now)
+{
+    if (p->rate <= 0)
+        return true;
+    refill(p, now);
+    if (p->tokens >= bytes)
+        return true;
+    p->waits++;
+    return false;
+}
+
+void pacer_consume(Pacer *p, int bytes)
+{
+    p->bytes += bytes;
+    if (p->rate > 0)
+        p->tokens -= bytes;
+}
+
+uint64_t pacer_next_send(const Pacer *p, int bytes)
+{
+    if (p->rate <= 0 || p->tokens >= bytes)
+        return p->last;
+    if (bytes > p->burst) //the bucket never gets fuller than this
+        bytes = (int)p->burst;
+    return p->last + (uint64_t)((bytes - p->tokens) * 1e6 / p->rate) + 1;
+}
+
+/*
+ * pacer_schedule: with SO_TXTIME the kernel (fq) holds every packet until its departure time, so the sender
+ * hands over the whole window at once and the bucket only computes when each packet may leave: the moment
+ * the tokens it takes would have been there. Debt carries over, packets queued behind it leave later
+ */
+uint64_t pacer_schedule(Pacer *p, int bytes, uint64_t now)
+{
+    uint64_t at = now;
+
+    refill(p, now);
+    if (p->rate > 0 && p->tokens < bytes)
+        at = now + (uint64_t)((bytes - p->tokens) * 1e6 / p->rate);
+    pacer_consume(p, bytes);
+    return at;
+}
+
+int pacer_burst_segments(const Pacer *p)
+{
+    return (int)(p->burst / p->mss);
+}
+
+void pacer_print_stats(const Pacer *p)
+{
+    printf("pacer: %llu bytes paced, %lu waits for tokens, last rate %.3f Mbit/s, burst %d segments\n",
+           p->bytes, p->waits, p->rate * 8 / 1e6, pacer_burst_segments(p));
+}
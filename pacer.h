@@ -0,0 +1,30 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PACER_BURST_US 1000    //the bucket holds this much time worth of the pacing rate (like the fq / TSO autosizing quantum)
+#define PACER_MIN_BURST 2      //segments, never less than this goes out back to back
+
+typedef struct {
+    double rate;                 //bytes per second, 0 while no rate is known (nothing is held back then)
+    double tokens;               //bytes that may go out now, negative when sends were charged ahead of time
+    double burst;                //bucket depth in bytes, the largest back to back burst
+    int mss;
+    int max_burst;               //segments, upper limit for the bucket depth
+    uint64_t last;               //microseconds, last refill
+    unsigned long waits;         //times the sender had to wait for tokens
+    unsigned long long bytes;    //bytes that went through the bucket
+} Pacer;
+
+void pacer_init(Pacer *p, int mss, int max_burst, uint64_t now);
+void pacer_set_rate(Pacer *p, double rate, uint64_t now);      //bucket is refilled at the old rate first, the depth follows the rate
+bool pacer_can_send(Pacer *p, int bytes, uint64_t now);       //enough tokens for bytes right now
+void pacer_consume(Pacer *p, int bytes);                       //charge a send, may go into debt (retransmissions are never held back)
+uint64_t pacer_next_send(const Pacer *p, int bytes);          //when there will be tokens for bytes, to schedule the wakeup
+uint64_t pacer_schedule(Pacer *p, int bytes, uint64_t now);   //SO_TXTIME mode: charge now and return the departure time, never waits
+int pacer_burst_segments(const Pacer *p);
+void pacer_print_stats(const Pacer *p);
+
+#endif /* PACER_H */
@@ -1,5 +1,9 @@
 #include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <endian.h>
 #include"packet.h"
+#include"crc32c.h"
 
 static tcp_packet zero_packet = {.hdr={0}};
 /*
@@ -8,7 +12,7 @@ static tcp_packet zero_packet = {.hdr={0}};
 tcp_packet* make_packet(int len)
 {
     tcp_packet *pkt;
-    pkt = malloc(TCP_HDR_SIZE + len);
+    pkt = malloc(sizeof(tcp_header) + len);
 
     *pkt = zero_packet;
     pkt->hdr.data_size = len;
@@ -20,3 +24,79 @@ int get_data_size(tcp_packet *pkt)
     return pkt->hdr.data_size;
 }
 
+
+const char *wire_error_names[WIRE_ERRORS] = { "ok", "short", "version", "length", "checksum" };
+
+void packet_encode(const tcp_header *hdr, const void *payload, wire_header *out)
+{
+    out->version = PROTO_VERSION;
+    out->flags = hdr->ctr_flags;
+    out->data_size = htons(hdr->data_size);
+    out->conn_id = htonl(hdr->conn_id);
+    out->seqno = htobe64(hdr->seqno);
+    out->ackno = htobe64(hdr->ackno);
+    out->offset = htobe64(hdr->offset);
+    out->flows = htons(hdr->flows);
+    out->seg_size = htons(hdr->seg_size);
+    out->rwnd = htonl(hdr->rwnd);
+    out->tsval = htonl(hdr->tsval);
+    out->tsecr = htonl(hdr->tsecr);
+    out->checksum = 0;
+    uint32_t crc = crc32c(0, out, sizeof(wire_header));
+    out->checksum = htonl(crc32c(crc, payload, hdr->data_size));
+}
+
+/*
+ * packet_decode: check a received datagram and unpack its header. Nothing in it is trusted before this
+ * said WIRE_OK, a corrupt data_size must not make us read or write past a segment
+ */
+int packet_decode(const void *buf, int len, const void *payload, tcp_header *hdr)
+{
+    wire_header w;
+
+    if (len < (int)sizeof(wire_header))
+        return WIRE_SHORT;
+    memcpy(&w, buf, sizeof(w)); //the header may sit at any alignment in a GRO datagram
+    if (w.version != PROTO_VERSION)
+        return WIRE_VERSION;
+    int data_size = ntohs(w.data_size);
+    if (data_size != len - (int)sizeof(wire_header) || data_size > MAX_DATA_SIZE)
+        return WIRE_LENGTH;
+
+    uint32_t checksum = ntohl(w.checksum);
+    w.checksum = 0;
+    uint32_t crc = crc32c(0, &w, sizeof(w));
+    if (crc32c(crc, payload != NULL ? payload : (const char *)buf + sizeof(wire_header), data_size) != checksum)
+        return WIRE_CHECKSUM;
+
+    hdr->ctr_flags = w.flags;
+    hdr->data_size = data_size;
+    hdr->conn_id = ntohl(w.conn_id);
+    hdr->seqno = be64toh(w.seqno);
+    hdr->ackno = be64toh(w.ackno);
+    hdr->offset = be64toh(w.offset);
+    hdr->flows = ntohs(w.flows);
+    hdr->seg_size = ntohs(w.seg_size);
+    hdr->rwnd = ntohl(w.rwnd);
+    hdr->tsval = ntohl(w.tsval);
+    hdr->tsecr = ntohl(w.tsecr);
+    if (hdr->seqno < 0 || hdr->offset < 0) //past what an int64_t byte offset can hold
+        return WIRE_LENGTH;
+    return WIRE_OK;
+}
+
+void sack_to_net(sack_block *blocks, int n)
+{
+    for (int i = 0; i < n; i++) {
+        blocks[i].start = htobe64(blocks[i].start);
+        blocks[i].end = htobe64(blocks[i].end);
+    }
+}
+
+void sack_to_host(sack_block *blocks, int n)
+{
+    for (int i = 0; i < n; i++) {
+        blocks[i].start = be64toh(blocks[i].start);
+        blocks[i].end = be64toh(blocks[i].end);
+    }
+}
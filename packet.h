@@ -1,24 +1,85 @@
 #ifndef PACKET_H
 #define PACKET_H
 
+#include <stdint.h>
+
 enum packet_type { //making an enumeration that has 3 potential values: DATA , ACK or, FIN
     DATA, //assigned O
     ACK, //assigned 1
     FIN, //assigned 2
+    PARITY, //forward error correction for a block of data segments, see fec.h
+    ZDATA, //DATA of a compressed transfer, the payloads are a stream of frames (see zstream.h)
+    QUERY, //a resuming sender asks which parts of the file the receiver already has
+    PROGRESS, //the answer, its payload are those byte ranges (see journal.h)
+    PROBE, //path mtu discovery, padded to the size being tried and sent with DF, the receiver echoes it without the padding
 };
 
+/*
+ * tcp_header is how a header looks in memory, on the wire it is a wire_header: packed, network byte order,
+ * versioned and with a CRC-32C over header and payload. packet_encode / packet_decode convert between the two
+ */
 typedef struct { //defining a struct in C that has the header information for the TCP packets
-    int seqno; // sequence number to find the position of the 1st data byte in packet
-    int ackno; //ACK number for the next sequence number the receiver is expecting to receive
+    int64_t seqno; // sequence number to find the position of the 1st data byte in packet
+    int64_t ackno; //ACK number for the next sequence number the receiver is expecting to receive (PARITY: coded offsets)
     int ctr_flags; //stores the type of the packet
     int data_size; //stores the size of the packet in bytes
+    int rwnd; //ACKs: how many segments past ackno the receiver can buffer, the sender never has more than this in flight (PARITY: coded lengths)
+    unsigned int tsval; //sender clock when the packet went out, 0 when the sender does not use timestamps
+    unsigned int tsecr; //ACKs: tsval of the packet that triggered the ack, echoed back unchanged. DATA and PARITY: FEC geometry, 0 without FEC
+    unsigned int conn_id; //picked at random by the sender for each transfer, the receiver keys its connections on it and echoes it in acks
+    int64_t offset; //file offset of the payload, equal to seqno unless the file is striped over several flows (then seqno counts the flow's own bytes)
+    int flows; //number of flows the file is striped over, all of them carry the same conn_id
+    int seg_size; //payload of a full segment of this flow, every DATA segment but the last has it. Fixed for a transfer
 } tcp_header;
 
-#define MSS_SIZE    1500 //we use MSS in the C files, here we define its size to be 1500
+#define PROTO_VERSION 4 //1 was the host endian tcp_header as it was, without checksum, 2 had no seg_size, 3 had 32 bit byte offsets
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;   //PROTO_VERSION, anything else is dropped
+    uint8_t flags;     //tcp_header's ctr_flags, the packet type (enum packet_type)
+    uint16_t data_size;
+    uint32_t conn_id;
+    uint64_t seqno;    //byte offsets are 64 bit, a transfer is not limited to 2 GB
+    uint64_t ackno;
+    uint64_t offset;
+    uint16_t flows;
+    uint16_t seg_size;
+    uint32_t rwnd;
+    uint32_t tsval;
+    uint32_t tsecr;
+    uint32_t checksum; //CRC-32C over the header (with this field 0) followed by the payload
+} wire_header;
+
+//not a multiple of 8: a struct with a payload member behind a wire_header gets padding in between, so build
+//a datagram in a char buffer with the payload at buf + TCP_HDR_SIZE
+_Static_assert(sizeof(wire_header) == 52, "wire_header is the v4 wire format");
+
+enum wire_error { //why packet_decode refused a datagram, the receiving side counts each
+    WIRE_OK,
+    WIRE_SHORT,    //smaller than a header
+    WIRE_VERSION,  //another protocol version, or not ours at all
+    WIRE_LENGTH,   //data_size does not match the datagram or does not fit a segment, or a negative offset
+    WIRE_CHECKSUM, //corrupted on the way
+    WIRE_ERRORS
+};
+
+#define MSS_SIZE    1500 //we use MSS in the C files, here we define its size to be 1500. The base mtu, every path is assumed to carry it
 #define UDP_HDR_SIZE    8 //set the UDP header size to 8
 #define IP_HDR_SIZE    20 //sets the IP header as 20 bytes, this is the min size for IPv4 headers without options
-#define TCP_HDR_SIZE    sizeof(tcp_header) //defining this to the size of the tcp_header struct in bytes
+#define TCP_HDR_SIZE    ((size_t)52) //header bytes on the wire, in memory a packet starts with the (bigger) tcp_header
 #define DATA_SIZE   (MSS_SIZE - TCP_HDR_SIZE - UDP_HDR_SIZE - IP_HDR_SIZE) //this calculates the max size available for data in a packet, done by subtracting all the header sizes from MSS
+#define MAX_MTU     9000 //jumbo frames, the most -M takes. A bigger segment size is probed for at runtime (see PROBE)
+#define SEGMENT_SIZE(mtu) ((int)((mtu) - TCP_HDR_SIZE - UDP_HDR_SIZE - IP_HDR_SIZE)) //payload per packet for an mtu
+#define MAX_DATA_SIZE SEGMENT_SIZE(MAX_MTU)
+
+_Static_assert(sizeof(wire_header) == TCP_HDR_SIZE, "TCP_HDR_SIZE is the header on the wire");
+
+#define MAX_SACK_BLOCKS 4 //most SACK ranges an ACK carries, like TCP with timestamps on
+
+typedef struct { //one range of bytes the receiver already holds above ackno, an ACK carries data_size / sizeof(sack_block) of them as its payload
+    int64_t start; //first byte held
+    int64_t end;   //one past the last byte held
+} sack_block;
 
 typedef struct tcp_packet { //defining a struct called tcp_packet to represent a complete packet with:
     tcp_header  hdr; // a tcp_header struct that has the packet header details
@@ -28,4 +89,10 @@ typedef struct tcp_packet { //defining a struct called tcp_packet to represent a
 tcp_packet* make_packet(int seq);//function to make a new packet the seq number given
 int get_data_size(tcp_packet *pkt); //function to get size of data in packet
 
+void packet_encode(const tcp_header *hdr, const void *payload, wire_header *out); //payload is hdr->data_size bytes, they are checksummed but not copied
+int packet_decode(const void *buf, int len, const void *payload, tcp_header *hdr); //len is the whole datagram, payload NULL if it follows the header; WIRE_OK or why not
+void sack_to_net(sack_block *blocks, int n); //SACK ranges are an ack's payload, in network byte order on the wire too
+void sack_to_host(sack_block *blocks, int n);
+extern const char *wire_error_names[WIRE_ERRORS];
+
 #endif /* PACKET_H */
\ No newline at end of file
@@ -3,14 +3,21 @@ import matplotlib.pyplot as plt
 x = []
 y1 = []
 y2 = []
+pacing = [] # the columns after ssthresh: pacing rate (Mbit/s), burst (segments), bottleneck bandwidth (Mbit/s), min rtt (ms), state
+burst = []
+btl_bw = []
 
-with open("CWND.csv", "r") as fp:
+with open("CWND.csv", "r") as fp: # the sender writes CWND.trace, ../obj/trace_decode CWND.trace CWND.csv makes this
     fp.readline()
     for line in fp:
         data = line.strip().split(",")
         x.append(float(data[0]))
         y1.append(float(data[1]))
         y2.append(int(data[2]))
+        if len(data) > 5:
+            pacing.append(float(data[3]))
+            burst.append(int(data[4]))
+            btl_bw.append(float(data[5]))
 
 fig, ax1 = plt.subplots()
 ax2 = ax1.twinx()
@@ -32,4 +39,27 @@ ax2.set_ylabel("ss_thresh (num. packets)")
 ax1.yaxis.label.set_color("g")
 ax2.yaxis.label.set_color("r")
 plt.show()
-plt.savefig("cwnd.pdf")
\ No newline at end of file
+plt.savefig("cwnd.pdf")
+
+# model based congestion control (bbr) also logs its bandwidth estimate, plot it next to the pacing rate
+if btl_bw and max(btl_bw) > 0:
+    fig, ax = plt.subplots()
+    ax.plot(x, btl_bw, "b-", label="bottleneck bandwidth")
+    ax.plot(x, pacing, "m:", label="pacing rate")
+    ax.set_ylabel("Mbit/s")
+    ax.set_xlabel("Time (seconds)")
+    ax.legend()
+    plt.show()
+    plt.savefig("model.pdf")
+
+# with -p / -x the sender paces, plot the rate and the burst size the bucket allowed
+if burst and max(burst) > 0:
+    fig, ax1 = plt.subplots()
+    ax2 = ax1.twinx()
+    ax1.plot(x, pacing, "m-")
+    ax2.step(x, burst, "k--")
+    ax1.set_ylabel("Pacing rate (Mbit/s)")
+    ax2.set_ylabel("Burst (num. packets)")
+    ax1.set_xlabel("Time (seconds)")
+    plt.show()
+    plt.savefig("pacing.pdf")
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+#include "common.h"
+
+/* per-thread stash, only used for the pool it was filled from */
+typedef struct {
+    PacketPool *owner;
+    void *slots[POOL_CACHE_SIZE];
+    int count;
+} PoolCache;
+
+static __thread PoolCache cache;
+
+#define NEXT(slot) (*(void **)(slot)) //free slots store the next pointer in their first bytes
+
+/*
+ * grow: carve a new chunk into slots and push them on the free list, caller holds the lock
+ */
+static void grow(PacketPool *p, int nslots)
+{
+    char *chunk = malloc(p->slot_size * nslots);
+    void **chunks = realloc(p->chunks, (p->nchunks + 1) * sizeof(void *));
+    if (chunk == NULL || chunks == NULL)
+        error("pool grow");
+    p->chunks = chunks;
+    p->chunks[p->nchunks++] = chunk;
+
+    for (int i = nslots - 1; i >= 0; i--) {
+        void *slot = chunk + (size_t)i * p->slot_size;
+        NEXT(slot) = p->free_list;
+        p->free_list = slot;
+    }
+    p->total_slots += nslots;
+    p->chunk_allocs++;
+}
+
+void pool_init(PacketPool *p, size_t slot_size, int initial_slots, int use_cache)
+{
+    memset(p, 0, sizeof(*p));
+    if (slot_size < sizeof(void *)) //a free slot has to hold the list pointer
+        slot_size = sizeof(void *);
+    p->slot_size = (slot_size + 7) & ~(size_t)7; //keep every slot 8 byte aligned
+    p->use_cache = use_cache;
+    pthread_mutex_init(&p->lock, NULL);
+    if (initial_slots > 0)
+        grow(p, initial_slots);
+}
+
+static void* take_slot(PacketPool *p)
+{
+    void *slot;
+
+    if (p->use_cache && cache.owner == p && cache.count > 0) //fast path, nobody else can touch our stash
+        return cache.slots[--cache.count];
+
+    pthread_mutex_lock(&p->lock);
+    if (p->free_list == NULL)
+        grow(p, POOL_CHUNK_SLOTS);
+    slot = p->free_list;
+    p->free_list = NEXT(slot);
+    if (p->use_cache && (cache.owner == p || cache.owner == NULL)) { //refill half the stash while we hold the lock
+        cache.owner = p;
+        while (cache.count < POOL_CACHE_SIZE / 2) {
+            if (p->free_list == NULL)
+                grow(p, POOL_CHUNK_SLOTS);
+            cache.slots[cache.count++] = p->free_list;
+            p->free_list = NEXT(p->free_list);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return slot;
+}
+
+static void give_slot(PacketPool *p, void *slot)
+{
+    if (p->use_cache && cache.owner == p && cache.count < POOL_CACHE_SIZE) {
+        cache.slots[cache.count++] = slot;
+        return;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    NEXT(slot) = p->free_list;
+    p->free_list = slot;
+    if (p->use_cache && cache.owner == p) { //stash is full, hand half of it back in the same lock
+        while (cache.count > POOL_CACHE_SIZE / 2) {
+            void *s = cache.slots[--cache.count];
+            NEXT(s) = p->free_list;
+            p->free_list = s;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * pool_acquire: replacement for make_packet, hands out a slot with a zeroed header instead of calling malloc
+ */
+tcp_packet* pool_acquire(PacketPool *p, int len)
+{
+    if (sizeof(tcp_header) + len > p->slot_size) {
+        fprintf(stderr, "pool_acquire: %d bytes of data do not fit a %zu byte slot\n", len, p->slot_size);
+        exit(1);
+    }
+
+    tcp_packet *pkt = take_slot(p);
+    memset(&pkt->hdr, 0, sizeof(tcp_header));
+    pkt->hdr.data_size = len;
+
+    __atomic_add_fetch(&p->acquires, 1, __ATOMIC_RELAXED);
+    size_t in_use = __atomic_add_fetch(&p->in_use, 1, __ATOMIC_RELAXED);
+    size_t hw = __atomic_load_n(&p->high_water, __ATOMIC_RELAXED);
+    while (in_use > hw && !__atomic_compare_exchange_n(&p->high_water, &hw, in_use, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    return pkt;
+}
+
+void pool_release(PacketPool *p, tcp_packet *pkt)
+{
+    if (pkt == NULL)
+        return;
+    give_slot(p, pkt);
+    __atomic_add_fetch(&p->releases, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&p->in_use, 1, __ATOMIC_RELAXED);
+}
+
+void pool_destroy(PacketPool *p)
+{
+    if (cache.owner == p) { //the slots in our stash belong to chunks we are about to free
+        cache.owner = NULL;
+        cache.count = 0;
+    }
+    for (int i = 0; i < p->nchunks; i++)
+        free(p->chunks[i]);
+    free(p->chunks);
+    pthread_mutex_destroy(&p->lock);
+    p->chunks = NULL;
+    p->nchunks = 0;
+    p->free_list = NULL;
+}
+
+void pool_print_stats(const char *name, const PacketPool *p)
+{
+    printf("%s: %lu acquires, %lu releases, %zu in use, high water %zu of %zu slots (%zu bytes each), %lu chunk mallocs\n",
+           name, p->acquires, p->releases, p->in_use, p->high_water, p->total_slots, p->slot_size, p->chunk_allocs);
+}
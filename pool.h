@@ -0,0 +1,34 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "packet.h"
+
+#define POOL_CHUNK_SLOTS 256 //slots allocated at once when the free list runs dry
+#define POOL_CACHE_SIZE 64   //slots a thread keeps for itself when per-thread caches are on
+
+typedef struct {
+    size_t slot_size;           //bytes per slot, header included (MSS_SIZE for data packets)
+    void *free_list;            //free slots linked through their first bytes
+    void **chunks;              //every chunk we malloc'd, so pool_destroy can give them back
+    int nchunks;
+    int use_cache;              //1 to give each thread a small private stash of slots (no lock on the fast path)
+    pthread_mutex_t lock;       //protects free_list and chunks
+
+    //counters, updated atomically so they stay right with per-thread caches
+    unsigned long acquires;     //pool_acquire calls
+    unsigned long releases;     //pool_release calls
+    unsigned long chunk_allocs; //mallocs the pool itself did (one per POOL_CHUNK_SLOTS slots)
+    size_t total_slots;         //slots owned by the pool
+    size_t in_use;              //slots handed out right now
+    size_t high_water;          //most slots ever handed out at the same time
+} PacketPool;
+
+void pool_init(PacketPool *p, size_t slot_size, int initial_slots, int use_cache);
+tcp_packet* pool_acquire(PacketPool *p, int len); //zeroed header with data_size = len, len must fit the slot
+void pool_release(PacketPool *p, tcp_packet *pkt); //NULL is fine
+void pool_destroy(PacketPool *p);
+void pool_print_stats(const char *name, const PacketPool *p);
+
+#endif /* POOL_H */
@@ -3,283 +3,1091 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h> 
+#include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
-#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
 #include "common.h"
 #include "packet.h"
+#include "batch.h"
+#include "writer.h"
+#include "filemap.h"
+#include "pool.h"
+#include "reorder.h"
+#include "conn.h"
+#include "fec.h"
 
-#define BUFFER_SIZE 20 //defining the size of the packet buffer for storing the out of order packets
+#define SEG(c, seqno) ((int)((seqno) / (c)->seg_size)) // segment number of a byte offset, every segment but the last is seg_size long
+#define DEFAULT_ACK_EVERY 2          // delayed acks: one ack per this many in order segments (RFC 1122 says at least every second one)
+#define DEFAULT_ACK_DELAY_US 1000    // and never held back longer than this, microseconds
+#define LINGER_US 5000000ULL         // after the eof a connection waits this long for retransmissions before it is closed
+#define DEFAULT_IDLE_TIMEOUT 60      // daemon mode: seconds without a packet before an unfinished transfer is given up
+#define STALE_US 500000ULL           // a resuming sender's query closes connections of its transfer this quiet
+#define NO_DEADLINE UINT64_MAX
+
+static const char *ack_reason_names[ACK_REASONS] = { "every n", "delayed", "out of order", "gap fill", "duplicate", "eof" };
 
 /*
- * You are required to change the implementation to support
- * window size greater than one.
- * In the current implementation the window size is one, hence we have
- * only one send and receive packet
+ * A worker owns one socket and every connection whose packets arrive on it. In daemon mode there is one worker
+ * per core, all bound to the same port with SO_REUSEPORT: the kernel picks the socket by hashing the client's
+ * address and port, so a flow always lands on the same worker. The workers share nothing but the output files
+ * of striped transfers, whose flows come from different ports and may land on different workers.
+ * Without a target directory there is a single worker that serves one transfer into one file and exits
  */
-tcp_packet *recvpkt; //pointer that holds the most recently received packet from the client
-tcp_packet *sndpkt; //pointer that is used to make and send ACK packets 
-int expectedseq = 0; //variable to track the next sequence number the receiver expects to receive from the sender, starts at 0 
-int last_ack_sent = 0;  //variable that stores the ACK number from the last ACK packet that the client recieved  
+typedef struct {
+    int index;
+    int sockfd;
+    pthread_t thread;
+    Batch recv_batch;           //incoming data packets are pulled from the socket in batches with recvmmsg
+    Batch ack_batch;            //acks generated while handling a batch are sent together with sendmmsg
+    PacketPool packet_pool;     //MSS sized slots for the out of order packets of all connections, no malloc per packet
+    ConnTable conns;
+    Connection *hot;            //scatter mode: connection of the last data packet, unless striped the next batch is received into its mapping
+    char *spill;                //scatter mode: where a batch is received while there is no hot connection
+    uint64_t next_deadline;     //earliest held back ack or close of any connection, can be early but never late
+    uint64_t next_checkpoint;   //journal: when the connections' progress is written down next
+    struct timeval tp;          //time of the packet being handled, for the debug log
+    bool done;                  //single transfer mode: the transfer is over
+    struct in_addr single_host; //single transfer mode: the transfer we serve, every flow of it is let in
+    unsigned int single_id;
+    unsigned long opened;       //stats
+    unsigned long abandoned;    //closed without an eof after the idle timeout
+    unsigned long refused;      //packets of a connection we could not (or, in single transfer mode, would not) open
+    unsigned long dropped[WIRE_ERRORS]; //datagrams packet_decode refused, by reason
+    unsigned int loss_seed;     //-L
+    unsigned long lost;         //datagrams -L threw away
+} Worker;
 
-tcp_packet* packet_buffer[BUFFER_SIZE]; // stroing the out of order packetss (type array)
-int buffer_seqno[BUFFER_SIZE]; // the sequence number associated to the buffered packet
-int buffer_used[BUFFER_SIZE]; // checks whether or not the buffer slot is currently taken (0 meants not in use 1 means in use)
+int ack_every = DEFAULT_ACK_EVERY;        //-a
+long ack_delay_us = DEFAULT_ACK_DELAY_US; //-d, 0 acks every packet right away
+int batch_size = DEFAULT_BATCH_SIZE;      //-b, number of datagrams per recvmmsg/sendmmsg
+int use_gro = 0;                          //-g, let the kernel coalesce incoming datagrams with UDP_GRO
+int writer_mode = WRITER_URING;           //-W, io_uring unless asked (or forced) to use the writer thread
+int recv_window = DEFAULT_RECV_WINDOW;    //-w, segments each connection accepts past its expectedseq
+int use_scatter = 0;                      //-m, payload is received straight into a mapping of the output file
+const char *output_path = NULL;           //single transfer mode: the output file
+const char *output_dir = NULL;            //-D, daemon mode: every connection gets its own file in here
+uint64_t idle_timeout_us = 0;             //-i, 0 waits forever for a transfer that stopped before its eof
+double loss_percent = 0;                  //-L, throw away this share of the incoming datagrams, a lossy path to test against
+int max_mtu = MSS_SIZE;                   //-M, biggest datagram we take, a sender probes the path up to it
+int max_seg = DATA_SIZE;                  //payload of a max_mtu datagram, the receive slots and the scatter stride are sized to it
+long journal_ms = 0;                      //-J, keep a progress journal next to each output file, checkpointed this often
+volatile sig_atomic_t stopping = 0;       //daemon mode: SIGINT or SIGTERM, the workers close their connections and return
 
-int main(int argc, char **argv) { 
-    int sockfd; /* socket */
-    int portno; /* port to listen on */
-    int clientlen; /* byte size of client's address */
-    struct sockaddr_in serveraddr; /* server's addr */
-    struct sockaddr_in clientaddr; /* client addr */
-    int optval; /* flag value for setsockopt */
-    FILE *fp; //poiinter to a FILE structure to write received data into a file
-    char buffer[MSS_SIZE]; //declaring an array of characters of size MSS(Max segment size)
-    struct timeval tp; //struct to store the time values, when timestamp logging 
+void send_ack(Worker *w, Connection *c, int64_t ackno, int flags, int reason); //queue an ack for the client
+void ack_segment(Worker *w, Connection *c, bool immediate, int reason); //an in order segment arrived, ack it now or hold the ack back
+uint64_t now_us(void);
+void handle_packet(Worker *w, Connection *c, const tcp_header *hdr, char *payload); //run one data packet through the in order / out of order logic
+void handle_parity(Worker *w, Connection *c, const tcp_header *hdr, char *payload); //fec, add a parity packet to its block
 
-    /* 
-     * check command line arguments 
-     */
-    if (argc != 3) { //first checking if we got exactly three command line arguments (prog name+port number+output file)
-        fprintf(stderr, "usage: %s <port> FILE_RECVD\n", argv[0]);
-        exit(1); //if not print a usage message and error code exit
+uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * schedule: a connection has something due at deadline, make sure the worker wakes up for it
+ */
+void schedule(Worker *w, uint64_t deadline)
+{
+    if (deadline < w->next_deadline) {
+        w->next_deadline = deadline;
+    }
+}
+
+/*
+ * close_deadline: after the eof we only linger for retransmissions, before it we give up after idle_timeout_us
+ */
+uint64_t close_deadline(const Connection *c)
+{
+    if (c->eof_received) {
+        return c->last_active + LINGER_US;
+    }
+    return idle_timeout_us ? c->last_active + idle_timeout_us : NO_DEADLINE;
+}
+
+/*
+ * build_sack: SACK ranges for the segments waiting in the reorder buffer. Like TCP the range holding the
+ * most recent arrival goes first, the rest are filled in from the lowest up so the holes right above
+ * ackno are always reported
+ */
+int build_sack(const Connection *c, sack_block *blocks)
+{
+    const ReorderBuf *reorder = &c->reorder;
+    int n = 0;
+    int start, end;
+    int first_start = -1;
+
+    if (reorder->count == 0) {
+        return 0;
+    }
+    if (reorder_range_of(reorder, c->recent_seg, &start, &end)) {
+        first_start = start;
+        blocks[n].start = (int64_t)start * c->seg_size;
+        blocks[n].end = (int64_t)(end - 1) * c->seg_size + reorder->lens[(end - 1) & reorder->mask]; //the last segment can be short
+        n++;
+    }
+    int from = reorder->base_seg;
+    while (n < MAX_SACK_BLOCKS && reorder_next_range(reorder, from, &start, &end)) {
+        if (start != first_start) {
+            blocks[n].start = (int64_t)start * c->seg_size;
+            blocks[n].end = (int64_t)(end - 1) * c->seg_size + reorder->lens[(end - 1) & reorder->mask];
+            n++;
+        }
+        from = end;
+    }
+    return n;
+}
+
+/*
+ * send_ack: build an ACK for the client and queue it, the queue is flushed once per received batch.
+ * Every ack is cumulative, so it also covers whatever ack was being held back
+ */
+void send_ack(Worker *w, Connection *c, int64_t ackno, int flags, int reason)
+{
+    tcp_header hdr = {0};
+    char ack[TCP_HDR_SIZE + MAX_SACK_BLOCKS * sizeof(sack_block)]; //batch_add copies header and SACK ranges, so the stack is all the storage an ACK needs
+    sack_block sack[MAX_SACK_BLOCKS];
+    hdr.ackno = ackno; //the next byte we expect from the client
+    hdr.ctr_flags = flags; //ACK or FIN
+    hdr.rwnd = c->reorder.capacity; //any segment below ackno + rwnd fits in the reorder buffer
+    hdr.tsecr = c->ts_recent; //timestamp echo, the sender turns it into an rtt sample
+    hdr.conn_id = c->id;
+    int nsack = build_sack(c, sack);
+    hdr.data_size = nsack * sizeof(sack_block); //the SACK ranges are the payload of the ACK, right behind the header
+    sack_to_net(sack, nsack);
+    memcpy(ack + TCP_HDR_SIZE, sack, hdr.data_size); //a struct would pad them to the next multiple of 8
+    packet_encode(&hdr, ack + TCP_HDR_SIZE, (wire_header *)ack);
+    batch_add(&w->ack_batch, ack, TCP_HDR_SIZE + hdr.data_size, NULL, 0, &c->addr);
+    c->last_ack_sent = ackno; //updated to the last ACK sent
+    c->acks_sent[reason]++;
+    c->ack_bytes += TCP_HDR_SIZE + hdr.data_size;
+    c->unacked_segments = 0;
+    c->ack_deadline = 0;
+}
+
+/*
+ * ack_segment: delayed acks, an in order segment is acked together with the next one (ack_every of them) or
+ * when ack_delay_us ran out, whatever comes first. Anything that tells the sender about loss goes out at once
+ */
+void ack_segment(Worker *w, Connection *c, bool immediate, int reason)
+{
+    c->unacked_segments++;
+    if (immediate || c->unacked_segments >= ack_every || ack_delay_us == 0) {
+        send_ack(w, c, c->expectedseq, ACK, immediate ? reason : ACK_EVERY);
+    } else if (c->ack_deadline == 0) { //the first segment held back starts the timer
+        c->ack_deadline = now_us() + ack_delay_us;
+        schedule(w, c->ack_deadline);
+    }
+}
+
+/*
+ * hold_ack: with fec a dup ack for a hole its parity may still fill only makes the sender retransmit it. The ack
+ * waits for the parity, or ack_delay_us at most, like a delayed ack
+ */
+void hold_ack(Worker *w, Connection *c)
+{
+    if (c->ack_deadline == 0) {
+        c->ack_deadline = now_us() + ack_delay_us;
+        schedule(w, c->ack_deadline);
+    }
+}
+
+/*
+ * write_payload: writer mode, queue a payload at its file offset, the disk write happens in the background
+ */
+void write_payload(Connection *c, int64_t offset, const char *data, int len)
+{
+    writer_write(&c->writer, offset, data, len);
+    if (journal_ms > 0) {
+        ranges_add(&c->landed, offset, (size_t)offset + len);
+    }
+    if ((size_t)offset + len > c->highest_end) {
+        c->highest_end = (size_t)offset + len;
+    }
+}
+
+/*
+ * feed_stream: compressed transfer, in order bytes of the frame stream are collected and every frame they
+ * complete is expanded to its block of the file. In scatter mode straight into the mapping
+ */
+void feed_stream(Connection *c, const char *data, int len)
+{
+    bool complete;
+
+    if (c->z == NULL) {
+        c->z = malloc(sizeof(ZReader));
+        if (c->z == NULL) {
+            error("feed_stream");
+        }
+        zr_init(c->z);
+    }
+    while (len > 0) {
+        int used = zr_feed(c->z, data, len, &complete);
+        data += used;
+        len -= used;
+        if (!complete) {
+            continue;
+        }
+        size_t end = (size_t)c->z->offset + c->z->raw_len;
+        if (c->scatter) {
+            filemap_reserve(&c->output_map, end);
+            if (zr_decode(c->z, c->output_map.base + c->z->offset) == NULL) {
+                continue;
+            }
+            if (journal_ms > 0) {
+                ranges_add(&c->landed, c->z->offset, end);
+            }
+            if (end > c->highest_end) {
+                c->highest_end = end;
+            }
+        } else {
+            const char *raw = zr_decode(c->z, NULL);
+            if (raw != NULL) {
+                write_payload(c, c->z->offset, raw, c->z->raw_len);
+            }
+        }
     }
-    portno = atoi(argv[1]); //converting the 2nd argument which is the port number from string type to int
+}
 
-    fp = fopen(argv[2], "w");  //opens the file with w to create an empty file or overwrite an existing one
-    if (fp == NULL) { //checking if the file opening was succesful if not an error function is called 
-        error(argv[2]); 
+/*
+ * drain_buffer: write out every buffered segment that is now in order, the run of them is found
+ * from the bitmap in one pass and each is popped off the head of the ring
+ */
+void drain_buffer(Worker *w, Connection *c)
+{
+    int run = reorder_run(&c->reorder); //how many segments from expectedseq on are already here
+    tcp_packet *pkt;
+    int len;
+
+    for (int i = 0; i < run; i++) {
+        reorder_pop(&c->reorder, &pkt, &len);
+        if (pkt != NULL && pkt->hdr.ctr_flags == ZDATA) {
+            feed_stream(c, pkt->data, len);
+            pool_release(&w->packet_pool, pkt);
+        } else if (pkt != NULL) { //in scatter mode there is no packet, the payload already sits in the output mapping
+            write_payload(c, pkt->hdr.offset, pkt->data, len); //handing the buffered packet's data to the writer
+            pool_release(&w->packet_pool, pkt); //giving the slot back to the pool
+        }
+        VLOG(DEBUG, "%lu, %d, %lld", w->tp.tv_sec, len, (long long)c->expectedseq);
+        c->expectedseq += len; //updating the expected seq number for the next packet
     }
+}
 
-    /* 
-     * socket: create the parent socket 
+/*
+ * place_payload: scatter mode, make sure the payload of a new segment sits at its byte offset in the output
+ * mapping. When the guess made before the receive was right this is free, otherwise it costs one copy.
+ */
+void place_payload(Worker *w, Connection *c, const tcp_header *hdr, char *payload)
+{
+    size_t end = (size_t)hdr->offset + hdr->data_size;
+    char *dst = c->output_map.base + hdr->offset;
+
+    filemap_reserve(&c->output_map, end);
+    if (payload != dst) {
+        memcpy(dst, payload, hdr->data_size);
+        c->scatter_copies++;
+    } else {
+        c->scatter_direct++;
+    }
+    if (end > c->highest_end) {
+        c->highest_end = end;
+    }
+    if (journal_ms > 0) {
+        ranges_add(&c->landed, hdr->offset, end);
+    }
+    w->hot = c; //most likely the next batch is more of the same transfer
+}
+
+/*
+ * bounce_mispredicted: scatter mode, message i of a batch was received at highest_end + i * max_seg of the hot
+ * connection, which is right for in order traffic of that flow. A segment that belongs elsewhere (or to another
+ * connection) is copied back behind its header in the batch slot before anything is placed, otherwise placing it
+ * could overwrite another not yet handled payload of the batch.
+ */
+void bounce_mispredicted(Worker *w, int n, const tcp_header *hdrs, const int *status, char **payloads)
+{
+    for (int i = 0; i < n; i++) {
+        if (status[i] != WIRE_OK || hdrs[i].data_size == 0) {
+            continue;
+        }
+        Connection *c = conn_lookup(&w->conns, batch_addr(&w->recv_batch, i), hdrs[i].conn_id);
+        if (c == NULL || hdrs[i].ctr_flags != DATA || payloads[i] != c->output_map.base + hdrs[i].offset) {
+            char *slot = batch_data(&w->recv_batch, i) + TCP_HDR_SIZE; //the slot is max_mtu, the payload fits behind the header
+            memcpy(slot, payloads[i], hdrs[i].data_size);
+            payloads[i] = slot;
+        }
+    }
+}
+
+/*
+ * output_name: the file a transfer goes into
+ */
+void output_name(const struct sockaddr_in *addr, unsigned int id, char *path, int size)
+{
+    char host[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, &addr->sin_addr, host, sizeof(host));
+    if (output_dir != NULL) { //address and conn_id make the name unique, a resuming sender derives its conn_id from the file
+        snprintf(path, size, "%s/%s_%08x", output_dir, host, id);
+    } else {
+        snprintf(path, size, "%s", output_path);
+    }
+}
+
+/*
+ * conn_open: first packet of a flow we do not know yet, create (or, striped, join) its output file and state
+ */
+Connection* conn_open(Worker *w, const struct sockaddr_in *addr, unsigned int id, int flows, int seg_size)
+{
+    char host[INET_ADDRSTRLEN];
+    char path[PATH_MAX];
+    Connection *c;
+
+    if (output_dir == NULL && w->opened > 0 && (w->single_id != id || w->single_host.s_addr != addr->sin_addr.s_addr)) {
+        return NULL; //single transfer mode, another sender must not touch the file
+    }
+    if (seg_size < 1 || seg_size > max_seg) {
+        return NULL; //segments our receive slots can not hold, the sender probed another receiver or ignored our answer
+    }
+    c = calloc(1, sizeof(Connection));
+    if (c == NULL) {
+        error("conn_open");
+    }
+    c->addr = *addr;
+    c->id = id;
+    c->seg_size = seg_size;
+    c->recent_seg = -1;
+    c->scatter = use_scatter;
+    c->opened = c->last_active = now_us();
+    inet_ntop(AF_INET, &addr->sin_addr, host, sizeof(host));
+    output_name(addr, id, path, sizeof(path));
+
+    c->out = output_get(&addr->sin_addr, id, flows, path, journal_ms > 0);
+    if (c->out == NULL) {
+        free(c);
+        return NULL;
+    }
+    if (c->scatter) { //the output file is mapped and filled in place, no writer needed
+        if (filemap_map_write(&c->output_map, c->out->fd) < 0) {
+            perror("filemap_map_write");
+            output_put(c->out, 0, false);
+            free(c);
+            return NULL;
+        }
+    } else {
+        writer_init(&c->writer, c->out->fd, writer_mode);
+    }
+    w->single_host = addr->sin_addr;
+    w->single_id = id;
+    reorder_init(&c->reorder, recv_window); //sized to the window we advertise, so a well behaved sender never overruns it
+    conn_insert(&w->conns, c);
+    w->opened++;
+    schedule(w, close_deadline(c));
+    if (journal_ms > 0 && w->next_checkpoint < c->opened) { //the first connection after an idle spell
+        w->next_checkpoint = c->opened + journal_ms * 1000;
+        schedule(w, w->next_checkpoint);
+    }
+    VLOG(INFO, "worker %d: new connection from %s:%u (id %08x, %d flows) into %s", w->index, host, ntohs(addr->sin_port), id, c->out->flows, c->out->path);
+    return c;
+}
+
+void conn_print_stats(const Connection *c, uint64_t now)
+{
+    char host[INET_ADDRSTRLEN];
+    unsigned long total_acks = 0;
+    double secs = (now - c->opened) / 1e6;
+
+    inet_ntop(AF_INET, &c->addr.sin_addr, host, sizeof(host));
+    for (int i = 0; i < ACK_REASONS; i++) {
+        total_acks += c->acks_sent[i];
+    }
+    flockfile(stdout); //workers close connections concurrently, keep each block together
+    printf("connection %s:%u (id %08x): %lld bytes in %d byte segments into %s in %.3f s%s\n", host, ntohs(c->addr.sin_port), c->id,
+           (long long)c->expectedseq, c->seg_size, c->out->path, secs, c->eof_received ? "" : ", no eof, given up");
+    printf("acks: %lu for %lu data packets (%.3f per packet), %llu bytes of acks, ack every %d or after %ld us:",
+           total_acks, c->data_packets, c->data_packets ? (double)total_acks / c->data_packets : 0.0,
+           c->ack_bytes, ack_every, ack_delay_us);
+    for (int i = 0; i < ACK_REASONS; i++) {
+        printf(" %s %lu%s", ack_reason_names[i], c->acks_sent[i], i + 1 < ACK_REASONS ? "," : "\n");
+    }
+    if (c->scatter) {
+        printf("scatter receive: %lu payloads placed directly, %lu copied once\n", c->scatter_direct, c->scatter_copies);
+    } else {
+        writer_print_stats(&c->writer); //queue depth and bytes in flight, to size WRITER_DEPTH and WRITER_CHUNK
+    }
+    printf("reorder buffer: %d slots, at most %d segments held, %lu duplicates, %lu dropped when full, %d left\n",
+           c->reorder.capacity, c->reorder.max_count, c->reorder.dups, c->reorder.drops, reorder_count(&c->reorder));
+    if (c->fec != NULL) {
+        fec_decoder_print_stats(c->fec);
+    }
+    if (c->z != NULL) {
+        zr_print_stats(c->z);
+    }
+    fflush(stdout);
+    funlockfile(stdout);
+}
+
+/*
+ * conn_close: the transfer is over (or given up), flush its file and forget it
+ */
+void conn_close(Worker *w, Connection *c, uint64_t now)
+{
+    for (int i = 0; i < c->reorder.capacity; i++) { //freeing any packets left in the buffer
+        if (c->reorder.pkts[i] != NULL) {
+            pool_release(&w->packet_pool, c->reorder.pkts[i]);
+        }
+    }
+    if (c->scatter) {
+        filemap_unmap(&c->output_map); //the last flow to finish cuts the preallocated tail and fsyncs once
+    } else {
+        writer_finish(&c->writer); //wait for the queued writes and fsync once
+    }
+    if (!c->eof_received) {
+        w->abandoned++;
+    }
+    output_checkpoint(c->out, &c->landed); //the last of it, the writer already drained
+    ranges_free(&c->landed);
+    conn_print_stats(c, now);
+    bool complete = output_put(c->out, c->highest_end, c->eof_received);
+
+    conn_remove(&w->conns, c);
+    reorder_free(&c->reorder);
+    if (c->fec != NULL) {
+        fec_decoder_free(c->fec);
+        free(c->fec);
+    }
+    if (c->z != NULL) {
+        zr_free(c->z);
+        free(c->z);
+    }
+    if (w->hot == c) {
+        w->hot = NULL;
+    }
+    free(c);
+    if (output_dir == NULL && complete) { //every flow of the transfer is done
+        w->done = true;
+    }
+}
+
+/*
+ * conn_checkpoint: journal, write down what this connection put into the file since the last checkpoint. The
+ * writer has to hand its staged data to the kernel first, the only time the receive loop waits for it
+ */
+void conn_checkpoint(Connection *c)
+{
+    if (c->landed.count == 0) {
+        return;
+    }
+    if (!c->scatter) {
+        writer_sync(&c->writer);
+    }
+    output_checkpoint(c->out, &c->landed);
+    c->landed.count = 0;
+}
+
+/*
+ * run_timers: send the held back acks that are due, close the connections that are done or idle, write the
+ * journal checkpoints, and find the next deadline. Only runs when the earliest deadline passed, so the scan
+ * costs nothing per packet
+ */
+void run_timers(Worker *w, uint64_t now)
+{
+    uint64_t next = NO_DEADLINE;
+    bool checkpoint = journal_ms > 0 && w->next_checkpoint <= now;
+
+    for (int b = 0; b < w->conns.nbuckets; b++) {
+        Connection *c = w->conns.buckets[b];
+        while (c != NULL) {
+            Connection *following = c->next; //closing unlinks c
+            if (c->ack_deadline != 0 && c->ack_deadline <= now) {
+                send_ack(w, c, c->expectedseq, ACK, ACK_DELAYED);
+            }
+            if (checkpoint) {
+                conn_checkpoint(c);
+            }
+            uint64_t close_at = close_deadline(c);
+            if (close_at <= now) {
+                conn_close(w, c, now);
+            } else {
+                if (close_at < next) next = close_at;
+                if (c->ack_deadline != 0 && c->ack_deadline < next) next = c->ack_deadline;
+            }
+            c = following;
+        }
+    }
+    if (checkpoint) {
+        w->next_checkpoint = now + journal_ms * 1000;
+    }
+    if (journal_ms > 0 && w->conns.count > 0 && w->next_checkpoint < next) { //an idle worker does not wake up for it
+        next = w->next_checkpoint;
+    }
+    w->next_deadline = next;
+    batch_flush(&w->ack_batch);
+}
+
+/*
+ * fec_start: the first packet that says the sender codes its data, size the decoder to our receive window
+ */
+int fec_start(Connection *c, unsigned int geometry)
+{
+    c->fec = malloc(sizeof(FecDecoder));
+    if (c->fec == NULL) {
+        error("fec_start");
+    }
+    if (fec_decoder_init(c->fec, geometry, c->reorder.capacity, c->seg_size) < 0) {
+        free(c->fec);
+        c->fec = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * fec_deliver: the holes of seg's block can be rebuilt, run the rebuilt segments through handle_packet as if
+ * they had just arrived. Their own fec_add_data finds them already marked, so this does not recurse
+ */
+void fec_deliver(Worker *w, Connection *c, int seg)
+{
+    FecSegment rebuilt[FEC_MAX_M];
+    int n = fec_rebuild(c->fec, seg, rebuilt);
+
+    for (int i = 0; i < n; i++) {
+        tcp_header hdr = {0};
+        hdr.ctr_flags = rebuilt[i].type;
+        hdr.seqno = (int64_t)rebuilt[i].seg * c->seg_size;
+        hdr.seg_size = c->seg_size;
+        hdr.offset = rebuilt[i].offset;
+        hdr.data_size = rebuilt[i].len;
+        hdr.tsval = c->ts_recent; //keep echoing the last real tsval
+        hdr.conn_id = c->id;
+        handle_packet(w, c, &hdr, (char *)rebuilt[i].data);
+    }
+}
+
+void handle_parity(Worker *w, Connection *c, const tcp_header *hdr, char *payload)
+{
+    if (c->fec == NULL && fec_start(c, hdr->tsecr) < 0) {
+        return;
+    }
+    if (fec_add_parity(c->fec, hdr, payload)) {
+        fec_deliver(w, c, SEG(c, hdr->seqno));
+    } else if (c->ack_deadline != 0 && c->reorder.count > 0 && !fec_pending(c->fec, SEG(c, c->expectedseq))) {
+        send_ack(w, c, c->expectedseq, ACK, ACK_OUT_OF_ORDER); //the parity is in and the hole is still there, the sender has to resend it
+    }
+}
+
+void handle_packet(Worker *w, Connection *c, const tcp_header *hdr, char *payload)
+{
+    bool rebuild = false; //fec: this segment completed what its block needs to rebuild the rest
+
+    if (hdr->ctr_flags == PARITY) {
+        handle_parity(w, c, hdr, payload);
+        return;
+    }
+    c->ts_recent = hdr->tsval; //0 when the sender does not stamp its packets, then we echo nothing
+
+    if (hdr->data_size == 0) { //to handle EOF, we check if the recieved packet is an EOF packet, we do this through looking at the data size, 0 indicating EOF
+        VLOG(INFO, "End Of File packet received");
+        drain_buffer(w, c); //process buffered packets that can now be handled
+        send_ack(w, c, c->expectedseq, FIN, ACK_EOF); //setting the control flag to FIN to show that this is the last ACK
+        c->eof_received = true; //we only linger for retransmissions from now on, run_timers closes the connection
+        schedule(w, close_deadline(c));
+        return;
+    }
+    gettimeofday(&w->tp, NULL);
+    c->data_packets++;
+    if (c->fec == NULL && hdr->tsecr != 0) {
+        fec_start(c, hdr->tsecr);
+    }
+
+    if (c->expectedseq == hdr->seqno) { //cheking if the packet that was received matches witht he expected sequence number
+        VLOG(DEBUG, "%lu, %d, %lld", w->tp.tv_sec, hdr->data_size, (long long)hdr->seqno);
+        if (hdr->ctr_flags == ZDATA) {
+            feed_stream(c, payload, hdr->data_size);
+        } else if (c->scatter) {
+            place_payload(w, c, hdr, payload); //already in the file mapping, nothing to write
+        } else {
+            write_payload(c, hdr->offset, payload, hdr->data_size); //queue the packet data at its file offset
+        }
+        if (c->fec != NULL) {
+            rebuild = fec_add_data(c->fec, SEG(c, hdr->seqno), hdr, payload);
+        }
+
+        bool gap_fill = c->reorder.count > 0; //there are segments above, so this one filled (part of) a hole
+        c->expectedseq += hdr->data_size; //update the expected sequence number for the next packet
+        reorder_skip(&c->reorder); //the head of the reorder ring moves along with expectedseq
+
+        drain_buffer(w, c);
+        ack_segment(w, c, gap_fill, ACK_GAP_FILL); //one ack covering this packet and whatever it drained, a second identical ack would look like a dup ack to the sender
+    } else if (hdr->seqno > c->expectedseq) { // else if section to handle the case when the received packet had a seq number > expected meaning its out of order
+        int seg = SEG(c, hdr->seqno);
+        int status = reorder_check(&c->reorder, seg); //duplicate and too far ahead are both O(1) checks
+        c->recent_seg = seg;
+
+        if (status == REORDER_OK && c->fec != NULL) {
+            rebuild = fec_add_data(c->fec, seg, hdr, payload);
+        }
+        if (status == REORDER_OK && c->scatter && hdr->ctr_flags == DATA) { //scatter mode only needs to remember that the segment is there
+            place_payload(w, c, hdr, payload);
+            reorder_insert(&c->reorder, seg, NULL, hdr->data_size);
+        } else if (status == REORDER_OK) {
+            tcp_packet *copy = pool_acquire(&w->packet_pool, hdr->data_size); //taking a slot from the pool for the packet in buffer
+            copy->hdr.ctr_flags = hdr->ctr_flags; //frame stream bytes are not file data, they can not be placed ahead
+            copy->hdr.seqno = hdr->seqno;
+            copy->hdr.offset = hdr->offset;
+            memcpy(copy->data, payload, hdr->data_size); // copy the payload received to the buffer space
+            reorder_insert(&c->reorder, seg, copy, hdr->data_size);
+        } else if (status == REORDER_DROP) {
+            VLOG(DEBUG, "reorder buffer full, dropping segment %d", seg);
+        }
+        if (c->fec != NULL && ack_delay_us > 0 && fec_pending(c->fec, SEG(c, c->expectedseq))) {
+            hold_ack(w, c);
+        } else {
+            send_ack(w, c, c->expectedseq, ACK, ACK_OUT_OF_ORDER); //sending the duplicate ACK so the sender knows we still need the expected seq number
+        }
+    } else { // this final else handles the case when the seq number is less than expected meaning that the packet we processed already is retransmitted
+        send_ack(w, c, c->expectedseq, ACK, ACK_DUPLICATE);
+    }
+    if (rebuild) {
+        fec_deliver(w, c, SEG(c, hdr->seqno));
+    }
+}
+
+/*
+ * answer_query: a sender that starts with -r asks what it can skip. Answered without opening the transfer, like
+ * the stateless FIN. A connection of it that is still open here and went quiet is from before the sender went
+ * away, it is closed now so it does not hold the file until the idle timeout (flows on other workers still wait
+ * for theirs). Active ones are left alone, a late copy of the query must not cut off the flows it started
+ */
+void answer_query(Worker *w, int i, const tcp_header *hdr, uint64_t now)
+{
+    struct sockaddr_in *from = batch_addr(&w->recv_batch, i);
+    char path[PATH_MAX];
+    char ranges[DATA_SIZE];
+    tcp_header reply = {0};
+    wire_header wire;
+
+    for (int b = 0; b < w->conns.nbuckets; b++) {
+        Connection *c = w->conns.buckets[b];
+        while (c != NULL) {
+            Connection *following = c->next;
+            if (c->id == hdr->conn_id && c->addr.sin_addr.s_addr == from->sin_addr.s_addr && now - c->last_active >= STALE_US) {
+                conn_close(w, c, now);
+            }
+            c = following;
+        }
+    }
+    w->done = false; //single transfer mode: closing those did not end the transfer, it is about to go on
+    output_name(from, hdr->conn_id, path, sizeof(path));
+    reply.ctr_flags = PROGRESS;
+    reply.conn_id = hdr->conn_id;
+    reply.tsecr = hdr->tsval;
+    reply.data_size = journal_ms > 0 ? output_progress(&from->sin_addr, hdr->conn_id, path, ranges, sizeof(ranges)) : 0;
+    packet_encode(&reply, ranges, &wire);
+    batch_add(&w->ack_batch, &wire, TCP_HDR_SIZE, ranges, reply.data_size, from);
+    batch_flush(&w->ack_batch); //the ranges are on our stack
+}
+
+/*
+ * answer_probe: path mtu discovery. A probe that made it this far fit the path and our receive slots, its size
+ * goes back in ackno along with the biggest datagram we take (rwnd), so the first probe tells the sender where
+ * to stop. Stateless like answer_query, the padding is not echoed
+ */
+void answer_probe(Worker *w, int i, const tcp_header *hdr)
+{
+    tcp_header reply = {0};
+    wire_header wire;
+
+    reply.ctr_flags = PROBE;
+    reply.conn_id = hdr->conn_id;
+    reply.ackno = TCP_HDR_SIZE + hdr->data_size + UDP_HDR_SIZE + IP_HDR_SIZE;
+    reply.rwnd = max_mtu;
+    reply.tsecr = hdr->tsval;
+    packet_encode(&reply, NULL, &wire);
+    batch_add(&w->ack_batch, &wire, TCP_HDR_SIZE, NULL, 0, batch_addr(&w->recv_batch, i));
+    batch_flush(&w->ack_batch); //the sender waits for it before it sends anything else
+}
+
+/*
+ * dispatch: find (or open) the connection of a received packet and hand the packet to it
+ */
+void dispatch(Worker *w, int i, const tcp_header *hdr, char *payload, uint64_t now)
+{
+    struct sockaddr_in *from = batch_addr(&w->recv_batch, i);
+
+    if (hdr->ctr_flags == QUERY) {
+        answer_query(w, i, hdr, now);
+        return;
+    }
+    if (hdr->ctr_flags == PROBE) {
+        answer_probe(w, i, hdr);
+        return;
+    }
+    Connection *c = conn_lookup(&w->conns, from, hdr->conn_id);
+    if (c == NULL && hdr->data_size == 0 && hdr->seqno > 0) {
+        //eof of a transfer we already closed, our FIN got lost. Answer it without bringing the connection back
+        tcp_header fin = {0};
+        wire_header wire;
+        fin.ackno = hdr->seqno; //the sender puts its final byte count in the eof
+        fin.ctr_flags = FIN;
+        fin.tsecr = hdr->tsval;
+        fin.conn_id = hdr->conn_id;
+        packet_encode(&fin, NULL, &wire);
+        batch_add(&w->ack_batch, &wire, TCP_HDR_SIZE, NULL, 0, from);
+        return;
+    }
+    if (c == NULL && hdr->ctr_flags == PARITY) { //late parity of a closed transfer must not open a new one
+        return;
+    }
+    if (c == NULL) {
+        c = conn_open(w, from, hdr->conn_id, hdr->flows, hdr->seg_size);
+        if (c == NULL) {
+            w->refused++;
+            return;
+        }
+    }
+    if (hdr->seg_size != c->seg_size || hdr->data_size > c->seg_size) {
+        w->refused++; //the segment size is fixed for a transfer, SEG() depends on it
+        return;
+    }
+    c->last_active = now;
+    handle_packet(w, c, hdr, payload);
+}
+
+void worker_init(Worker *w, int index, int portno)
+{
+    struct sockaddr_in serveraddr; /* server's addr */
+    int optval; /* flag value for setsockopt */
+
+    memset(w, 0, sizeof(*w));
+    w->index = index;
+    w->next_deadline = NO_DEADLINE;
+    w->loss_seed = (unsigned int)time(NULL) ^ index;
+
+    /*
+     * socket: create the parent socket
      */
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0); //creating a new socket 
-    if (sockfd < 0)  //if a value less than zero is returned then there was an error 
+    w->sockfd = socket(AF_INET, SOCK_DGRAM, 0); //creating a new socket
+    if (w->sockfd < 0)  //if a value less than zero is returned then there was an error
         error("ERROR opening socket"); //error function being called
 
-    /* setsockopt: Handy debugging trick that lets 
-     * us rerun the server immediately after we kill it; 
-     * otherwise we have to wait about 20 secs. 
-     * Eliminates "ERROR on binding: Address already in use" error. 
+    /* setsockopt: Handy debugging trick that lets
+     * us rerun the server immediately after we kill it;
+     * otherwise we have to wait about 20 secs.
+     * Eliminates "ERROR on binding: Address already in use" error.
      */
-    optval = 1; //this wil be used as a boolean flag when it come to socket options 
-    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, 
-            (const void *)&optval , sizeof(int)); //setting the options for the socket 
+    optval = 1; //this wil be used as a boolean flag when it come to socket options
+    setsockopt(w->sockfd, SOL_SOCKET, SO_REUSEADDR,
+            (const void *)&optval , sizeof(int)); //setting the options for the socket
 //arguments being sockfd(file descriptor) SOL_SOCKET (defines the option at socket level) SO_REUSEADDR(specific option to set allowing the socket to be connected to an adrress in use) (const void *)&optval(pointer poiting to the option value) sizeof(int) (the size of the option value in bytes)
+    if (output_dir != NULL && setsockopt(w->sockfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(int)) < 0) {
+        error("SO_REUSEPORT"); //every worker binds the same port, the kernel spreads the clients over them
+    }
+
     /*
      * build the server's Internet address
      */
     bzero((char *) &serveraddr, sizeof(serveraddr)); //calling the fill serveraddr struct with zeros
     serveraddr.sin_family = AF_INET; //setting server address's address family field to AF_INET
-    serveraddr.sin_addr.s_addr = htonl(INADDR_ANY); //setting the IP address to INADDR_ANY which allows the server to accept connection on any network interface of the machine , then htonl will convert the value from host byte to network byte order 
+    serveraddr.sin_addr.s_addr = htonl(INADDR_ANY); //setting the IP address to INADDR_ANY which allows the server to accept connection on any network interface of the machine , then htonl will convert the value from host byte to network byte order
     serveraddr.sin_port = htons((unsigned short)portno); //setting the port num field to the value sorted in portno, and also casts the portno to an unsigned short
 
-    /* 
-     * bind: associate the parent socket with a port 
+    /*
+     * bind: associate the parent socket with a port
      */
-    if (bind(sockfd, (struct sockaddr *) &serveraddr, 
-                sizeof(serveraddr)) < 0) 
+    if (bind(w->sockfd, (struct sockaddr *) &serveraddr,
+                sizeof(serveraddr)) < 0)
         error("ERROR on binding"); //calling bind to connect the specified address and port
 
-    /* 
-     * main loop: wait for a datagram, then echo it
-     */
-    VLOG(DEBUG, "epoch time, bytes received, sequence number"); //logging a debug message using VLOG macro 
-
-    clientlen = sizeof(clientaddr);//cleint wit size of the clientaddr, which we will then use in recvfrom() and sendto() calls
-    int eof_received = 0; // declare and initialize a new int variable to keep track of when the EOF is received 
-    
-    
-    for (int i = 0; i < BUFFER_SIZE; i++) { //initializing an array that we will use to buffer the out of order packets 
-        packet_buffer[i] = NULL; //setting each pointer in hte packet buffer array to NULL
-        buffer_seqno[i] = -1; // setting the sequence numbers to -1 to show that no packet is being stored yet
-        buffer_used[i] = 0; // sets each "used" flag to 0 to show that the slot is available.
-    }
-    
-    while (1) {
-        /*
-         * recvfrom: receive a UDP datagram from a client
-         */
-//callling recvfrom() to receiver a UDP datagram by passing the socket descriptor, buffer MSS size, no special flags, the senders address and the size of the address structure
-        if (recvfrom(sockfd, buffer, MSS_SIZE, 0, 
-                (struct sockaddr *) &clientaddr, (socklen_t *)&clientlen) < 0) {
-            error("ERROR in recvfrom"); // returning a value less than 0 means error so it calls the error function
+    batch_init(&w->recv_batch, w->sockfd, batch_size, max_mtu); //each receive slot holds a whole datagram of the biggest size we accept
+    pool_init(&w->packet_pool, max_mtu, POOL_CHUNK_SLOTS, 0); //more chunks are added while the reorder buffers fill up
+    batch_init(&w->ack_batch, w->sockfd, batch_size, TCP_HDR_SIZE + MAX_SACK_BLOCKS * sizeof(sack_block)); //acks are a header plus SACK ranges
+    conn_table_init(&w->conns);
+    if (use_scatter) {
+        w->spill = malloc((size_t)w->recv_batch.capacity * max_seg);
+        if (w->spill == NULL)
+            error("worker_init");
+    }
+    if (use_gro && use_scatter) { //a coalesced datagram has headers in between the payloads, it can not be scattered
+        if (index == 0)
+            fprintf(stderr, "UDP GRO can not be combined with scatter receive, ignoring -g\n");
+    } else if (use_gro && batch_enable_gro(&w->recv_batch)) { //coalesced datagrams are split back into packets by batch_recv
+        VLOG(INFO, "UDP GRO enabled");
+    }
+}
+
+/*
+ * worker_loop: wait for a batch of datagrams, then ack them. Held back acks and closes are run from here too,
+ * when one is due the receive waits only until then
+ */
+void worker_loop(Worker *w)
+{
+    while (!w->done && !stopping) {
+        uint64_t now = now_us();
+        if (w->next_deadline <= now) {
+            run_timers(w, now);
+            continue;
         }
-        // below two lines: casting the received data in buffer to a tcp_packet struct, thenverifying that th data size reported in the packet is valid 
-        recvpkt = (tcp_packet *) buffer;
-        assert(get_data_size(recvpkt) <= DATA_SIZE);
-        
-
-        if (recvpkt->hdr.data_size == 0) { //to handle EOF, we check if the recieved packet is an EOF packet, we do this through looking at the data size, 0 indicating EOF
-            VLOG(INFO, "End Of File packet received");
-            //do while loop so we can process buffered packets that can now be handled 
-            int processed;
-            do {
-                processed = 0; // here we aere using this variable so we can keep track of the packet that was processed in the current interation 
-                for (int i = 0; i < BUFFER_SIZE; i++) { //going over all the slots in the buffer
-                    if (buffer_used[i] && buffer_seqno[i] == expectedseq) { // if statement to check if our current buffer slot is being used, and if the seq number matched the expected one 
-                        
-                        tcp_packet *pkt = packet_buffer[i]; //making a local pointer to easily access the buffered packet
-                        fseek(fp, pkt->hdr.seqno, SEEK_SET); //setting the file pointer at the byte offset we got from the packet's sequence number 
-                        fwrite(pkt->data, 1, pkt->hdr.data_size, fp);// writing thr data from the packet intot he file
-                        fflush(fp);
-                        
-                        VLOG(DEBUG, "%lu, %d, %d", tp.tv_sec, pkt->hdr.data_size, pkt->hdr.seqno);
-                        expectedseq += pkt->hdr.data_size; //updating the expected sequence number by adding the size of the processed data
-
-                        free(packet_buffer[i]); //freeing the slot that was for the packet and resetting the slot to show that its not in use any more 
-                        packet_buffer[i] = NULL;
-                        buffer_seqno[i] = -1;
-                        buffer_used[i] = 0;
-                        processed = 1; //setting our processed flag to show that the packet is processed now 
-                        break; //breaking out of the for loop
-                    }
-                }
-            } while (processed); //keep the loop going as long as there is at least one packet that was processed in the last iteration
-            sndpkt = make_packet(0);  //making a new packet with no data 
-            sndpkt->hdr.ackno = expectedseq;  //setting the ack number to the current expected sequence number
-            sndpkt->hdr.ctr_flags = FIN; // setting the control flag to FIN to show that this is the last ACK
-            if (sendto(sockfd, sndpkt, TCP_HDR_SIZE, 0, 
-                    (struct sockaddr *) &clientaddr, clientlen) < 0) { //sending the ACK packet back to the client and checking for error
-                error("ERROR in sendto");
-            }
-            
-            // printf("EOF ACK sent: %d\n", sndpkt->hdr.ackno); // printint that the EOF ACK was sent for checking 
-            eof_received = 1; //flag set to 1 to show received and acknowleged EOF ppacket 
-
-            if (eof_received) { //handling EOF and retransmission in this if else statement 
-                struct timeval wait_time; //below setting a one sec timeout to wait for more packets
-                wait_time.tv_sec = 5; 
-                wait_time.tv_usec = 0;
-                fd_set readfds; //making a file descriptor 
-                FD_ZERO(&readfds); //empty
-                FD_SET(sockfd, &readfds); // add sockets to the set 
-          
-                int ready = select(sockfd + 1, &readfds, NULL, NULL, &wait_time); //wait for any activity on the socket or for the timeout to expire
-                if (ready <= 0) { //monitor if new packets have been sent
-                    // printf("No more packets received, closing file\n");
-                    for (int i = 0; i < BUFFER_SIZE; i++) { //freeing any packets left in the buffer 
-                        if (buffer_used[i] && packet_buffer[i] != NULL) {
-                            free(packet_buffer[i]);
-                        }
-                    }
-                    
-                    fclose(fp); //closing the output file and breaking 
-                    break; //breaking out of the main while loop
-                }
+        if (w->next_deadline != NO_DEADLINE) { //something is due, wait for more data only until then
+            struct timespec timeout;
+            timeout.tv_sec = (w->next_deadline - now) / 1000000;
+            timeout.tv_nsec = ((w->next_deadline - now) % 1000000) * 1000;
+            struct pollfd pfd = { .fd = w->sockfd, .events = POLLIN };
+            if (ppoll(&pfd, 1, &timeout, NULL) <= 0) { //timed out (or a signal), the timers run at the top
                 continue;
             }
         }
-        gettimeofday(&tp, NULL); 
-        // printf("Packet received - seqno: %d, expected: %d, datasize: %d\n", //printing all info in the received packet
-            //    recvpkt->hdr.seqno, expectedseq, recvpkt->hdr.data_size);
-        
-        if (expectedseq == recvpkt->hdr.seqno) { //cheking if the packet that was received matches witht he expected sequence number
-            VLOG(DEBUG, "%lu, %d, %d", tp.tv_sec, recvpkt->hdr.data_size, recvpkt->hdr.seqno); 
-            fseek(fp, recvpkt->hdr.seqno, SEEK_SET); //file pointer is at the position of the byte offset 
-            fwrite(recvpkt->data, 1, recvpkt->hdr.data_size, fp); //writing the packet data into the file
-            fflush(fp); //forcing the data to be written immediately 
-
-            sndpkt = make_packet(0); //making a new packet to send ACKS
-            sndpkt->hdr.ackno = recvpkt->hdr.seqno + recvpkt->hdr.data_size; //setting the ACK num to the next expected byte which is current sequence + data size
-            sndpkt->hdr.ctr_flags = ACK; //setting thje control flag to show that we are dealing with an ACK package
-            
-            if (sendto(sockfd, sndpkt, TCP_HDR_SIZE, 0, 
-                    (struct sockaddr *) &clientaddr, clientlen) < 0) { //checking for any errors while sending the ACK backet back to the client
-                error("ERROR in sendto");
+
+        /*
+         * recvmmsg: receive every UDP datagram that is waiting, blocking for the first one
+         */
+        int n;
+        char *payloads[MAX_BATCH_SIZE];
+        tcp_header hdrs[MAX_BATCH_SIZE];
+        int status[MAX_BATCH_SIZE];
+        if (use_scatter) { //headers into the batch slots, payloads where in order segments of the hot connection belong
+            Connection *h = w->hot;
+            char *dst = w->spill;
+            //past highest_end of a striped file other flows may already have written, of a resumed one an earlier run
+            //the batch is cut into max_seg pieces, only segments that size land where they belong
+            if (h != NULL && h->out->flows == 1 && h->highest_end >= h->out->resumed && h->seg_size == max_seg) {
+                filemap_reserve(&h->output_map, h->highest_end + (size_t)w->recv_batch.capacity * max_seg);
+                dst = h->output_map.base + h->highest_end;
             }
-            last_ack_sent = sndpkt->hdr.ackno; //updated to the last ACK sent
-            expectedseq += recvpkt->hdr.data_size; //update the expected sequence number for the next packet 
-            // printf("ACK sent: %d (updated expected to %d)\n", sndpkt->hdr.ackno, expectedseq); //logging info on ACK and the expcted sequence number 
-            int processed; //starting a do while loop to process any buffered packets
-            do {
-                processed = 0; //flag set to 0 for now
-                for (int i = 0; i < BUFFER_SIZE; i++) { ///looping through the slots in the buffer
-                    if (buffer_used[i] && buffer_seqno[i] == expectedseq) { //checking the buffer slot's status to see if its in use, and also if the packet's sequence number matches the epxected one
-                        tcp_packet *pkt = packet_buffer[i]; //accessing the reference to the buferred packet 
-                        
-                        fseek(fp, pkt->hdr.seqno, SEEK_SET); //writing the buffered packet's data into the file (next 3 lines)
-                        fwrite(pkt->data, 1, pkt->hdr.data_size, fp);
-                        fflush(fp);
-                        VLOG(DEBUG, "%lu, %d, %d", tp.tv_sec, pkt->hdr.data_size, pkt->hdr.seqno);
-                        //updating the expected seq number for the next packet
-                        expectedseq += pkt->hdr.data_size;
-
-                        free(packet_buffer[i]); //freeing the buffer slot and setting its state to 0 to show that it is not in use
-                        packet_buffer[i] = NULL;
-                        buffer_seqno[i] = -1;
-                        buffer_used[i] = 0;
-                        
-                        processed = 1;//setting a flag to show that the packet was processed 
-                        break;
-                    }
-                }
-            } while (processed); //as long as at least one packet was processed, continue the loop
-        
-            sndpkt = make_packet(0); //making a new ACK, with the new expected sequence number 
-            sndpkt->hdr.ackno = expectedseq; //sending the dup ACK 
-            sndpkt->hdr.ctr_flags = ACK;
-            
-            if (sendto(sockfd, sndpkt, TCP_HDR_SIZE, 0, 
-                    (struct sockaddr *) &clientaddr, clientlen) < 0) { 
-                error("ERROR in sendto");
+            n = batch_recv_scatter(&w->recv_batch, TCP_HDR_SIZE, dst, max_seg);
+        } else {
+            n = batch_recv(&w->recv_batch);
+        }
+        if (n < 0)
+            continue;
+
+        for (int i = 0; i < n; i++) { //checksum and unpack every header first, nothing of a corrupt packet is used
+            payloads[i] = use_scatter ? batch_payload(&w->recv_batch, i) : batch_data(&w->recv_batch, i) + TCP_HDR_SIZE;
+            status[i] = packet_decode(batch_data(&w->recv_batch, i), batch_len(&w->recv_batch, i), payloads[i], &hdrs[i]);
+            if (status[i] != WIRE_OK) {
+                w->dropped[status[i]]++;
             }
-        
-            last_ack_sent = sndpkt->hdr.ackno; //updating the tracking variable
-            // printf("Updated ACK sent after processing buffer: %d\n", sndpkt->hdr.ackno); //logging that an updated ACK was sent
-        } else if (recvpkt->hdr.seqno > expectedseq) { // else if section to handle the case when the received packet had a seq number > expected meaning its out of order
-            // printf("Out of order packet (seqno: %d, expected: %d) - buffering\n", 
-            //        recvpkt->hdr.seqno, expectedseq);
-            int slot = -1; // setting the slot to -1 to show that the slot has not been found yet
-            for (int i = 0; i < BUFFER_SIZE; i++) { //looping over the buffer so we can find the first slot that is empty 
-                if (!buffer_used[i]) {
-                    slot = i; //set slot to the found empty index
-                    break; //break when its found 
-                }
+        }
+        if (use_scatter)
+            bounce_mispredicted(w, n, hdrs, status, payloads);
+
+        now = now_us();
+        for (int i = 0; i < n; i++) {
+            if (status[i] != WIRE_OK)
+                continue;
+            if (loss_percent > 0 && rand_r(&w->loss_seed) < loss_percent / 100 * RAND_MAX) {
+                w->lost++;
+                continue;
             }
-            
-            if (slot != -1) { // check if there is an unused slot in the buffer 
-                int size = TCP_HDR_SIZE + recvpkt->hdr.data_size; //calcualting the total size for the packet
-                packet_buffer[slot] = (tcp_packet *)malloc(size); //using malloc to allocate memory in that size for the packet in buffer
-                
-                if (packet_buffer[slot] != NULL) { //quick check to see if the memory allocation was done successfully 
-                    memcpy(packet_buffer[slot], recvpkt, size);// if so then we copy the packet recieved to the buffer space
-                    buffer_seqno[slot] = recvpkt->hdr.seqno; //stores its respective sequence number
-                    buffer_used[slot] = 1; //marks the flag to 1 to show that the space is no longer empty 
-                    // printf("Buffered packet with seqno %d in slot %d\n", recvpkt->hdr.seqno, slot);
-                } else { //otherwise
-                    // printf("Failed to allocate memory for buffering packet\n"); //we indicate that the allocation was failed
+            dispatch(w, i, &hdrs[i], payloads[i], now);
+        }
+        batch_flush(&w->ack_batch); //all acks for this batch leave in one sendmmsg
+    }
+
+    uint64_t now = now_us();
+    for (int b = 0; b < w->conns.nbuckets; b++) { //shutting down, whatever arrived so far is flushed to its file
+        while (w->conns.buckets[b] != NULL) {
+            conn_close(w, w->conns.buckets[b], now);
+        }
+    }
+}
+
+void* worker_main(void *arg)
+{
+    Worker *w = arg;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus); //one worker per core, its socket, table and pool stay in that core's cache
+    CPU_SET(w->index % (ncpu > 0 ? ncpu : 1), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus); //only a hint, a restricted cpuset just keeps the default
+    worker_loop(w);
+    return NULL;
+}
+
+void worker_finish(Worker *w)
+{
+    char name[64];
+
+    if (output_dir != NULL) {
+        printf("worker %d: %lu connections, %lu given up, %lu packets refused\n", w->index, w->opened, w->abandoned, w->refused);
+        snprintf(name, sizeof(name), "worker %d recv batch", w->index);
+    } else {
+        if (w->refused > 0)
+            printf("%lu packets of other transfers refused\n", w->refused);
+        snprintf(name, sizeof(name), "recv batch");
+    }
+    if (output_dir != NULL)
+        printf("worker %d: ", w->index);
+    printf("dropped datagrams:");
+    for (int i = WIRE_SHORT; i < WIRE_ERRORS; i++) {
+        printf(" %s %lu%s", wire_error_names[i], w->dropped[i], i + 1 < WIRE_ERRORS ? "," : "\n");
+    }
+    if (loss_percent > 0) {
+        printf("%lu datagrams thrown away on purpose (-L %g)\n", w->lost, loss_percent);
+    }
+    batch_print_stats(name, &w->recv_batch); //how full our recvmmsg/sendmmsg calls were on average
+    snprintf(name, sizeof(name), output_dir != NULL ? "worker %d ack batch" : "ack batch", w->index);
+    batch_print_stats(name, &w->ack_batch);
+    pool_print_stats("packet pool", &w->packet_pool);
+    pool_destroy(&w->packet_pool);
+    conn_table_free(&w->conns);
+    batch_free(&w->recv_batch);
+    batch_free(&w->ack_batch);
+    free(w->spill);
+    close(w->sockfd);
+}
+
+static void wake_worker(int sig)
+{
+    (void)sig; //only there to interrupt recvmmsg / ppoll, the worker then sees stopping
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-b batch_size] [-g] [-W uring|thread] [-m] [-w recv_window] [-a ack_every] [-d ack_delay_us] [-L loss_percent] [-J checkpoint_ms] [-M max_mtu] [-v] <port> FILE_RECVD\n"
+                    "       %s [options above] -D DIR [-T threads] [-i idle_timeout_s] <port>\n", prog, prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int portno; /* port to listen on */
+    int nworkers = 0; //-T, daemon mode defaults to one per core
+    long idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    int opt;
+
+    /*
+     * check command line arguments
+     */
+    while ((opt = getopt(argc, argv, "b:gW:mw:a:d:D:T:i:L:J:M:v")) != -1) { //optional flags come before the positional arguments
+        switch (opt) {
+            case 'b':
+                batch_size = atoi(optarg);
+                break;
+            case 'g':
+                use_gro = 1;
+                break;
+            case 'W':
+                writer_mode = strcmp(optarg, "thread") == 0 ? WRITER_THREAD : WRITER_URING;
+                break;
+            case 'm':
+                use_scatter = 1;
+                break;
+            case 'w':
+                recv_window = atoi(optarg);
+                break;
+            case 'a':
+                ack_every = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'd':
+                ack_delay_us = atol(optarg);
+                break;
+            case 'D':
+                output_dir = optarg;
+                break;
+            case 'T':
+                nworkers = atoi(optarg);
+                break;
+            case 'i':
+                idle_timeout = atol(optarg);
+                break;
+            case 'L':
+                loss_percent = atof(optarg);
+                break;
+            case 'J':
+                journal_ms = atol(optarg) > 0 ? atol(optarg) : 0;
+                break;
+            case 'M':
+                max_mtu = atoi(optarg);
+                if (max_mtu < MSS_SIZE || max_mtu > MAX_MTU) {
+                    fprintf(stderr, "-M takes %d to %d\n", MSS_SIZE, MAX_MTU);
+                    exit(1);
                 }
-            } else { // if there was no free buffer than log that the buffer is full and we will begin to have packet loss
-                // printf("Buffer full, dropping out-of-order packet\n");
-            }
-            sndpkt = make_packet(0); //creating a new packet to send ACKS
-            sndpkt->hdr.ackno = expectedseq; //set the ACK number to the whatever the expected seq number indicates, this was we can let the sender know that we still need the  expected seq numer 
-            sndpkt->hdr.ctr_flags = ACK;  //settign the control flag to ACK to show that its an ACK packet 
-            
-            if (sendto(sockfd, sndpkt, TCP_HDR_SIZE, 0,  
-                    (struct sockaddr *) &clientaddr, clientlen) < 0) { //checking for any errors in sending, here we are sending the duplicate ACK back tot he cleint 
-                error("ERROR in sendto");
-            }
-            
-            // printf("Duplicate ACK sent: %d\n", sndpkt->hdr.ackno);//loggint the sending of the duplicate ACK and showing its ack number
-        } else { // this final else handles the case when the seq number is less than expected meaning that the packet we processed already is retransmitted
-            // printf("Received retransmission of already processed packet\n");
-            sndpkt = make_packet(0);  //making the ACK packet with the expected sequence number 
-            sndpkt->hdr.ackno = expectedseq;
-            sndpkt->hdr.ctr_flags = ACK; //setting flag to ACK
-            
-            if (sendto(sockfd, sndpkt, TCP_HDR_SIZE, 0, 
-                    (struct sockaddr *) &clientaddr, clientlen) < 0) { //sendin the ACK packet back to the client
-                error("ERROR in sendto");
-            }
-            // printf("ACK sent for retransmission: %d\n", sndpkt->hdr.ackno);
+                max_seg = SEGMENT_SIZE(max_mtu);
+                break;
+            case 'v':
+                verbose = ALL;
+                break;
+            default:
+                usage(argv[0]);
         }
     }
+    if (argc - optind != (output_dir != NULL ? 1 : 2)) { //port, plus the output file unless we serve a directory
+        usage(argv[0]); //if not print a usage message and error code exit
+    }
+    portno = atoi(argv[optind]); //converting the port number from string type to int
+
+    if (output_dir == NULL) { //single transfer: one worker in this thread, done when the transfer is
+        Worker worker;
+        output_path = argv[optind + 1];
+        worker_init(&worker, 0, portno);
+        VLOG(DEBUG, "epoch time, bytes received, sequence number"); //logging a debug message using VLOG macro
+        worker_loop(&worker);
+        worker_finish(&worker);
+        return 0;
+    }
+
+    /*
+     * daemon mode: one worker per core on the same port, until SIGINT or SIGTERM
+     */
+    if (nworkers <= 0) {
+        nworkers = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    }
+    idle_timeout_us = idle_timeout > 0 ? (uint64_t)idle_timeout * 1000000ULL : 0;
+    Worker *workers = calloc(nworkers, sizeof(Worker));
+    if (workers == NULL)
+        error("calloc");
+    for (int i = 0; i < nworkers; i++) { //all sockets are bound before any traffic, so the reuseport group never changes under a client
+        worker_init(&workers[i], i, portno);
+    }
+
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL); //the workers inherit the mask, only this thread takes them
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = wake_worker; //no SA_RESTART, so a blocked recvmmsg returns EINTR
+    sigaction(SIGUSR1, &sa, NULL);
+
+    for (int i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+            error("pthread_create");
+    }
+    printf("receiving into %s on port %d with %d workers\n", output_dir, portno, nworkers);
+    fflush(stdout);
 
+    int sig;
+    sigwait(&stop_signals, &sig);
+    stopping = 1;
+    for (int i = 0; i < nworkers; i++) {
+        struct timespec deadline;
+        do { //a worker that was between its stopping check and recvmmsg missed the first signal, so keep poking
+            pthread_kill(workers[i].thread, SIGUSR1);
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+        } while (pthread_timedjoin_np(workers[i].thread, NULL, &deadline) == ETIMEDOUT);
+    }
+    for (int i = 0; i < nworkers; i++) {
+        worker_finish(&workers[i]);
+    }
+    free(workers);
     return 0;
 }
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,21 +7,40 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <signal.h>
 #include <sys/time.h>
 #include <time.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "packet.h"
 #include "common.h"
-#include "vector.h"
+#include "sendwin.h"
+#include "batch.h"
+#include "filemap.h"
+#include "pool.h"
+#include "timerwheel.h"
+#include "cc.h"
+#include "pacer.h"
+#include "stripe.h"
+#include "crc32c.h"
+#include "fec.h"
+#include "zstream.h"
+#include "journal.h"
+#include "trace.h"
 
-// declaring the timers to start stop and initialize the timers for packer retrasmitting
-void start_timer(void);
-void stop_timer(void);
-void resend_packets(int sig); //signal handler
-void init_timer(int delay, void (*sig_handler)(int));
+// retransmission timers: one per segment in the timer wheel, the wheel drives a timerfd that the epoll loop waits on
+void on_timer(void *arg, long key); //timer wheel callback, only records what expired
+void handle_timeouts(void); //rto handling, runs in the main loop after the wheel was advanced
+int retransmit_lost(int budget); //resend segments an rto declared lost, oldest first
+void arm_timerfd(void); //point the timerfd at the next tick the wheel needs
 
 //defining the constants for the RTT AND RTO
 #define INITIAL_RTO 3000        // rto is initially 3 seconds
@@ -32,245 +52,701 @@ void init_timer(int delay, void (*sig_handler)(int));
 
 
 #define INITIAL_SSTHRESH 64    //initialzing the ssthresh to 64 pkts
-#define SLOW_START 0 // the two states that we can have 0 being slow start and 1 being congestion avoidance 
-#define CONGESTION_AVOIDANCE 1
 
-#define CSV_FILENAME "CWND.csv" //in order to log the chanegs in the cwnd
-
-// defining a struct for the the pkt time stamp to know when each pkt is being sent
-typedef struct {
-    int seqno;                  // seq num
-    struct timeval send_time;   // time pkt sent
-    bool retransmitted;         // boolean to know if the pkt is new or a retransmission (will be used later to skip in rtt calc as per karns algorithm)
-} packet_timestamp;
+#define TRACE_FILENAME "CWND.trace" //binary event trace, trace_decode turns it into CWND.csv. Striped flows other than the first use CWND.<flow>.trace
 
 //measuring rtt and rto dunctions
-void update_rtt(int seqno, struct timeval *send_time, bool was_retransmitted); //updating the calc of rtt based on the acks we are receving 
+void update_rtt(int64_t ackno, long rtt_us); //feeding one rtt sample into srtt / rttvar and recomputing the rto, and into the congestion control
 void calculate_rto(void); // computing new rto based on the rtt changes 
-//record and get the pkt timestamps 
 int get_current_rto(void);
-void record_packet_sent(int seqno, bool is_retransmit);
-struct timeval* get_packet_send_time(int seqno);
-bool was_packet_retransmitted(int seqno);
+unsigned int ts_now(void); //timestamp clock for the tsval header field
 
 //managing congestion control
-void update_congestion_window(bool ack_received, bool timeout, bool triple_dup_ack); //adjusting cwnd based on the possible events (getting an ack, a timeout, or 3 dup acks)
+void update_congestion_window(int event, int acked); //adjusting cwnd based on the possible events (see enum cwnd_event)
 void log_congestion_state(void);
-void log_to_csv(void); // logging thr functions to track the congestion state
+void handle_ack(tcp_packet *recvpkt); //processing one ack taken out of the receive batch
+void send_packet(tcp_packet *pkt); //send (or resend) a single packet from the window right away
+void send_eof(void); //send (or resend) the eof packet
+void send_parity(void); //queue the parity of the fec block just completed
+void mark_sent(WindowSlot *slot, bool is_retransmit); //stamp the send time (and retransmit count) of a segment, call right before it is sent
+void apply_sack(tcp_packet *ack); //mark the segments the receiver reports in SACK ranges
+int retransmit_holes(int budget); //resend segments the SACK scoreboard says are lost, at most budget of them
+void retransmit(WindowSlot *slot); //resend one segment of the window, it is no longer lost once it is on the wire again
+bool resent_recently(WindowSlot *slot); //a retransmitted copy of this segment is less than an rto old
+void retransmit_head(const char *why); //resend the segment at send_base (fast retransmit, partial ack)
+int in_flight(void); //segments sent and neither acked, SACKed nor declared lost
+void mark_delivered(WindowSlot *slot, uint64_t now); //a segment reached the receiver, feeds the delivery rate sample of this ack
+void send_rate_sample(void); //hand the delivery rate sample of the ack just processed to the congestion control
 
 #define STDIN_FD    0
 #define RETRY  120  //defining a retry limit in order not to go into an infinite loop
-#define MAX_WINDOW_SIZE 100 // max window size
-#define MAX_TIMESTAMPS 1000 // max timestamps for tracking
+#define QUERY_TIMEOUT_MS 300 //resume: wait this long for the receiver's answer before asking again
+#define QUERY_TRIES 5
+#define PROBE_TIMEOUT_MS 200 //mtu probing: a probe not echoed within this is taken as lost
+#define PROBE_TRIES 3        //a size is too big once this many probes of it were lost in a row
+#define PROBE_GRANULARITY 32 //the search stops when the biggest size that got through is this close to the smallest that did not
+#define MAX_WINDOW_SIZE 65536 // max cwnd in packets, the send window ring grows on demand up to this
+#define SEG(seqno) ((int)((seqno) / seg_size)) // segment number of a byte offset, every segment but the last is seg_size long. An int is 3 TB at the base mtu
+#define DUP_THRESH 3 // a hole counts as lost once this many segments above it were SACKed, and the segment at send_base after this many dup acks
+
+enum cwnd_event {
+    EV_ACK,             // new data acked outside of recovery, acked segments
+    EV_TIMEOUT,         // rto
+    EV_FAST_RETRANSMIT, // DUP_THRESH dup acks, enter fast recovery
+    EV_DUP_ACK,         // further dup ack during recovery, inflate
+    EV_PARTIAL_ACK,     // ack below recover during recovery, deflate by acked segments
+    EV_FULL_ACK,        // ack at or past recover, leave recovery
+};
 
-int next_seqno=0; //initially zero increment for each pkt
-int send_base=0; //initially zero increments with acks
-Vector packet_window; // from defined vector (check vector.c, vector.h )
+int64_t next_seqno=0; //initially zero increment for each pkt, byte offsets are 64 bit so a transfer can be bigger than 2 GB
+int64_t send_base=0; //initially zero increments with acks
+SendWindow window; // ring of in flight segments indexed by segment number (check sendwin.c, sendwin.h)
+int cwnd = 1; // congestion window in packets, how many segments may be in flight (whole segments of cc.cwnd)
+CongestionControl cc; // the congestion control algorithm picked with -c (check cc.c, cc.h)
+int peer_rwnd = MAX_WINDOW_SIZE; // receive window the receiver advertises in its acks, in packets, caps what cwnd lets us send
 int sockfd, serverlen; //socket file descriptor for network communication + the length of the server address struct
 struct sockaddr_in serveraddr; //carries the IP address and port number of dest
-struct itimerval timer; //setup and manage timeout intervals
 tcp_packet *sndpkt; //points to the pkt thats currently being sent
 tcp_packet *recvpkt;//points to the received pkts/ acks
-sigset_t sigmask; //responsible for making sure that timers wont interupt other operations 
-int previous_acks[3] = {-1, -1, -1}; //array to detect 3 sup acks
-int acknum = 0;//ack counter
+int dup_acks = 0; //acks for send_base in a row while data is outstanding, new acks reset it, stale (reordered) acks are ignored
+int64_t recover = 0;  //next_seqno when fast recovery started, an ack at or past it ends recovery (RFC 6582), we only enter again above it
 int packet_count = 0;//total pkts sent 
+unsigned long retransmissions = 0; //segments sent again, for every reason
+unsigned long acks_received = 0;   //with packet_count and retransmissions, how many acks the sender handles per data packet
+unsigned long bad_acks[WIRE_ERRORS];  //acks dropped because packet_decode refused them, by reason
+unsigned int conn_id = 0;  //stamped on every packet, a receiver daemon tells concurrent transfers (and restarts) apart by it
 int eof_reached = 0;       // eof reached
 int eof_packet_sent = 0;   // eof sent
 int eof_acked = 0;         // eof acked
 tcp_packet *eof_packet = NULL;  // eof packet ptr
-int last_ack_received = -1;     // track last ack for better duplicate detection
 
-//variables to track the rtt and rto
-packet_timestamp timestamps[MAX_TIMESTAMPS];  //array storing the timestamps for the pkts that are snt out
-int timestamp_count = 0;                      // num of timestamps recorded
+#define EOF_TIMER -1            // timer wheel key of the eof packet's timer, segment timers use the segment number
+#define PACE_TIMER -2           // timer wheel key of the pacer's wakeup
+TimerWheel timers;              // per segment deadlines
+int timerfd;                    // fires when the wheel needs to be advanced
+uint64_t timerfd_armed = 0;     // tick the timerfd is set to, so it is only reprogrammed when that changes
+int eof_timer = TW_NONE;        // timer of the eof packet
+bool rto_fired = false;         // a segment timer expired since the last handle_timeouts
+bool eof_rto_fired = false;     // the eof timer expired since the last handle_timeouts
+int lost_count = 0;             // segments marked lost and not yet resent
+unsigned long timeouts = 0;     // rto events
+int highest_sacked = -1;        // highest segment any SACK range covered, holes below it may be lost
+int sacked_in_window = 0;       // SACKed segments not yet cumulatively acked
+
+//delivery rate estimation (the method of draft-cheng-iccrg-delivery-rate-estimation), for model based congestion control
+long delivered = 0;             // segments delivered so far
+uint64_t delivered_time = 0;    // when delivered last went up
+uint64_t first_sent_time = 0;   // send time of the newest segment delivered, starts the next interval
+bool have_sample = false;       // this ack delivered something
+RateSample rate_sample;         // built while the ack is processed, from the most recently sent segment it covers
+uint64_t sample_send_elapsed;   // send side length of the sample's interval
+uint64_t sample_prior_time;     // delivered_time when that segment was sent
+//pacing: new data leaves through a token bucket at the congestion control's pacing rate instead of as one window burst
+bool use_pacing = false;        // -p
+bool use_txtime = false;        // -x, the bucket stamps departure times and the kernel (fq) holds the packets
+Pacer pacer;
+int pace_timer = TW_NONE;       // wakes the loop up when the bucket has tokens for the next burst
+int txtime_burst_fill = 0;      // packets stamped with the departure time of the current burst so far
+unsigned long sacked_segments = 0;      // segments we learned about from SACK ranges
+unsigned long holes_retransmitted = 0;  // retransmissions the SACK scoreboard asked for
+
+//variables to track the rtt and rto, send times live in the window slots
+bool use_timestamps = false;                  // stamp every packet with tsval, the receiver echoes it back so each ack is an rtt sample
 int srtt = -1;                                // initially not defined, smoothed RTT which is calculated by srtt = (1-ALPHA) * srtt + ALPHA * measured_rtt
 int rttvar = -1;                              //  initially not defined, the rtt deviation
 int rto = INITIAL_RTO;                        
 int consecutive_timeouts = 0;                 // counting the number of consecutive timeouts for the exponential backoff
 
-// variables for congestion control
-int ssthresh = INITIAL_SSTHRESH;              // slow start thresh
-int congestion_state = SLOW_START;            // initially the state will be at slow start, later can move to congestion avoidance
-float fractional_cwnd = 0;                    // float definition to allow the later fractional increment (+=1/cwnd) in congestion avoidance
+Batch send_batch; //window bursts are queued here and flushed with a single sendmmsg
+Batch ack_batch;  //pending acks are drained from the socket with a single recvmmsg
+
+PacketPool packet_pool; //window packets come from here instead of malloc, MSS sized slots (header sized in mmap mode)
+
+bool use_mmap = false; //zero copy mode: payload is sent straight out of a mapping of the input file
+FileMap input_map;     //the mapping, window packets then only carry the header (offset, data_size = length)
+FILE *fp = NULL;       //the input file when it is read with fread (not used in mmap mode)
+
+//striping: the file is split over several flows, each a forked copy of this process with its own socket, window and rtt
+int nflows = 1;        //-f
+int flow = 0;          //which one this process is
+Stripe *stripe = NULL; //the byte ranges of all flows, shared between the processes
+int64_t chunk_offset = 0;  //file offset of the next byte of the chunk being sent
+int chunk_left = 0;    //bytes of it not sent yet
 
-FILE *csv_file = NULL;
+//forward error correction: after every k new segments m parity segments, the receiver rebuilds up to m lost ones
+//of the block without waiting a round trip for the retransmission. Parity is sent once, outside of the window
+bool use_fec = false;  //-F k[,m]
+FecEncoder fec;
 
-// getting a more precise timestamp (microsec as decimal)
-double get_timestamp_with_ms() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return (double)tv.tv_sec + ((double)tv.tv_usec / 1000000.0);
+//compression: the file is read a block at a time and every block is sent as a compressed frame, the flow's
+//byte stream (seqno) is then the stream of frames and no longer the file itself
+bool use_compress = false; //-z block_kb
+ZWriter zw;
+
+//resuming: the receiver keeps a journal of what it has, we ask for it before sending and skip every segment
+//(or compression block) it holds in full. conn_id comes from the file then, so the receiver finds the journal
+bool resume = false;       //-r
+RangeSet done;             //byte ranges the receiver says it has
+unsigned long long skipped = 0;
+long long file_size = 0;
+
+//path mtu: segments are DATA_SIZE (base mtu) unless -M lets us probe the path for bigger datagrams before the
+//transfer, the size found holds for the whole transfer
+int max_mtu = MSS_SIZE;    //-M
+int seg_size = DATA_SIZE;  //payload of a full segment
+
+/*
+ * packet_payload: where the payload of a window packet lives, either behind its header
+ * or, in mmap mode, in the file mapping at its byte offset
+ */
+char* packet_payload(tcp_packet *pkt)
+{
+    return use_mmap ? input_map.base + pkt->hdr.offset : pkt->data;
 }
 
-//logging all the congetion control details into a csv file
-void log_to_csv() {
-    if (csv_file != NULL) { //check if file is succesfully opened beforfe proceeding 
-        double timestamp = get_timestamp_with_ms(); //get precise current timestamp 
-        //check if we are currently at slow start or congestion avoidance to determine whether to increment fractionally or not
-        float cwnd_value = (congestion_state == CONGESTION_AVOIDANCE && fractional_cwnd > 0) 
-                          ? fractional_cwnd 
-                          : (float)vector_size(&packet_window);
-        //immediately writing to the file 
-        fprintf(csv_file, "%.6f,%.2f,%d\n", timestamp, cwnd_value, ssthresh);
-        fflush(csv_file); 
+/*
+ * read_file: length and file offset of the next (at most max) bytes of the file for this flow, they are read
+ * into buffer unless we send from the mapping. 0 at the end of the file, or when striping once no range has
+ * anything left for us
+ */
+int read_file(char *buffer, int max, int64_t *offset)
+{
+    static int64_t file_pos = 0; //not striped: how far we got, equal to next_seqno unless we compress or resume
+    int len;
+
+    do { //pieces the receiver already has are passed over, they stay whole segments so SEG() still holds
+        if (stripe == NULL) {
+            len = file_size - file_pos < max ? file_size - file_pos : max;
+            *offset = file_pos;
+            file_pos += len;
+        } else {
+            if (chunk_left == 0) {
+                chunk_left = stripe_claim(stripe, flow, &chunk_offset);
+                if (chunk_left == 0) {
+                    return 0;
+                }
+            }
+            len = chunk_left < max ? chunk_left : max;
+            *offset = chunk_offset;
+            chunk_offset += len;
+            chunk_left -= len;
+        }
+        if (len > 0 && done.count > 0 && ranges_cover(&done, *offset, (uint64_t)*offset + len)) {
+            skipped += len;
+            continue;
+        }
+        break;
+    } while (1);
+    if (len > 0 && fp != NULL) { //only seeks after a jump, a stream read in order stays buffered
+        if (ftello(fp) != *offset && fseeko(fp, *offset, SEEK_SET) < 0) {
+            error("fseeko");
+        }
+        if (fread(buffer, 1, len, fp) != (size_t)len) {
+            error("fread");
+        }
     }
+    return len;
 }
 
-void resend_packets(int sig) //resend oldest packet
+/*
+ * next_segment: length and file offset of the next new segment. Without compression that is the next bytes of
+ * the file, with it the next bytes of the frame stream (offset is then the block of the frame it starts in)
+ */
+int next_segment(char *buffer, int64_t *offset)
 {
-    if (sig == SIGALRM)
-    {
-        VLOG(INFO, "Timeout happened for segment starting at %d", send_base); 
-        
-        // exponential back off 
-        consecutive_timeouts++;
-        if (consecutive_timeouts > 1) {
-            rto *= 2;  // more than 1 timeout for pkt consecutively, double the rto
-            if (rto > MAX_RTO) { //making sure to limtit the rto to the max which is 240 seconds
-                rto = MAX_RTO;  
+    int n = 0;
+
+    if (!use_compress) {
+        return read_file(buffer, seg_size, offset);
+    }
+    while (n < seg_size) { //segments run across frame boundaries, only the last one of the stream is short
+        int got = zw_read(&zw, buffer + n, seg_size - n);
+        if (got == 0) {
+            int64_t block_offset;
+            int len = read_file(zw.raw, zw.block, &block_offset);
+            if (len == 0) {
+                break;
             }
-            printf("Exponential backoff: RTO now %d ms for segment %d\n", rto, send_base);
+            zw_pack(&zw, block_offset, len);
+            continue;
         }
-        
-        update_congestion_window(false, true, false); //updating the cwnd afer timeout
-    
-        log_to_csv(); //logging to the csv
+        if (n == 0) {
+            *offset = zw.frame_offset;
+        }
+        n += got;
+    }
+    return n;
+}
+
+/*
+ * query_progress: resuming, ask the receiver which byte ranges of the file it already has. Asked once before
+ * the flows start, so all of them skip the same ranges. Without an answer the whole file is sent
+ */
+void query_progress(void)
+{
+    struct timeval tv = { 0, QUERY_TIMEOUT_MS * 1000 };
+    char buf[MSS_SIZE];
+    tcp_header hdr = {0};
+    wire_header wire;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
 
-        if (eof_reached && eof_packet_sent && !eof_acked) { // this handles the case if we reached eof, and it was sent but not acked
-            printf("Timeout - eof packet resend\n");
-            if(sendto(sockfd, eof_packet, TCP_HDR_SIZE, 0, 
-                    (const struct sockaddr *)&serveraddr, serverlen) < 0) { //resenf the eof pkt
-                error("sendto");
+    if (fd < 0) {
+        error("ERROR opening socket");
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    hdr.ctr_flags = QUERY;
+    hdr.conn_id = conn_id;
+    hdr.flows = nflows;
+    packet_encode(&hdr, NULL, &wire);
+    for (int tries = 0; tries < QUERY_TRIES; tries++) {
+        if (sendto(fd, &wire, TCP_HDR_SIZE, 0, (struct sockaddr *)&serveraddr, serverlen) < 0) {
+            error("sendto");
+        }
+        int n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) >= 0) { //anything but the answer is ignored, a timeout asks again
+            tcp_header reply;
+            if (packet_decode(buf, n, NULL, &reply) != WIRE_OK || reply.ctr_flags != PROGRESS || reply.conn_id != conn_id ||
+                ranges_unpack(&done, buf + TCP_HDR_SIZE, reply.data_size) < 0) {
+                continue;
             }
-        } else { // this handles the typical case, so oldest pkt is being sent
-            int window_index = (send_base/DATA_SIZE) % vector_capacity(&packet_window); //calc the index of the oldest unacked pkt
-            tcp_packet* oldest_packet = vector_at(&packet_window, window_index); 
-            if (oldest_packet != NULL) { 
-                printf("Timeout - packet resend with seqno: %d, RTO: %d ms, Segment: %d\n", 
-                       oldest_packet->hdr.seqno, rto, send_base);
-            
-                record_packet_sent(oldest_packet->hdr.seqno, true); //making sure to mark this as retransmission to skip during implementation of karns algorithm
-                
-                if(sendto(sockfd, oldest_packet, TCP_HDR_SIZE + get_data_size(oldest_packet), 0, 
-                        (const struct sockaddr *)&serveraddr, serverlen) < 0) { //handling error case of returing a negative value which means that there was a network related error  
-                    error("sendto");
-                }
-            } else { // handling the error case of a missing packets
-                printf("Warning: No packet found at index %d to resend\n", window_index);
+            RangeSet none;
+            ranges_init(&none);
+            ranges_merge(&done, &none); //sorted, ranges_cover needs that
+            printf("resume: the receiver has %llu of %lld bytes in %d ranges\n", (unsigned long long)ranges_bytes(&done),
+                   file_size, done.count);
+            close(fd);
+            return;
+        }
+    }
+    printf("resume: no answer from the receiver, sending the whole file\n");
+    close(fd);
+}
+
+/*
+ * probe_once: send probes padded to an mtu sized datagram until one is echoed, false when they all got lost or the
+ * kernel already knows the route can not take them. The echo of the first probe also carries the receiver's maximum
+ */
+bool probe_once(int fd, int mtu, int *peer_max)
+{
+    static char probe[MAX_MTU]; //zero padding behind the header
+    char buf[MSS_SIZE];
+    tcp_header hdr = {0};
+    wire_header wire;
+
+    hdr.ctr_flags = PROBE;
+    hdr.conn_id = conn_id;
+    hdr.data_size = SEGMENT_SIZE(mtu);
+    packet_encode(&hdr, probe + TCP_HDR_SIZE, &wire);
+    memcpy(probe, &wire, TCP_HDR_SIZE);
+    for (int tries = 0; tries < PROBE_TRIES; tries++) {
+        if (sendto(fd, probe, TCP_HDR_SIZE + hdr.data_size, 0, (struct sockaddr *)&serveraddr, serverlen) < 0) {
+            if (errno == EMSGSIZE) { //bigger than our own interface takes
+                return false;
             }
+            error("sendto");
+        }
+        int n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) >= 0) { //echoes of earlier (smaller) probes are ignored
+            tcp_header reply;
+            if (packet_decode(buf, n, NULL, &reply) != WIRE_OK || reply.ctr_flags != PROBE || reply.conn_id != conn_id ||
+                (int)reply.ackno != mtu) {
+                continue;
+            }
+            if (peer_max != NULL) {
+                *peer_max = reply.rwnd;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * probe_mtu: packetization layer path mtu discovery (RFC 8899) before the flows start. Probes go out with DF set
+ * and the receiver echoes them, a size is too big when it gets no echo, so a path that drops big datagrams without
+ * telling us (a black hole) is found as well as one that sends back an ICMP. The base mtu needs no probe to work,
+ * the first one is still base sized, it learns how big the receiver goes. Then the biggest size both ends take is
+ * tried, and a binary search runs between what got through and what did not when it fails.
+ * The result holds for the whole transfer, SEG() needs every full segment to be the same size
+ */
+void probe_mtu(void)
+{
+    struct timeval tv = { 0, PROBE_TIMEOUT_MS * 1000 };
+    int pmtudisc = IP_PMTUDISC_PROBE; //DF, and ignore the path mtu the kernel may have cached so we can go above it
+    int peer_max = MSS_SIZE;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (fd < 0) {
+        error("ERROR opening socket");
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc)) < 0) {
+        perror("IP_MTU_DISCOVER");
+    }
+    if (!probe_once(fd, MSS_SIZE, &peer_max)) {
+        printf("mtu probe: no answer from the receiver, staying at %d bytes\n", MSS_SIZE);
+        close(fd);
+        return;
+    }
+    int top = max_mtu < peer_max ? max_mtu : peer_max;
+    int lo = MSS_SIZE, hi = top + 1; //lo got through, hi did not
+    int mtu = top;
+    while (mtu > lo) {
+        if (probe_once(fd, mtu, NULL)) {
+            lo = mtu;
+        } else {
+            hi = mtu;
+        }
+        mtu = hi - lo > PROBE_GRANULARITY ? (lo + hi) / 2 : lo;
+    }
+    close(fd);
+    seg_size = SEGMENT_SIZE(lo);
+    printf("mtu probe: %d byte datagrams (receiver takes %d), %d byte segments\n", lo, peer_max, seg_size);
+}
+
+/*
+ * start_flows: striping, fork one process per flow. Every flow gets its own socket (and source port), window,
+ * rtt estimate and congestion control, the only thing they share is the stripe. Returns in the children with
+ * flow set, the parent waits for all of them and exits
+ */
+void start_flows(const char *path)
+{
+    struct stat st;
+    struct timeval start, end;
+    pid_t pids[MAX_FLOWS];
+    int failed = 0;
+
+    if (stat(path, &st) < 0) {
+        error((char *)path);
+    }
+    stripe = stripe_create(st.st_size, seg_size, nflows);
+    if (stripe == NULL) {
+        error("stripe_create");
+    }
+    gettimeofday(&start, NULL);
+    fflush(stdout); //or the children print our buffered output again
+    for (int i = 0; i < nflows; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            error("fork");
+        }
+        if (pids[i] == 0) {
+            flow = i;
+            return;
+        }
+    }
+    for (int i = 0; i < nflows; i++) {
+        int status;
+        if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "flow %d failed\n", i);
+            failed = 1;
         }
-        
-        init_timer(rto, resend_packets);  // updating timer to current rto
-        start_timer(); // restart timer on oldest packet
     }
+    gettimeofday(&end, NULL);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    stripe_print_stats(stripe);
+    printf("striped transfer: %lld bytes over %d flows in %.3f s, %.1f Mbit/s\n", (long long)st.st_size, nflows, secs,
+           secs > 0 ? st.st_size * 8 / secs / 1e6 : 0.0);
+    stripe_destroy(stripe);
+    exit(failed);
 }
 
+#ifdef RDT_TRACE
+Trace trace; //events go into a ring in memory, a thread of the trace module writes them out, nothing on the ack path waits for the disk
 
-void start_timer() 
+/*
+ * trace_event: one record with the state every event carries, a handful of stores into the ring. The
+ * record is filled in place, so the TR_CWND fields of trace_cwnd are only paid for where the csv rows used to be written
+ */
+static inline TraceRecord* trace_event(int event, int64_t seq, uint64_t rtt_us, uint64_t now)
 {
-    sigprocmask(SIG_UNBLOCK, &sigmask, NULL); //unnlocking any signal the was set in sigmask
-    setitimer(ITIMER_REAL, &timer, NULL); // starting a timer to genertae SIGALRM signals only for when the timer expires
+    TraceRecord *r = trace_next(&trace);
+
+    if (r != NULL) {
+        r->time = now;
+        r->seq = seq;
+        r->cwnd = cc.cwnd;
+        r->ssthresh = cc.ssthresh;
+        r->rtt = rtt_us;
+        r->rto = rto;
+        r->event = event;
+        r->state = cc.state | (cc.in_recovery ? TRACE_RECOVERY : 0);
+        r->min_rtt = 0;
+        r->pacing = 0;
+        r->btl_bw = 0;
+        r->burst = 0;
+    }
+    return r;
 }
 
+//a CWND.csv row: the congestion state with the pacing rate and burst, the bottleneck bandwidth estimate and the min rtt
+static void trace_cwnd(void)
+{
+    TraceRecord *r = trace_event(TR_CWND, send_base, cc.srtt, tw_clock());
+
+    if (r != NULL) {
+        r->min_rtt = cc.min_rtt;
+        r->pacing = cc_pacing_rate(&cc) * 8 / 1e6;
+        r->btl_bw = cc_bandwidth(&cc) * 8 / 1e6;
+        r->burst = use_pacing ? pacer_burst_segments(&pacer) : 0; //0 when not pacing
+        trace_commit(&trace);
+    }
+}
 
-void stop_timer() 
+static inline void trace_log(int event, int64_t seq, uint64_t rtt_us, uint64_t now)
 {
-    sigprocmask(SIG_BLOCK, &sigmask, NULL); //here we block the signals to stop the SIGALRM from interupting the process until its unlocked again
+    if (trace_event(event, seq, rtt_us, now) != NULL) {
+        trace_commit(&trace);
+    }
 }
 
+#define TRACE(event, seq, now) trace_log(event, seq, cc.srtt, now)
+#define TRACE_RTT(seq, rtt_us, now) trace_log(TR_RTT, seq, rtt_us, now)
+#define TRACE_CWND() trace_cwnd()
+#else
+#define TRACE(event, seq, now) ((void)0)
+#define TRACE_RTT(seq, rtt_us, now) ((void)0)
+#define TRACE_CWND() ((void)0)
+#endif
 
 /*
- * init_timer: Initialize timer
- * delay: delay in milliseconds
- * sig_handler: signal handler function for re-sending unACKed packets
+ * on_timer: called by tw_advance for every expired timer, never from signal context. It only takes notes,
+ * handle_timeouts reacts once per batch of expiries so a burst sent together counts as one rto
  */
-void init_timer(int delay, void (*sig_handler)(int)) 
+void on_timer(void *arg, long key)
 {
-    signal(SIGALRM, sig_handler); //calling sig_handler for the SIGALRM signal is received 
-    timer.it_interval.tv_sec = delay / 1000; //2nd part of the timer also converting ms to secs  
-    timer.it_interval.tv_usec = (delay % 1000) * 1000;   //get remainder of the delay by using modulo 1000 then cnvert to microsecs
-    timer.it_value.tv_sec = delay / 1000; 
-    timer.it_value.tv_usec = (delay % 1000) * 1000;
-
-    sigemptyset(&sigmask);//clear any previos signal settings
-    sigaddset(&sigmask, SIGALRM);//used to control when the timer can interrup the start/stop timer
+    (void)arg;
+    if (key == EOF_TIMER) {
+        eof_timer = TW_NONE;
+        eof_rto_fired = true;
+        return;
+    }
+    if (key == PACE_TIMER) { //nothing to do, the loop sends once it is awake
+        pace_timer = TW_NONE;
+        return;
+    }
+    WindowSlot *slot = sendwin_slot(&window, (int)key);
+    if (slot != NULL) {
+        slot->timer = TW_NONE;
+        if (slot->pkt != NULL && !slot->sacked) {
+            rto_fired = true;
+        }
+    }
 }
 
-void record_packet_sent(int seqno, bool is_retransmit) 
+void handle_timeouts(void)
 {
-    int i;
-    
-//check for existing enteries
-    for (i = 0; i < timestamp_count; i++) { //loop over the existing timestamps
-        if (timestamps[i].seqno == seqno) { //if we find a matched seq num
-            gettimeofday(&timestamps[i].send_time, NULL);//update the send time to the current time using gettimeofday()
-            timestamps[i].retransmitted = is_retransmit;// setting the retransmission flag if needed
-            return;
+    if (!rto_fired && !eof_rto_fired) {
+        return;
+    }
+    timeouts++;
+    VLOG(INFO, "Timeout happened for segment starting at %lld", (long long)send_base); 
+
+    // exponential back off 
+    consecutive_timeouts++;
+    if (consecutive_timeouts > 1) {
+        rto *= 2;  // more than 1 timeout for pkt consecutively, double the rto
+        if (rto > MAX_RTO) { //making sure to limtit the rto to the max
+            rto = MAX_RTO;  
         }
+        printf("Exponential backoff: RTO now %d ms for segment %lld\n", rto, (long long)send_base);
     }
-    
-    if (timestamp_count >= MAX_TIMESTAMPS) { //check if we reached max time stamp
-        timestamp_count = 0;//if yes, reset the counter to 0 
+
+    update_congestion_window(EV_TIMEOUT, 0); //updating the cwnd afer timeout, this also ends fast recovery
+    recover = next_seqno; //no fast retransmit for dup acks of data sent before the timeout
+    dup_acks = 0;
+    TRACE(TR_TIMEOUT, send_base, tw_clock());
+    TRACE_CWND();
+
+    if (eof_rto_fired && eof_packet_sent && !eof_acked) { // this handles the case if we reached eof, and it was sent but not acked
+        printf("Timeout - eof packet resend\n");
+        send_eof(); //resend the eof pkt
+        eof_timer = tw_schedule(&timers, tw_clock() + rto * 1000ULL, EOF_TIMER);
     }
 
-    timestamps[timestamp_count].seqno = seqno; //store seq num of pkt
-    gettimeofday(&timestamps[timestamp_count].send_time, NULL); //record current time
-    timestamps[timestamp_count].retransmitted = is_retransmit;//setting the restransmison flag to "is_retrasnmit"
-    timestamp_count++; //incrementing the counter
+    if (rto_fired) { //like TCP after an rto everything in flight that was not SACKed is considered lost
+        for (int seg = window.base_seg; seg < window.next_seg; seg++) {
+            WindowSlot *slot = sendwin_slot(&window, seg);
+            if (slot->pkt != NULL && !slot->sacked && !slot->lost) {
+                tw_cancel(&timers, slot->timer);
+                slot->timer = TW_NONE;
+                slot->lost = true;
+                lost_count++;
+            }
+        }
+        printf("Timeout - %d segments lost from seqno %lld, RTO: %d ms\n", lost_count, (long long)send_base, rto);
+        if (cwnd > in_flight()) { //cwnd is back to 1, the rest go out as acks open the window again
+            retransmit_lost(cwnd - in_flight());
+        }
+    }
+    rto_fired = false;
+    eof_rto_fired = false;
 }
 
-
-struct timeval* get_packet_send_time(int seqno) //returns a pointer to the struct timeval
+/*
+ * retransmit_lost: resend up to budget lost segments, oldest first
+ */
+int retransmit_lost(int budget)
 {
-    for (int i = 0; i < MAX_TIMESTAMPS; i++) { //loop over all the possible timestamps
-        if (timestamps[i].seqno == seqno) { //check if the current timestamp entry matches with the resquested seq num
-            return &timestamps[i].send_time; //if matched, return its memory address
+    int sent = 0;
+    for (int seg = window.base_seg; seg < window.next_seg && lost_count > 0 && sent < budget; seg++) {
+        WindowSlot *slot = sendwin_slot(&window, seg);
+        if (!slot->lost) {
+            continue;
         }
+        VLOG(DEBUG, "Timeout - packet resend with seqno: %lld", (long long)slot->seqno);
+        retransmit(slot);
+        sent++;
+    }
+    return sent;
+}
+
+
+/*
+ * send_packet: header and payload go out as two iovecs so the payload never has to sit
+ * right behind the header (it does not in mmap mode)
+ */
+void send_packet(tcp_packet *pkt)
+{
+    struct iovec iov[2];
+    struct msghdr mh;
+    wire_header wire;
+
+    packet_encode(&pkt->hdr, packet_payload(pkt), &wire); //a retransmission has a new tsval, so a new checksum too
+    iov[0].iov_base = &wire;
+    iov[0].iov_len = TCP_HDR_SIZE;
+    iov[1].iov_base = packet_payload(pkt);
+    iov[1].iov_len = get_data_size(pkt);
+    retransmissions++;
+    if (use_pacing) { //retransmissions are never held back, but they use up the rate like everything else
+        pacer_consume(&pacer, get_data_size(pkt));
+    }
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = &serveraddr;
+    mh.msg_namelen = serverlen;
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+    if (sendmsg(sockfd, &mh, 0) < 0) { //handling error case of returing a negative value which means that there was a network related error
+        error("sendmsg");
     }
-    return NULL;//otherwise return null as there is no send time info available
 }
 
 
-bool was_packet_retransmitted(int seqno) //checking for retransmitted packets to ignore them in calculating rtt measurments (karns algorithm)
+/*
+ * send_parity: the payloads are referenced by the send batch, fec_next_block says when the encoder is about
+ * to reuse one that may still be queued
+ */
+void send_parity(void)
 {
-    for (int i = 0; i < MAX_TIMESTAMPS; i++) { //similar to the above block
-        if (timestamps[i].seqno == seqno) {
-            return timestamps[i].retransmitted;
+    for (int row = 0; row < fec.m; row++) {
+        tcp_header hdr = {0};
+        const char *payload;
+        wire_header wire;
+
+        fec_parity(&fec, row, &hdr, &payload);
+        hdr.conn_id = conn_id;
+        hdr.flows = nflows;
+        hdr.seg_size = seg_size;
+        packet_encode(&hdr, payload, &wire);
+        batch_add(&send_batch, &wire, TCP_HDR_SIZE, payload, hdr.data_size, &serveraddr);
+        if (use_pacing && !use_txtime) {
+            pacer_consume(&pacer, hdr.data_size);
         }
     }
-    return false; //returning false assuming that pkt not found in the timestamp array has not been retransmitted
+    if (fec_next_block(&fec)) {
+        batch_flush(&send_batch);
+    }
 }
 
+void send_eof(void)
+{
+    wire_header wire;
+
+    packet_encode(&eof_packet->hdr, NULL, &wire);
+    if (sendto(sockfd, &wire, TCP_HDR_SIZE, 0, (const struct sockaddr *)&serveraddr, serverlen) < 0) {
+        error("sendto");
+    }
+}
 
 
-void update_rtt(int ackno, struct timeval *send_time, bool was_retransmitted) //function for updating the RTT based on akcs received 
+/*
+ * mark_sent: per segment bookkeeping whenever a segment goes on the wire
+ */
+void mark_sent(WindowSlot *slot, bool is_retransmit)
 {
-    struct timeval now, diff; //variables for current time and rtt difference
-    int rtt_ms; //rtt val in ms
-    
-    if (was_retransmitted) { //ignore rtt calc from retrasnmitted packets to implement karns algorthm
-        printf("Skipping RTT calculation for retransmitted packet (Karn's algorithm)\n");
+    gettimeofday(&slot->send_time, NULL);
+    slot->pkt->hdr.tsval = use_timestamps ? ts_now() : 0; //goes out with the header, a retransmission gets a fresh one
+    tw_cancel(&timers, slot->timer); //every segment has its own deadline, one rto after it last went out
+    slot->timer = tw_schedule(&timers, tw_clock() + rto * 1000ULL, SEG(slot->seqno));
+
+    uint64_t now = tw_clock();
+    if (in_flight() == 0) { //nothing in flight, a new sampling interval starts with this segment
+        first_sent_time = now;
+        delivered_time = now;
+    }
+    slot->sent_us = now;
+    slot->delivered = delivered;
+    slot->delivered_time = delivered_time;
+    slot->first_sent_time = first_sent_time;
+    if (is_retransmit) {
+        slot->retransmits++;
+    }
+    TRACE(is_retransmit ? TR_RETRANSMIT : TR_SEND, slot->seqno, now);
+}
+
+
+/*
+ * arm_timerfd: the timerfd always points at the next tick the wheel has work for, absolute on the
+ * monotonic clock so it keeps microsecond resolution
+ */
+void arm_timerfd(void)
+{
+    uint64_t next = tw_next_tick(&timers);
+    struct itimerspec its;
+
+    if (next == timerfd_armed) {
         return;
     }
-    
-    gettimeofday(&now, NULL);
-    
-    timersub(&now, send_time, &diff); //diff = now - send_time
-    rtt_ms = diff.tv_sec * 1000 + diff.tv_usec / 1000; //convert to milli secs
-    
-    printf("Measured RTT: %d ms for packet %d\n", rtt_ms, ackno);
+    memset(&its, 0, sizeof(its)); //all zero disarms it when the wheel is empty
+    if (next != UINT64_MAX) {
+        its.it_value.tv_sec = next / 1000000;
+        its.it_value.tv_nsec = (next % 1000000) * 1000;
+    }
+    if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        error("timerfd_settime");
+    }
+    timerfd_armed = next;
+}
+
+/*
+ * ts_now: microseconds on the monotonic clock, cut to 32 bits, the receiver only echoes it so only
+ * differences matter and those survive the wrap. 0 is kept to mean "no timestamp" in the header
+ */
+unsigned int ts_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned int now = (unsigned int)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+    return now != 0 ? now : 1;
+}
+
+
+void update_rtt(int64_t ackno, long rtt_us) //function for updating the RTT based on akcs received 
+{
+    int rtt_ms = (int)(rtt_us / 1000); //the rto works in milliseconds
+    uint64_t now = tw_clock();
+
+    cc_on_rtt_sample(&cc, rtt_us, now); //the congestion control keeps its own microsecond estimates
+    TRACE_RTT(ackno, rtt_us, now);
     
     if (srtt == -1) {
         srtt = rtt_ms; //initialize the smooth rtt to the first rtt sample
         rttvar = rtt_ms / 2; //rtt variation is initalliy firstmeasurement/2
-        printf("Initial SRTT: %d ms, RTTVAR: %d ms\n", srtt, rttvar);
     } else {
        //updating smooth rtt and rtt variation by using Exponential Weighted Moving Average
         rttvar = (int)((1 - BETA) * rttvar + BETA * abs(srtt - rtt_ms)); 
         srtt = (int)((1 - ALPHA) * srtt + ALPHA * rtt_ms);
-        
-        printf("Updated SRTT: %d ms, RTTVAR: %d ms\n", srtt, rttvar);
     }
     rto = srtt + K * rttvar; //calculating rto using the formula mentioned in the slides, where k=4
 //making sure rto is within the limit
@@ -279,8 +755,7 @@ void update_rtt(int ackno, struct timeval *send_time, bool was_retransmitted) //
     } else if (rto > MAX_RTO) { 
         rto = MAX_RTO;
     }
-    
-    printf("New RTO: %d ms\n", rto);
+    VLOG(DEBUG, "RTT %d ms for %lld, SRTT %d ms, RTTVAR %d ms, RTO %d ms", rtt_ms, (long long)ackno, srtt, rttvar, rto);
 
     consecutive_timeouts = 0; //upon getting a valid ack. reset the consecutive timeout counter to 0 to record the next consecutive timeout
 }
@@ -291,116 +766,446 @@ int get_current_rto(void) //get current rto value
 }
 
 
-void update_congestion_window(bool ack_received, bool timeout, bool triple_dup_ack) //function to update the congestion window based on the 3 possible network events: 1- normal ack received, 2- timeout, 3- 3 dupe acks
+void update_congestion_window(int event, int acked) //function to update the congestion window based on the network events: new acks, timeouts and the fast recovery events
 
 {
-    int old_state = congestion_state; //before any adjustments the current congestion state and window are stored
-    int old_size = vector_size(&packet_window);
+    int old_state = cc.state; //before any adjustments the current congestion state and window are stored
+    bool old_recovery = cc.in_recovery;
+    int old_size = cwnd;
+    uint64_t now = tw_clock();
     
-    if (timeout) { //upon timeout
-        ssthresh = vector_size(&packet_window) / 2;// ssthresh is half the current window
-        if (ssthresh < 2) ssthresh = 2;  //enforcing a min ssthresh of 2
-        
-        packet_window.v_size = 1; //vector size=1 for slow start 
-        congestion_state = SLOW_START; //state is changed to slow start 
-        fractional_cwnd = 0; // reset to 0 , to be used later when state = congestion avoidance
-        
-        printf("TIMEOUT: window_size=%d, ssthresh=%d, state=SLOW_START\n", 
-               vector_size(&packet_window), ssthresh);
-    } 
-    else if (triple_dup_ack) { //in the case of 3 duplicate acks
-        int half_window = vector_size(&packet_window) / 2; //ssthresh is current window halfed
-        ssthresh = (half_window > 2) ? half_window : 2;  //enforcing min ssthresh of 2
-        
-        packet_window.v_size = 1;//window size is set to 1 
-        congestion_state = SLOW_START; //starts slow start phase
-        fractional_cwnd = 0; 
-        
-        printf("TRIPLE DUP ACK: window_size=%d, ssthresh=%d, state=SLOW_START\n", 
-               vector_size(&packet_window), ssthresh);
+    switch (event) {
+    case EV_TIMEOUT: //upon timeout
+        cc_on_timeout(&cc, now);
+        printf("TIMEOUT: window_size=%d, ssthresh=%d, state=%s\n", 
+               cc_cwnd(&cc), cc.ssthresh, cc_current_state(&cc));
+        break;
+    case EV_FAST_RETRANSMIT: //in the case of 3 duplicate acks, cwnd = ssthresh + 3
+        cc_enter_recovery(&cc, DUP_THRESH, now);
+        printf("TRIPLE DUP ACK: window_size=%d, ssthresh=%d, state=%s\n", 
+               cc_cwnd(&cc), cc.ssthresh, cc_current_state(&cc));
+        break;
+    case EV_DUP_ACK:
+        cc_on_dup_ack(&cc);
+        break;
+    case EV_PARTIAL_ACK:
+        cc_on_partial_ack(&cc, acked);
+        break;
+    case EV_FULL_ACK:
+        cc_exit_recovery(&cc);
+        printf("FULL ACK: window_size=%d, ssthresh=%d, state=%s\n", 
+               cc_cwnd(&cc), cc.ssthresh, cc_current_state(&cc));
+        break;
+    default: //normal ack case
+        cc_on_ack(&cc, acked, send_base, next_seqno, now);
+        break;
     }
-    else if (ack_received) { //normal ack case
-        if (congestion_state == SLOW_START) {
-            packet_window.v_size += 1;  // the window is incremented by one per ack received, and if all packets in window acked, the window will double for each rtt
-            
-            if (packet_window.v_size > MAX_WINDOW_SIZE) { //forcing a max window size to not overflow the buffer 
-                packet_window.v_size = MAX_WINDOW_SIZE;
-            }
-            
-            if (vector_size(&packet_window) >= ssthresh) {//checking if the window size reached the ssthresh
-                congestion_state = CONGESTION_AVOIDANCE; //enter congestion avoidance if so
-                fractional_cwnd = (float)vector_size(&packet_window); //initialzing the fractional cwnd so we can accept icrements by +=1/cwnd
-                printf("Transition: SLOW_START -> CONGESTION_AVOIDANCE at window_size=%d\n", 
-                       vector_size(&packet_window));
-            }
-        } 
-        else if (congestion_state == CONGESTION_AVOIDANCE) {//handling for congestion avoidance phase
-            if (fractional_cwnd == 0) { //if fractiona cwnd is not already initialized
-                fractional_cwnd = (float)vector_size(&packet_window); //initialize
-            }
+    cwnd = cc_cwnd(&cc); //the send loop works in whole segments
+
+    if (old_state != cc.state && cc.state == CC_CONGESTION_AVOIDANCE && !cc.in_recovery) {
+        printf("Transition: SLOW_START -> CONGESTION_AVOIDANCE at window_size=%d\n", cwnd);
+    }
+//in the case that either congestion state was changed, or window size was changed log it
+    if (old_state != cc.state || old_recovery != cc.in_recovery || old_size != cwnd) {
+        log_congestion_state(); //calling the logging 
+    }
+}
+
+
+
+
+void log_congestion_state(void) //to log the congestion state, every change is in the trace as well
+{
+    VLOG(DEBUG, "Congestion Control: %s state=%s, window_size=%d (%.2f), ssthresh=%d\n", //logging the current congestion control state, window size, and ssthresh
+           cc.ops->name, cc_current_state(&cc), cwnd, cc.cwnd, cc.ssthresh);
+}
 
-            fractional_cwnd += 1.0 / fractional_cwnd;// for each ack fractional cwn is incremented by 1/cwnd 
-   
-            int new_window_size = (int)fractional_cwnd; // consider floor value
+/*
+ * apply_sack: the SACK ranges ride in the payload of the ack, every segment they cover is flagged
+ * in its window slot so it is never retransmitted
+ */
+void apply_sack(tcp_packet *ack)
+{
+    sack_block *blocks = (sack_block *) ack->data;
+    int n = ack->hdr.data_size / sizeof(sack_block);
 
-            if (new_window_size > vector_size(&packet_window)) { //if there was an integer increment update the value of the window size
-                packet_window.v_size = new_window_size;
-                if (packet_window.v_size > MAX_WINDOW_SIZE) {
-                    packet_window.v_size = MAX_WINDOW_SIZE;
-                    fractional_cwnd = MAX_WINDOW_SIZE; 
+    if (n > MAX_SACK_BLOCKS) {
+        n = MAX_SACK_BLOCKS;
+    }
+    for (int i = 0; i < n; i++) {
+        if (blocks[i].end <= blocks[i].start) {
+            continue;
+        }
+        int last = SEG(blocks[i].end - 1);
+        for (int seg = SEG(blocks[i].start); seg <= last; seg++) {
+            WindowSlot *slot = sendwin_slot(&window, seg);
+            if (slot != NULL && !slot->sacked) {
+                slot->sacked = true;
+                sacked_segments++;
+                sacked_in_window++;
+                mark_delivered(slot, tw_clock());
+                tw_cancel(&timers, slot->timer); //it arrived, no rto for it any more
+                slot->timer = TW_NONE;
+                if (slot->lost) {
+                    slot->lost = false;
+                    lost_count--;
                 }
-                printf("CONGESTION_AVOIDANCE: Incremented window to %d (fractional: %.2f)\n", 
-                       vector_size(&packet_window), fractional_cwnd);
             }
         }
+        if (last > highest_sacked) {
+            highest_sacked = last;
+        }
     }
-//in the case that either congestion state was changed, or window size was changed log it
-    if (old_state != congestion_state || old_size != vector_size(&packet_window)) {
-        log_congestion_state(); //calling the logging 
+}
+
+/*
+ * retransmit_holes: walk the scoreboard from send_base and resend every segment that is not SACKed but has
+ * at least DUP_THRESH SACKed segments above it (RFC 6675 IsLost). A hole is resent once, if that copy is lost
+ * too it waits for an rto like any other packet. budget keeps the burst in line with the congestion window
+ */
+int retransmit_holes(int budget)
+{
+    int sent = 0;
+    int sacked_above = 0;
+    int lost_below = highest_sacked; //every hole below the DUP_THRESH-th SACKed segment from the top is lost
+
+    for (; lost_below >= SEG(send_base) && sacked_above < DUP_THRESH; lost_below--) {
+        WindowSlot *slot = sendwin_slot(&window, lost_below);
+        if (slot != NULL && slot->sacked) {
+            sacked_above++;
+        }
+    }
+    if (sacked_above < DUP_THRESH) {
+        return 0;
     }
+    for (int seg = SEG(send_base); seg <= lost_below && sent < budget; seg++) {
+        WindowSlot *slot = sendwin_slot(&window, seg);
+        if (slot == NULL || slot->pkt == NULL || slot->sacked) {
+            continue;
+        }
+        if (resent_recently(slot)) { //already resent, only again when that copy is an rto old
+            continue;
+        }
+        VLOG(DEBUG, "SACK hole retransmit seqno: %lld", (long long)slot->seqno);
+        retransmit(slot);
+        holes_retransmitted++;
+        sent++;
+    }
+    return sent;
 }
 
+void retransmit(WindowSlot *slot)
+{
+    if (slot->lost) { //an rto declared it lost, retransmit_lost must not send it a second time
+        slot->lost = false;
+        lost_count--;
+    }
+    mark_sent(slot, true); //counted as a retransmission so karns algorithm skips it
+    send_packet(slot->pkt); //resend, in mmap mode the payload is reread from the mapping
+}
 
+bool resent_recently(WindowSlot *slot)
+{
+    struct timeval now, diff;
 
+    if (slot->retransmits == 0) {
+        return false;
+    }
+    gettimeofday(&now, NULL);
+    timersub(&now, &slot->send_time, &diff);
+    return diff.tv_sec * 1000 + diff.tv_usec / 1000 < rto;
+}
 
-void log_congestion_state(void) //to log the congestion state 
+/*
+ * retransmit_head: the segment at send_base is the one the dup acks / partial ack point at. The SACK hole
+ * scan may already have resent it for the same ack pattern, then that copy is left to do its job
+ */
+void retransmit_head(const char *why)
 {
-    const char* state_str;
-    switch (congestion_state) {
-        case SLOW_START:
-            state_str = "SLOW_START";
-            break;
-        case CONGESTION_AVOIDANCE:
-            state_str = "CONGESTION_AVOIDANCE";
-            break;
-        default:
-            state_str = "UNKNOWN";
+    WindowSlot *lost = sendwin_slot(&window, SEG(send_base)); //the segment that needs to be retransmitted
+    tcp_packet* retransmit_packet = lost != NULL ? lost->pkt : NULL; //retreive pointer to the packet that needs to be retransmitted 
+
+    if (retransmit_packet == NULL) { //handling the error case in case we can find the packet we need to retransmit
+        printf("Warning: No packet found for segment %d for %s\n", SEG(send_base), why);
+        return;
+    }
+    if (lost->sacked || resent_recently(lost)) {
+        return;
+    }
+    printf("%s: retransmitting packet with seqno: %lld\n", why, (long long)retransmit_packet->hdr.seqno);
+    retransmit(lost);
+}
+
+/*
+ * handle_ack: process a single ack from the receive batch, advancing send_base,
+ * growing the window and detecting duplicate acks. DUP_THRESH dup acks start NewReno fast recovery:
+ * the window is inflated by further dup acks, a partial ack resends the next hole and stays in
+ * recovery, the ack covering everything sent before the loss (recover) deflates it back to ssthresh
+ */
+void handle_ack(tcp_packet *recvpkt)
+{
+    if (recvpkt->hdr.conn_id != conn_id) { //a late ack of an earlier transfer from the same port
+        return;
+    }
+    acks_received++;
+    TRACE(TR_ACK, recvpkt->hdr.ackno, tw_clock());
+    
+    // check if ack is for eof (FIN FLAG) so it doesn't mix up with dupe acks of the last packet
+    if (eof_packet_sent && recvpkt->hdr.ackno >= next_seqno && recvpkt->hdr.ctr_flags==FIN) {
+        printf("Received ACK for EOF packet\n"); // 
+        eof_acked = 1;//mark as acked
+        tw_cancel(&timers, eof_timer); //stop timer
+        eof_timer = TW_NONE;
+        return;
+    }
+    
+    if (recvpkt->hdr.rwnd > 0) { //the receiver can only buffer this many segments past its ackno
+        peer_rwnd = recvpkt->hdr.rwnd;
+    }
+    if (recvpkt->hdr.data_size > 0) { //SACK ranges, fill the scoreboard before the window moves
+        apply_sack(recvpkt);
+    }
+
+    if (recvpkt->hdr.tsecr != 0) { //the receiver echoed the tsval of the packet that triggered this ack, so every ack (dups and acks
+                                   //for retransmissions too) is an unambiguous rtt sample
+        update_rtt(recvpkt->hdr.ackno, (long)(ts_now() - recvpkt->hdr.tsecr));
+    }
+
+    if(recvpkt->hdr.ackno > send_base) { // if ack is new
+        int64_t last_acknowledged = send_base;
+        int newly_acked = 0;
+        
+        // free ack'd packet and update send base
+        while(send_base < recvpkt->hdr.ackno) {
+            WindowSlot *acked = sendwin_slot(&window, SEG(send_base)); //O(1) lookup of the segment at send_base
+            tcp_packet* packet_to_free = acked != NULL ? acked->pkt : NULL; //ge tthe pointer to the packet of that segment
+            if(packet_to_free != NULL) { //check if there is an existing packet at this position
+                if (send_base == last_acknowledged && recvpkt->hdr.tsecr == 0) { // without timestamp echo the oldest newly acked packet is our rtt sample
+                    if (acked->retransmits > 0) { //ignore rtt calc from retrasnmitted packets to implement karns algorthm
+                        VLOG(DEBUG, "Skipping RTT calculation for retransmitted packet (Karn's algorithm)");
+                    } else {
+                        struct timeval now, diff;
+                        gettimeofday(&now, NULL);
+                        timersub(&now, &acked->send_time, &diff); //diff = now - send_time
+                        update_rtt(send_base, diff.tv_sec * 1000000L + diff.tv_usec);
+                    }
+                }
+                
+                if (acked->sacked) { //already counted as delivered when it was SACKed
+                    sacked_in_window--;
+                } else {
+                    mark_delivered(acked, tw_clock());
+                }
+                pool_release(&packet_pool, packet_to_free); //give the slot back to the pool since its acked now
+                acked->pkt = NULL;
+                tw_cancel(&timers, acked->timer); //and its retransmission timer goes with it
+                acked->timer = TW_NONE;
+                if (acked->lost) {
+                    acked->lost = false;
+                    lost_count--;
+                }
+                newly_acked++;
+            }
+            
+            last_acknowledged = send_base; //update to the curr val of send base before incrementng 
+            
+            // increment by full packet size
+            if (send_base + seg_size <= recvpkt->hdr.ackno) {
+                send_base += seg_size; 
+            } else { // or increment by size of smaller packet size
+                send_base = recvpkt->hdr.ackno; 
+            }
+        }
+        sendwin_advance(&window, SEG(send_base)); //everything below send_base is out of the ring now, the segments still in flight keep their own timers
+        dup_acks = 0;
+
+        if (!cc.in_recovery) {
+            update_congestion_window(EV_ACK, newly_acked);
+        } else if (recvpkt->hdr.ackno >= recover) { //full ack, everything outstanding at the loss made it
+            update_congestion_window(EV_FULL_ACK, newly_acked);
+        } else { //partial ack, the next hole is lost too, resend it right away instead of waiting for 3 more dup acks
+            update_congestion_window(EV_PARTIAL_ACK, newly_acked);
+            retransmit_head("Partial ack");
+        }
+        TRACE_CWND(); //a csv row once the window was updated
+    } else if (recvpkt->hdr.ackno == send_base && send_base < next_seqno) { //dup ack, the receiver got something above send_base
+        dup_acks++;
+        VLOG(DEBUG, "Duplicate ACK received: %lld (%d in a row)", (long long)recvpkt->hdr.ackno, dup_acks); //log
+
+        if (cc.in_recovery) { //every further dup ack is a segment that left the network
+            update_congestion_window(EV_DUP_ACK, 0);
+        } else if (dup_acks == DUP_THRESH && recvpkt->hdr.ackno > recover) { //not for dup acks of data sent before the last loss event
+            VLOG(INFO, "3 Duplicate ACKs detected - Fast retransmit");  //log
+            recover = next_seqno;
+            update_congestion_window(EV_FAST_RETRANSMIT, 0);
+            TRACE_CWND();
+            retransmit_head("Fast retransmit");
+        }
+    } //anything else is an ack older than send_base that was reordered on the way, it neither counts as a dup nor resets the count
+
+    send_rate_sample();
+
+    if (recvpkt->hdr.data_size > 0) { //the ack told us about holes, resend the lost ones now instead of one per rto / dup ack cycle
+        retransmit_holes(cwnd);
+    }
+}
+
+int in_flight(void)
+{
+    int outstanding = SEG(next_seqno + seg_size - 1) - SEG(send_base); //the last segment may be short
+    return outstanding - sacked_in_window - lost_count;
+}
+
+void mark_delivered(WindowSlot *slot, uint64_t now)
+{
+    delivered++;
+    delivered_time = now;
+    if (!have_sample || slot->delivered > rate_sample.prior_delivered) { //the most recently sent segment makes the sample
+        have_sample = true;
+        rate_sample.prior_delivered = slot->delivered;
+        sample_prior_time = slot->delivered_time;
+        sample_send_elapsed = slot->sent_us - slot->first_sent_time;
+        first_sent_time = slot->sent_us;
+    }
+}
+
+/*
+ * send_rate_sample: the rate is what was delivered over the longer of the send and the ack interval, the
+ * longer one because acks can be compressed (or sends bunched) and would otherwise overestimate the rate
+ */
+void send_rate_sample(void)
+{
+    if (!have_sample) {
+        return;
+    }
+    have_sample = false;
+
+    uint64_t ack_elapsed = delivered_time - sample_prior_time;
+    uint64_t interval = ack_elapsed > sample_send_elapsed ? ack_elapsed : sample_send_elapsed;
+    if (interval == 0) {
+        return;
+    }
+    rate_sample.delivered = delivered - rate_sample.prior_delivered;
+    rate_sample.total_delivered = delivered;
+    rate_sample.interval = interval;
+    rate_sample.delivery_rate = rate_sample.delivered * 1e6 / interval;
+    rate_sample.in_flight = in_flight();
+
+    int old_state = cc.state;
+    int old_size = cwnd;
+    cc_on_rate_sample(&cc, &rate_sample, tw_clock());
+    cwnd = cc_cwnd(&cc);
+    if (old_state != cc.state || old_size != cwnd) {
+        log_congestion_state();
+        TRACE_CWND();
     }
-    printf("Congestion Control: state=%s, window_size=%d, ssthresh=%d\n", //logging the current congestion control state, window size, and ssthresh
-           state_str, vector_size(&packet_window), ssthresh);
 }
 
 int main (int argc, char **argv)
 {
     int portno, len;//declaring the port number of the server, and len
     char *hostname; //to save the server hostname
-    char buffer[DATA_SIZE]; //buffer to read from file
-    FILE *fp; //pointer to read the input files
+    char buffer[MAX_DATA_SIZE]; //buffer to read from file
+    int batch_size = DEFAULT_BATCH_SIZE; //number of datagrams per sendmmsg/recvmmsg
+    bool use_gso = false; //hand the kernel whole window bursts with UDP_SEGMENT
+    const CongestionOps *cc_ops = &cc_reno; //congestion control, -c picks another one
+    int fec_k = 0, fec_m = 1;
+    int zblock = ZBLOCK_DEFAULT;
+    struct timeval start, end;
+    int opt;
 
-    if (argc != 4) { //checks if the 4 arguements are passed in (program name, hostname, port, filename)
-        fprintf(stderr,"usage: %s <hostname> <port> <FILE>\n", argv[0]);
+    while ((opt = getopt(argc, argv, "b:gmtc:pxf:F:z:rM:v")) != -1) { //optional flags come before the positional arguments
+        switch (opt) {
+            case 'b':
+                batch_size = atoi(optarg);
+                break;
+            case 'g':
+                use_gso = true;
+                break;
+            case 'm':
+                use_mmap = true;
+                break;
+            case 't':
+                use_timestamps = true;
+                break;
+            case 'p':
+                use_pacing = true;
+                break;
+            case 'x':
+                use_pacing = true;
+                use_txtime = true;
+                break;
+            case 'f':
+                nflows = atoi(optarg);
+                if (nflows < 1 || nflows > MAX_FLOWS) {
+                    fprintf(stderr, "flows must be between 1 and %d\n", MAX_FLOWS);
+                    exit(0);
+                }
+                break;
+            case 'F':
+                if (sscanf(optarg, "%d,%d", &fec_k, &fec_m) < 1 || fec_k < 1 || fec_k > FEC_MAX_K || fec_m < 1 || fec_m > FEC_MAX_M) {
+                    fprintf(stderr, "fec needs 1 to %d data and 1 to %d parity segments per block, like -F 16,2\n", FEC_MAX_K, FEC_MAX_M);
+                    exit(0);
+                }
+                use_fec = true;
+                break;
+            case 'z':
+                zblock = atoi(optarg);
+                if (zblock < 1 || zblock > ZBLOCK_MAX / 1024) {
+                    fprintf(stderr, "compression blocks are 1 to %d KB\n", ZBLOCK_MAX / 1024);
+                    exit(0);
+                }
+                use_compress = true;
+                break;
+            case 'r':
+                resume = true;
+                break;
+            case 'v':
+                verbose = ALL;
+                break;
+            case 'M':
+                max_mtu = atoi(optarg);
+                if (max_mtu < MSS_SIZE || max_mtu > MAX_MTU) {
+                    fprintf(stderr, "-M takes %d to %d\n", MSS_SIZE, MAX_MTU);
+                    exit(0);
+                }
+                break;
+            case 'c':
+                cc_ops = cc_find(optarg);
+                if (cc_ops == NULL) {
+                    fprintf(stderr, "unknown congestion control %s, pick one of %s\n", optarg, cc_names());
+                    exit(0);
+                }
+                break;
+            default:
+                fprintf(stderr,"usage: %s [-b batch_size] [-g] [-m] [-t] [-c reno|cubic|bbr] [-p] [-x] [-f flows] [-F k[,m]] [-z block_kb] [-r] [-M max_mtu] [-v] <hostname> <port> <FILE>\n", argv[0]);
+                exit(0);
+        }
+    }
+
+    if (argc - optind != 3) { //checks if the 3 positional arguements are passed in (hostname, port, filename)
+        fprintf(stderr,"usage: %s [-b batch_size] [-g] [-m] [-t] [-c reno|cubic|bbr] [-p] [-x] [-f flows] [-F k[,m]] [-z block_kb] [-r] [-M max_mtu] [-v] <hostname> <port> <FILE>\n", argv[0]);
         exit(0);
     }
-    hostname = argv[1]; //extracting the arguements and saving them in the appropriate variable
-    portno = atoi(argv[2]);
-    fp = fopen(argv[3], "r");
-    if (fp == NULL) { //checking if file operning is successful 
-        error(argv[3]);
+    hostname = argv[optind]; //extracting the arguements and saving them in the appropriate variable
+    portno = atoi(argv[optind + 1]);
+    struct stat st;
+    if (stat(argv[optind + 2], &st) < 0) {
+        error(argv[optind + 2]);
+    }
+    file_size = st.st_size;
+    if (resume) { //the same file (name, size and mtime) always gets the same id, and so the same journal
+        const char *name = strrchr(argv[optind + 2], '/') ? strrchr(argv[optind + 2], '/') + 1 : argv[optind + 2];
+        conn_id = crc32c(0, name, strlen(name));
+        conn_id = crc32c(conn_id, &st.st_size, sizeof(st.st_size));
+        conn_id = crc32c(conn_id, &st.st_mtime, sizeof(st.st_mtime));
+    } else if (getrandom(&conn_id, sizeof(conn_id), 0) != sizeof(conn_id)) { //no entropy yet this early after boot, any value that differs between runs will do
+        conn_id = (unsigned int)getpid() ^ (unsigned int)time(NULL);
+    }
+    if (use_compress && use_mmap) {
+        printf("-m has no effect with -z, the payload is the compressed stream and not the file\n");
+        use_mmap = false;
     }
-
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0); //creating udp socket and checking for errors in socket creation
-    if (sockfd < 0) 
-        error("ERROR opening socket");
 
     bzero((char *) &serveraddr, sizeof(serveraddr)); //initially the server address struct is set to zeros
     serverlen = sizeof(serveraddr);//to store the length of the server address struct
@@ -413,20 +1218,71 @@ int main (int argc, char **argv)
     serveraddr.sin_family = AF_INET;
     serveraddr.sin_port = htons(portno);
 
+    if (max_mtu > MSS_SIZE) {
+        probe_mtu();
+    }
+    if (resume) {
+        query_progress();
+    }
+    if (nflows > 1) { //from here on this is one of the flows, they all share conn_id so the receiver puts them in one file
+        start_flows(argv[optind + 2]);
+    }
+    if (use_mmap) { //map the whole input file instead of reading it
+        if (filemap_open_read(&input_map, argv[optind + 2]) < 0) {
+            error(argv[optind + 2]);
+        }
+    } else {
+        fp = fopen(argv[optind + 2], "r");
+        if (fp == NULL) { //checking if file operning is successful 
+            error(argv[optind + 2]);
+        }
+    }
+
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0); //creating udp socket and checking for errors in socket creation
+    if (sockfd < 0) 
+        error("ERROR opening socket");
+
     assert(MSS_SIZE - TCP_HDR_SIZE > 0); //checking if there is room for data in pkts
+
+    batch_init(&send_batch, sockfd, batch_size, TCP_HDR_SIZE); //send slots only hold a header copy, payload is referenced from the window
+    batch_init(&ack_batch, sockfd, batch_size, MSS_SIZE); //receive slots hold whole datagrams
+    if (use_gso && batch_enable_gso(&send_batch, TCP_HDR_SIZE + seg_size)) { //every full packet becomes one gso segment
+        printf("UDP GSO enabled, segment size %lu bytes\n", TCP_HDR_SIZE + seg_size);
+    }
+    if (use_txtime && !batch_enable_txtime(&send_batch)) {
+        use_txtime = false;
+    }
+    if (use_compress) {
+        zw_init(&zw, zblock * 1024);
+    }
+    if (use_fec) { //one set of parity buffers per block a batch can hold, and one being filled
+        fec_encoder_init(&fec, fec_k, fec_m, batch_size / fec_k + 2, seg_size);
+        printf("FEC enabled, %d parity per %d data segments (%.1f%% overhead)\n", fec_m, fec_k, 100.0 * fec_m / fec_k);
+    }
+    if (use_pacing) {
+        int gso_segments = GSO_MAX_BYTES / (int)(TCP_HDR_SIZE + seg_size);
+        pacer_init(&pacer, seg_size, gso_segments < GSO_MAX_SEGMENTS ? gso_segments : GSO_MAX_SEGMENTS, tw_clock()); //a burst is at most what one gso send can carry
+        printf("Pacing enabled (%s)\n", use_txtime ? "SO_TXTIME" : "token bucket");
+    }
     
-    vector_init(&packet_window, MAX_WINDOW_SIZE); //initializing the packet window vector with the max cap
-    packet_window.v_size = 1;  //initial congestion control params, window size=1
-    ssthresh = INITIAL_SSTHRESH; // starting with the inital slow start thresh from declared constant INITIAL_SSTHRESH
-    congestion_state = SLOW_START; // state starts as slow start initially 
+    //one slot per window entry up front, in mmap mode the payload lives in the mapping so a header is all a slot holds
+    pool_init(&packet_pool, sizeof(tcp_header) + (use_mmap ? 0 : seg_size), SENDWIN_INITIAL_SLOTS + 1, 0);
+    sendwin_init(&window, SENDWIN_INITIAL_SLOTS); //initializing the send window ring, it doubles when cwnd outgrows it
+    cc_init(&cc, cc_ops, INITIAL_SSTHRESH, MAX_WINDOW_SIZE, seg_size); //initial congestion control params, window size=1 in slow start with the initial ssthresh
+    cwnd = cc_cwnd(&cc);
     
 
-    csv_file = fopen(CSV_FILENAME, "w"); //opening and writing to the csv file to log the congestion window changes 
-    if (csv_file == NULL) {// if file opening fails 
-        fprintf(stderr, "Warning: Could not open CSV file for logging: %s\n", CSV_FILENAME); //warn
+#ifdef RDT_TRACE
+    char trace_name[32] = TRACE_FILENAME;
+    if (flow > 0) {
+        snprintf(trace_name, sizeof(trace_name), "CWND.%d.trace", flow);
+    }
+    if (trace_open(&trace, trace_name, tw_clock()) < 0) { //if file opening fails the events are dropped
+        fprintf(stderr, "Warning: Could not open trace file for logging: %s\n", trace_name); //warn
     } else {
-        log_to_csv(); //otherwise log the initial state
+        TRACE_CWND(); //otherwise log the initial state
     }
+#endif
     
     log_congestion_state(); //log the initial congestion control state
 //initially sinxe smooth rtt and rttvar are not calculated yet
@@ -436,11 +1292,32 @@ int main (int argc, char **argv)
     consecutive_timeouts = 0; //resetting the counter that checks for consecutive timouts to check for new timeouts
     
 
-    init_timer(rto, resend_packets); //initializing the timer with params :the rto value, and the call back function for expired timer
+    //event loop: acks on the socket and rto deadlines on the timerfd, both handled here and never from a signal handler.
+    //the input file is a regular file, epoll can not wait on those, reads (or the mapping) are done when the window opens
+    tw_init(&timers, tw_clock());
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerfd < 0) {
+        error("timerfd_create");
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        error("epoll_create1");
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = sockfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0) {
+        error("epoll_ctl");
+    }
+    ev.data.fd = timerfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &ev) < 0) {
+        error("epoll_ctl");
+    }
     next_seqno = 0;
     send_base = 0;
     
     printf("Starting with initial RTO: %d ms\n", rto);
+    gettimeofday(&start, NULL);
     
     while (1) { 
 
@@ -450,214 +1327,231 @@ int main (int argc, char **argv)
         }
         
   
-        int current_window_size = vector_size(&packet_window); 
+        int current_window_size = cwnd < peer_rwnd ? cwnd : peer_rwnd; //never more in flight than the receiver can reorder
+        bool paced = false; //the bucket ran dry with window left
+        if (use_pacing) {
+            pacer_set_rate(&pacer, cc_pacing_rate(&cc), tw_clock());
+        }
         
+        if (lost_count > 0 && current_window_size > in_flight()) { //segments an rto declared lost go before any new data,
+            retransmit_lost(current_window_size - in_flight());       //as many as the acks made room for
+        }
+
         // send if window isn't full or isn't at eof
-        while (next_seqno < send_base + current_window_size * DATA_SIZE && !eof_reached) {
-            len = fread(buffer, 1, DATA_SIZE, fp); // read next packet
+        while (next_seqno < send_base + current_window_size * seg_size && !eof_reached) {
+            if (use_pacing && !use_txtime && !pacer_can_send(&pacer, seg_size, tw_clock())) {
+                paced = true;
+                break;
+            }
+            int64_t offset;
+            len = next_segment(buffer, &offset); // read next packet, in mmap mode it is just the next bytes of the mapping
             
             if (len <= 0) { // if eof reached
                 VLOG(INFO, "End Of File has been reached");
                 
-                eof_packet = make_packet(0);
+                eof_packet = pool_acquire(&packet_pool, 0);
+                eof_packet->hdr.seqno = next_seqno; //so a receiver that already closed the transfer can still answer with a FIN
+                eof_packet->hdr.conn_id = conn_id;
+                eof_packet->hdr.offset = next_seqno;
+                eof_packet->hdr.flows = nflows;
+                eof_packet->hdr.seg_size = seg_size;
                 eof_reached = 1;
-                fclose(fp);
+                if (use_fec && fec.count > 0) { //the last block is short, its parity says how many segments it has
+                    send_parity();
+                }
+                if (fp != NULL) {
+                    fclose(fp);
+                }
                 
                 // don't send eof packet for now, ack everything else first
                 break;
             }
             
             // create new packets
-            sndpkt = make_packet(len);
-            memcpy(sndpkt->data, buffer, len); // copy data 
-            sndpkt->hdr.seqno = next_seqno;
-            
-            // store in the window
-            int window_index = (next_seqno / DATA_SIZE) % vector_capacity(&packet_window);
-            tcp_packet* existing = vector_at(&packet_window, window_index);
-            if (existing != NULL) {
-                free(existing);
-                packet_window.data[window_index] = NULL;
-            }
-            
-            packet_window.data[window_index] = sndpkt; //store new packet in the window
-            
-
-            if (window_index >= vector_size(&packet_window)) {
-                // placeholder- the actual size is determined by congestion control, so we don't update here
+            if (use_mmap) {
+                sndpkt = pool_acquire(&packet_pool, 0); // header only, the window keeps just the offset and length
+                sndpkt->hdr.data_size = len;
+            } else {
+                sndpkt = pool_acquire(&packet_pool, len);
+                memcpy(sndpkt->data, buffer, len); // copy data 
             }
+            sndpkt->hdr.ctr_flags = use_compress ? ZDATA : DATA;
+            sndpkt->hdr.seqno = next_seqno;
+            sndpkt->hdr.conn_id = conn_id;
+            sndpkt->hdr.offset = offset;
+            sndpkt->hdr.flows = nflows;
+            sndpkt->hdr.seg_size = seg_size;
+            sndpkt->hdr.tsecr = use_fec ? FEC_GEOMETRY(fec.k, fec.m) : 0;
             
-            VLOG(DEBUG, "Sending packet %d to %s (Window size: %d, RTO: %d ms, State: %s)", 
-                next_seqno, inet_ntoa(serveraddr.sin_addr), current_window_size, rto,
-                congestion_state == SLOW_START ? "SLOW_START" : "CONGESTION_AVOIDANCE");
+            // store in the window, the ring grows by itself if cwnd is bigger than it
+            WindowSlot *slot = sendwin_push(&window, SEG(next_seqno));
+            slot->pkt = sndpkt; //store new packet in the window
+            slot->seqno = next_seqno;
+            slot->len = len;
             
+            VLOG(DEBUG, "Sending packet %lld to %s (Window size: %d, RTO: %d ms, State: %s)", 
+                (long long)next_seqno, inet_ntoa(serveraddr.sin_addr), current_window_size, rto,
+                cc_current_state(&cc));
 
-            record_packet_sent(next_seqno, false); //record the time that the pkt was sent to use later for rtt calculation, and also marking false as it its not a restransmission
-            
-            // send packet 
-            if(sendto(sockfd, sndpkt, TCP_HDR_SIZE + len, 0, 
-                    (const struct sockaddr *)&serveraddr, serverlen) < 0) {
-                error("sendto");
+            mark_sent(slot, false); //record the time that the pkt was sent to use later for rtt calculation, not a restransmission
+            if (use_txtime) { //the whole window goes to the kernel now, every burst of it with the time it may leave at
+                uint64_t at = pacer_schedule(&pacer, len, tw_clock());
+                if (txtime_burst_fill == 0) {
+                    batch_set_txtime(&send_batch, at * 1000);
+                }
+                txtime_burst_fill = (txtime_burst_fill + 1) % pacer_burst_segments(&pacer);
+            } else if (use_pacing) {
+                pacer_consume(&pacer, len); //the pacing rate counts payload bytes, like cwnd
             }
             
-            // start timer for first packet 
-            if(next_seqno == send_base) {
-                init_timer(rto, resend_packets);  //current rto value
-                start_timer();
+            // queue packet, the whole burst goes out in one sendmmsg below
+            wire_header wire;
+            packet_encode(&sndpkt->hdr, packet_payload(sndpkt), &wire); //batch_add copies the header, the payload is only referenced
+            batch_add(&send_batch, &wire, TCP_HDR_SIZE, packet_payload(sndpkt), len, &serveraddr);
+            if (use_fec && fec_encode(&fec, &sndpkt->hdr, packet_payload(sndpkt))) {
+                send_parity();
             }
             
             // move next sequence number by data size
             next_seqno += len;
             packet_count++; 
         }
+        batch_flush(&send_batch); //flush the window burst
+        if (use_pacing) { //wake up when the next burst may go, acks that arrive before just cut the wait short
+            tw_cancel(&timers, pace_timer);
+            pace_timer = TW_NONE;
+            if (paced) {
+                int room = send_base + current_window_size * seg_size - next_seqno;
+                int want = pacer_burst_segments(&pacer) * seg_size; //a whole burst, or what the window still takes
+                pace_timer = tw_schedule(&timers, pacer_next_send(&pacer, room < want ? room : want), PACE_TIMER);
+            }
+        }
+        if (use_mmap && stripe == NULL && skipped == 0) { //striped (or resumed) flows jump around the file, the kernel's own readahead has to do
+            filemap_advance(&input_map, send_base, next_seqno); //readahead in front, release what is acked
+        }
         
         // if all data has been acked and eof packet hasn't been sent but has been reached
         if (eof_reached && !eof_packet_sent && send_base >= next_seqno) {
             printf("All data acknowledged, sending EOF packet\n");
-            if(sendto(sockfd, eof_packet, TCP_HDR_SIZE, 0,  // send eof packet and mark it as sent
-                    (const struct sockaddr *)&serveraddr, serverlen) < 0) {
-                error("sendto");
-            }
+            send_eof(); // send eof packet and mark it as sent
             eof_packet_sent = 1;
-            init_timer(rto, resend_packets);  // Use current RTO value
-            start_timer(); // eof packet timer
-        }
-        
-        
-        // receive acks from server
-        if(recvfrom(sockfd, buffer, MSS_SIZE, 0,
-                    (struct sockaddr *) &serveraddr, (socklen_t *)&serverlen) < 0) {//if ack receiving is failed, skip to next iteration 
-            continue;
+            eof_timer = tw_schedule(&timers, tw_clock() + rto * 1000ULL, EOF_TIMER); // eof packet timer
         }
         
-        recvpkt = (tcp_packet *)buffer;
-        printf("ACK RECEIVED: %d (send_base: %d)\n", 
-               recvpkt->hdr.ackno, 
-               send_base);
-        
-        // check if ack is for eof (FIN FLAG) so it doesn't mix up with dupe acks of the last packet
-        if (eof_packet_sent && recvpkt->hdr.ackno >= next_seqno && recvpkt->hdr.ctr_flags==FIN) {
-            printf("Received ACK for EOF packet\n"); // 
-            eof_acked = 1;//mark as acked
-            stop_timer(); //stop timer
-            continue; // to next iteration
+        // wait for acks or the next deadline, whichever comes first
+        arm_timerfd();
+        struct epoll_event events[2];
+        int nev = epoll_wait(epfd, events, 2, -1);
+        if (nev < 0) {
+            if (errno == EINTR) { //a debugger or ^Z, nothing of ours
+                continue;
+            }
+            error("epoll_wait");
         }
-        
-        if(recvpkt->hdr.ackno > send_base) { // if ack is new
-            previous_acks[0] = previous_acks[1] = previous_acks[2] = -1; // reset dupe ack array
-            acknum = 0;
-            last_ack_received = recvpkt->hdr.ackno; // update last ack tracker
-
-            log_to_csv(); //log to csv immediately 
-            
-
-            int last_acknowledged = send_base;
-            
-            // free ack'd packet and update send base
-            while(send_base < recvpkt->hdr.ackno) {
-                int window_index = (send_base / DATA_SIZE) % vector_capacity(&packet_window); //calculating the index position in the pkt window where the packet is stored
-                tcp_packet* packet_to_free = vector_at(&packet_window, window_index); //ge tthe pointer to the packet at the calculated window index
-                if(packet_to_free != NULL) { //check if there is an existing packet at this position
-                    if (send_base == last_acknowledged) { // check if the current packet is the last acked packet that was recorded before processign current ack, to consider for rtt calculaiton
-                        struct timeval* send_time = get_packet_send_time(send_base); //timestamo for when the packet was sent
-                        bool retransmitted = was_packet_retransmitted(send_base); //checking if packet was retransmitted
-                        
-                        if (send_time != NULL) {  //update rtt calcuation but check if send time isnt null first
-                            update_rtt(send_base, send_time, retransmitted);
-                        }
-                    }
-                    
-                    free(packet_to_free); //free the memory allocated for the pkt since its acked now
-                    packet_window.data[window_index] = NULL;
-                    
-                
-                    update_congestion_window(true, false, false); //update congestion window (new ack->true, not a timeout->false, and not a triple duplicate ACK->false)
+        for (int e = 0; e < nev; e++) {
+            if (events[e].data.fd == timerfd) {
+                uint64_t expirations;
+                if (read(timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                    error("read timerfd");
                 }
-                
-                last_acknowledged = send_base; //update to the curr val of send base before incrementng 
-                
-                // increment by full packet size
-                if (send_base + DATA_SIZE <= recvpkt->hdr.ackno) {
-                    send_base += DATA_SIZE; 
-                } else { // or increment by size of smaller packet size
-                    send_base = recvpkt->hdr.ackno; 
-                }
-            }
-            
-            // time packet on new sendbase
-            if(send_base < next_seqno) {
-                stop_timer();
-                init_timer(rto, resend_packets);  // use current rto value
-                start_timer();
+                timerfd_armed = 0; //it fired, so it has to be set again even for the same tick
             } else {
-                stop_timer();
-            }
-        } else if (recvpkt->hdr.ackno == send_base && recvpkt->hdr.ackno != last_ack_received) {//in the case that the received ack number is equal to the oldest unacked packet, and this ack number is not the same as the last ack, then
-            last_ack_received = recvpkt->hdr.ackno;//track the ack
-        
-            log_to_csv(); //log the current state to the csv file
-            
-        } else { //in all other cases, which is the dupe ack case
-            VLOG(INFO, "Duplicate ACK received: %d", recvpkt->hdr.ackno); //log
-            previous_acks[acknum % 3] = recvpkt->hdr.ackno; // store the ack number in a looped buffer of size 3 using modulo
-            acknum++; //increment the ack trackign varaible
-            
-            if (acknum >= 3 && previous_acks[0] == previous_acks[1] && previous_acks[1] == previous_acks[2] && previous_acks[0] != -1) { //check for the case of three dupe acks
-                
-                VLOG(INFO, "3 Duplicate ACKs detected - Fast retransmit");  //log
-    
-                update_congestion_window(false, false, true); //(not new ack, not a timeout, is a tripple dupe ack)
-               
-                log_to_csv();//log to the csv
-                
-                // fast retransmit the packet
-                int window_index = (send_base / DATA_SIZE) % vector_capacity(&packet_window); //calculates the window index for the packet that needs to be retransmitted
-                tcp_packet* retransmit_packet = vector_at(&packet_window, window_index); //retreive pointer to the packet that needs to be retransmitted 
-                
-                if (retransmit_packet != NULL) { // send oldest packet again
-                    printf("Fast retransmitting packet with seqno: %d\n", retransmit_packet->hdr.seqno);
-                
-                    record_packet_sent(retransmit_packet->hdr.seqno, true); //record that this packet is a retransmission to skip for karns alogirthm 
-                    
-                    if(sendto(sockfd, retransmit_packet, TCP_HDR_SIZE + get_data_size(retransmit_packet), 0,  //pointer to the packet that needs to be retransmitted
-                            (const struct sockaddr *)&serveraddr, serverlen) < 0) {
-                        error("sendto");
+                // receive acks from server, every ack that is already waiting is taken in the same call
+                int nacks = batch_recv(&ack_batch);
+                for (int i = 0; i < nacks && !eof_acked; i++) {
+                    struct {
+                        tcp_header hdr;
+                        sack_block sack[MAX_SACK_BLOCKS];
+                    } ack; //the unpacked header with the SACK ranges right behind it, as handle_ack expects a packet
+                    _Static_assert(offsetof(__typeof__(ack), sack) == offsetof(tcp_packet, data), "SACK ranges are the packet's data");
+                    int err = packet_decode(batch_data(&ack_batch, i), batch_len(&ack_batch, i), NULL, &ack.hdr);
+                    if (err != WIRE_OK || ack.hdr.data_size > (int)sizeof(ack.sack)) {
+                        bad_acks[err != WIRE_OK ? err : WIRE_LENGTH]++; //dropped, a later ack covers whatever this one said
+                        continue;
                     }
-                    
-                    // reset dupe ack tracking buffer and counter 
-                    previous_acks[0] = previous_acks[1] = previous_acks[2] = -1;
-                    acknum = 0;
-                } else { //handling the error case in case we can find the packet we need to retransmit
-                    printf("Warning: No packet found at index %d for fast retransmit\n", window_index);
+                    memcpy(ack.sack, batch_data(&ack_batch, i) + TCP_HDR_SIZE, ack.hdr.data_size);
+                    sack_to_host(ack.sack, ack.hdr.data_size / sizeof(sack_block));
+                    handle_ack((tcp_packet *)&ack);
                 }
             }
         }
+        tw_advance(&timers, tw_clock(), on_timer, NULL); //acks went first, so a timer only fires if its ack really is late
+        handle_timeouts();
         
         // displaying the status of the window 
-        printf("Current status - Window: %d packets, ssthresh: %d, state: %s, Next Seq: %d, Base: %d, RTO: %d ms\n", 
-              vector_size(&packet_window), ssthresh, 
-              congestion_state == SLOW_START ? "SLOW_START" : "CONGESTION_AVOIDANCE",
-              next_seqno, send_base, rto);
+        VLOG(DEBUG, "Current status - Window: %d packets, ssthresh: %d, state: %s, Next Seq: %lld, Base: %lld, RTO: %d ms\n", 
+              cwnd, cc.ssthresh, 
+              cc_current_state(&cc),
+              (long long)next_seqno, (long long)send_base, rto);
     }
     
 
-    for (int i = 0; i < vector_capacity(&packet_window); i++) { //clean up, free pkts that are still in the window when we exit the loop
-        tcp_packet* packet = vector_at(&packet_window, i);
-        if (packet != NULL) {
-            free(packet);
+    for (int seg = window.base_seg; seg < window.next_seg; seg++) { //clean up, free pkts that are still in the window when we exit the loop
+        WindowSlot *left = sendwin_slot(&window, seg);
+        if (left->pkt != NULL) {
+            pool_release(&packet_pool, left->pkt);
         }
     }
     
     if (eof_packet != NULL) { //freeing the eof packet if it exists 
-        free(eof_packet);
+        pool_release(&packet_pool, eof_packet);
     }
     
-    vector_free(&packet_window); //freeing the memory alocated for the packet window struct defiend in the beginning 
+    if (use_mmap) {
+        filemap_close(&input_map);
+    }
+
+    if (use_pacing) {
+        pacer_print_stats(&pacer);
+    }
+    tw_print_stats("rto timers", &timers);
+    tw_free(&timers);
+    close(timerfd);
+    close(epfd);
+    sendwin_free(&window); //freeing the memory alocated for the send window ring defiend in the beginning 
+
+    if (stripe != NULL) {
+        printf("flow %d: %lld bytes in %d packets\n", flow, (long long)next_seqno, packet_count);
+    }
+    gettimeofday(&end, NULL);
+    if (resume) {
+        printf("resume: %llu bytes the receiver already had were not sent\n", skipped);
+    }
+    if (use_compress) {
+        zw_print_stats(&zw, (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+        zw_free(&zw);
+    }
+    if (use_fec) {
+        fec_encoder_print_stats(&fec);
+        fec_encoder_free(&fec);
+    }
+    printf("SACK: %lu segments reported, %lu holes retransmitted\n", sacked_segments, holes_retransmitted);
+    struct rusage usage; //the cpu the ack path costs us, compare runs with different receiver ack policies
+    getrusage(RUSAGE_SELF, &usage);
+    printf("acks: %lu received for %lu data packets sent (%.3f per packet), cpu %ld.%06ld s user %ld.%06ld s sys\n",
+           acks_received, packet_count + retransmissions,
+           packet_count + retransmissions ? (double)acks_received / (packet_count + retransmissions) : 0.0,
+           (long)usage.ru_utime.tv_sec, (long)usage.ru_utime.tv_usec, (long)usage.ru_stime.tv_sec, (long)usage.ru_stime.tv_usec);
+    printf("corrupt acks dropped:");
+    for (int i = WIRE_SHORT; i < WIRE_ERRORS; i++) {
+        printf(" %s %lu%s", wire_error_names[i], bad_acks[i], i + 1 < WIRE_ERRORS ? "," : "\n");
+    }
+    printf("checksums: crc32c (%s)\n", crc32c_impl());
+    pool_print_stats("packet pool", &packet_pool); //high water mark tells us how many slots the window really needed
+    pool_destroy(&packet_pool);
+
+    batch_print_stats("send batch", &send_batch); //how full our sendmmsg/recvmmsg calls were on average
+    batch_print_stats("ack batch", &ack_batch);
+    batch_free(&send_batch);
+    batch_free(&ack_batch);
     
-    if (csv_file != NULL) { //clsoing the csv and indication where it was saved
-        fclose(csv_file);
-        printf("CSV log file saved to: %s\n", CSV_FILENAME);
+#ifdef RDT_TRACE
+    if (trace.file != NULL) { //closing the trace and indication where it was saved
+        trace_close(&trace);
+        trace_print_stats(&trace, trace_name);
+        printf("trace_decode %s %.*s.csv writes the cwnd log for plot.py\n", trace_name, (int)strlen(trace_name) - 6, trace_name);
     }
+#endif
     
     return 0;
 }
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "reorder.h"
+#include "common.h"
+
+#define BIT_WORD(i) ((i) >> 6)
+#define BIT_MASK(i) (1ULL << ((i) & 63))
+
+/*
+ * reorder_init: out of order segments are kept in a ring indexed by segment number, so storing one,
+ * spotting a duplicate and finding the next in order one are all O(1) instead of scanning the buffer
+ */
+void reorder_init(ReorderBuf *r, int capacity)
+{
+    int cap = 64;
+    while (cap < capacity) //power of two and at least one bitmap word
+        cap <<= 1;
+    r->capacity = cap;
+    r->mask = cap - 1;
+    r->pkts = calloc(cap, sizeof(tcp_packet *));
+    r->lens = calloc(cap, sizeof(int));
+    r->bitmap = calloc(cap / 64, sizeof(uint64_t));
+    if (r->pkts == NULL || r->lens == NULL || r->bitmap == NULL)
+        error("reorder_init");
+    r->base_seg = 0;
+    r->high_seg = 0;
+    r->count = 0;
+    r->max_count = 0;
+    r->dups = 0;
+    r->drops = 0;
+}
+
+void reorder_free(ReorderBuf *r)
+{
+    free(r->pkts);
+    free(r->lens);
+    free(r->bitmap);
+    r->pkts = NULL;
+    r->lens = NULL;
+    r->bitmap = NULL;
+}
+
+static int held(const ReorderBuf *r, int seg)
+{
+    int i = seg & r->mask;
+    return (r->bitmap[BIT_WORD(i)] & BIT_MASK(i)) != 0;
+}
+
+int reorder_check(ReorderBuf *r, int seg)
+{
+    if (seg < r->base_seg) { //already delivered
+        r->dups++;
+        return REORDER_DUP;
+    }
+    if (seg >= r->base_seg + r->capacity) { //would wrap onto the head of the ring
+        r->drops++;
+        return REORDER_DROP;
+    }
+    if (held(r, seg)) {
+        r->dups++;
+        return REORDER_DUP;
+    }
+    return REORDER_OK;
+}
+
+void reorder_insert(ReorderBuf *r, int seg, tcp_packet *pkt, int len)
+{
+    int i = seg & r->mask;
+    r->pkts[i] = pkt;
+    r->lens[i] = len;
+    r->bitmap[BIT_WORD(i)] |= BIT_MASK(i);
+    r->count++;
+    if (seg >= r->high_seg)
+        r->high_seg = seg + 1;
+    if (r->count > r->max_count)
+        r->max_count = r->count;
+}
+
+/*
+ * find_bit: first segment in [from, to) whose bit is want (1 held, 0 hole), or to if there is none. Works a
+ * word at a time, count trailing zeros on the (inverted for holes) word gives the first match in it
+ */
+static int find_bit(const ReorderBuf *r, int from, int to, int want)
+{
+    int seg = from;
+
+    while (seg < to) {
+        int i = seg & r->mask;
+        int bit = i & 63;
+        uint64_t word = r->bitmap[BIT_WORD(i)];
+        if (!want)
+            word = ~word;
+        word >>= bit; //bits from seg to the end of this word, the shifted in zeros never match
+        if (word != 0) {
+            int found = seg + __builtin_ctzll(word);
+            return found < to ? found : to;
+        }
+        seg += 64 - bit;
+    }
+    return to;
+}
+
+//reorder_run: the first hole at or after the head ends the in order run
+int reorder_run(const ReorderBuf *r)
+{
+    return find_bit(r, r->base_seg, r->base_seg + r->capacity, 0) - r->base_seg;
+}
+
+int reorder_pop(ReorderBuf *r, tcp_packet **pkt, int *len)
+{
+    int i = r->base_seg & r->mask;
+    if (!(r->bitmap[BIT_WORD(i)] & BIT_MASK(i)))
+        return 0;
+    *pkt = r->pkts[i];
+    *len = r->lens[i];
+    r->pkts[i] = NULL;
+    r->bitmap[BIT_WORD(i)] &= ~BIT_MASK(i);
+    r->count--;
+    r->base_seg++;
+    return 1;
+}
+
+void reorder_skip(ReorderBuf *r)
+{
+    r->base_seg++;
+}
+
+int reorder_next_range(const ReorderBuf *r, int from, int *start, int *end)
+{
+    if (from < r->base_seg)
+        from = r->base_seg;
+    *start = find_bit(r, from, r->high_seg, 1);
+    if (*start >= r->high_seg)
+        return 0;
+    *end = find_bit(r, *start, r->high_seg, 0);
+    return 1;
+}
+
+int reorder_range_of(const ReorderBuf *r, int seg, int *start, int *end)
+{
+    if (seg < r->base_seg || seg >= r->high_seg || !held(r, seg))
+        return 0;
+    *start = seg;
+    while (*start > r->base_seg && held(r, *start - 1)) //runs past a loss are short, walking back is cheap
+        (*start)--;
+    *end = find_bit(r, seg, r->high_seg, 0);
+    return 1;
+}
+
+//popcount over the bitmap, used to cross check count
+int reorder_count(const ReorderBuf *r)
+{
+    int n = 0;
+    for (int w = 0; w < r->capacity / 64; w++)
+        n += __builtin_popcountll(r->bitmap[w]);
+    return n;
+}
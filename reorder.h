@@ -0,0 +1,40 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <stdint.h>
+#include "packet.h"
+
+#define DEFAULT_RECV_WINDOW 4096 //segments the receiver can hold past expectedseq, advertised to the sender as rwnd
+
+enum reorder_result {
+    REORDER_OK,    //segment can be (or was) stored
+    REORDER_DUP,   //we already hold this segment
+    REORDER_DROP,  //segment is past the end of the buffer
+};
+
+typedef struct {
+    tcp_packet **pkts;    //buffered packet per slot, NULL in scatter mode (the payload is already in the file)
+    int *lens;            //payload bytes per slot
+    uint64_t *bitmap;     //one bit per slot, set while the slot holds a segment
+    int capacity;         //slots, always a power of two
+    int mask;
+    int base_seg;         //segment number of expectedseq, slot of base_seg is the head of the ring
+    int high_seg;         //one past the highest segment ever stored, nothing is held at or above it
+    int count;            //segments held right now
+    int max_count;        //most segments ever held at once
+    unsigned long dups;   //duplicates that were not stored twice
+    unsigned long drops;  //segments dropped because they were beyond the buffer
+} ReorderBuf;
+
+void reorder_init(ReorderBuf *r, int capacity);
+void reorder_free(ReorderBuf *r);
+int reorder_check(ReorderBuf *r, int seg);                    //REORDER_OK / REORDER_DUP / REORDER_DROP, counts dups and drops
+void reorder_insert(ReorderBuf *r, int seg, tcp_packet *pkt, int len); //only after reorder_check said REORDER_OK
+int reorder_run(const ReorderBuf *r);                          //number of consecutive segments held starting at base_seg
+int reorder_pop(ReorderBuf *r, tcp_packet **pkt, int *len);    //take the base segment and move the base up, 0 if it is missing
+void reorder_skip(ReorderBuf *r);                              //base segment arrived in order and was consumed directly
+int reorder_count(const ReorderBuf *r);                        //segments held, counted from the bitmap
+int reorder_next_range(const ReorderBuf *r, int from, int *start, int *end); //first run of held segments at or after from, [start, end)
+int reorder_range_of(const ReorderBuf *r, int seg, int *start, int *end);    //the run of held segments seg is part of, 0 if seg is not held
+
+#endif /* REORDER_H */
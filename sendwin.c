@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sendwin.h"
+#include "common.h"
+
+/*
+ * sendwin_init: the send window is a ring indexed by segment number (seqno / segment size), so finding the
+ * segment at send_base or any acked segment is a mask instead of a search, and cwnd is kept separately
+ */
+void sendwin_init(SendWindow *w, int capacity)
+{
+    int cap = 1;
+    while (cap < capacity) //round up to a power of two so the index is just seg & mask
+        cap <<= 1;
+    w->slots = calloc(cap, sizeof(WindowSlot));
+    if (w->slots == NULL)
+        error("sendwin_init");
+    w->capacity = cap;
+    w->mask = cap - 1;
+    w->base_seg = 0;
+    w->next_seg = 0;
+}
+
+void sendwin_free(SendWindow *w)
+{
+    free(w->slots);
+    w->slots = NULL;
+    w->capacity = 0;
+}
+
+/*
+ * grow: double the ring, every held segment moves to its slot under the new mask
+ */
+static void grow(SendWindow *w)
+{
+    int cap = w->capacity * 2;
+    WindowSlot *slots = calloc(cap, sizeof(WindowSlot));
+    if (slots == NULL)
+        error("sendwin grow");
+    for (int seg = w->base_seg; seg < w->next_seg; seg++)
+        slots[seg & (cap - 1)] = w->slots[seg & w->mask];
+    free(w->slots);
+    w->slots = slots;
+    w->capacity = cap;
+    w->mask = cap - 1;
+}
+
+WindowSlot* sendwin_push(SendWindow *w, int seg)
+{
+    if (seg != w->next_seg) {
+        fprintf(stderr, "sendwin_push: segment %d pushed, expected %d\n", seg, w->next_seg);
+        exit(1);
+    }
+    if (w->next_seg - w->base_seg == w->capacity)
+        grow(w);
+
+    WindowSlot *slot = &w->slots[seg & w->mask];
+    memset(slot, 0, sizeof(*slot));
+    w->next_seg++;
+    return slot;
+}
+
+WindowSlot* sendwin_slot(SendWindow *w, int seg)
+{
+    if (seg < w->base_seg || seg >= w->next_seg)
+        return NULL;
+    return &w->slots[seg & w->mask];
+}
+
+void sendwin_advance(SendWindow *w, int seg)
+{
+    if (seg > w->next_seg)
+        seg = w->next_seg;
+    for (; w->base_seg < seg; w->base_seg++) //clear so stale packet pointers can never be found again
+        w->slots[w->base_seg & w->mask].pkt = NULL;
+}
+
+int sendwin_count(const SendWindow *w)
+{
+    return w->next_seg - w->base_seg;
+}
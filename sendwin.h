@@ -0,0 +1,41 @@
+#ifndef SENDWIN_H
+#define SENDWIN_H
+
+#include <stdbool.h>
+#include <sys/time.h>
+#include "packet.h"
+#include "timerwheel.h"
+
+#define SENDWIN_INITIAL_SLOTS 128 //starting ring size, doubles whenever more segments are in flight
+
+typedef struct {
+    tcp_packet *pkt;            //the packet (header only in mmap mode), NULL for a free slot
+    int64_t seqno;              //byte offset of the segment
+    int len;                    //payload bytes
+    struct timeval send_time;   //last time the segment went out
+    int retransmits;            //how many times it was sent again after the first time
+    bool sacked;                //the receiver told us it already has this segment
+    bool lost;                  //an rto declared it lost, it is resent as soon as the congestion window allows
+    int timer;                  //retransmission timer in the timer wheel, TW_NONE when not armed
+    uint64_t sent_us;           //delivery rate sampling: when it last went out (tw_clock)
+    long delivered;             //  total delivered at that moment
+    uint64_t delivered_time;    //  when that total was reached
+    uint64_t first_sent_time;   //  send time of the segment that started the current sampling interval
+} WindowSlot;
+
+typedef struct {
+    WindowSlot *slots;          //ring storage, capacity is always a power of two
+    int capacity;
+    int mask;                   //capacity - 1, segment number & mask gives the slot
+    int base_seg;               //oldest segment still held (the one at send_base)
+    int next_seg;               //one past the newest segment held
+} SendWindow;
+
+void sendwin_init(SendWindow *w, int capacity);
+void sendwin_free(SendWindow *w);
+WindowSlot* sendwin_push(SendWindow *w, int seg); //claim the slot for a new segment, seg must be next_seg
+WindowSlot* sendwin_slot(SendWindow *w, int seg); //O(1) lookup, NULL when seg is not held
+void sendwin_advance(SendWindow *w, int seg);     //forget every segment below seg, the caller already released their packets
+int sendwin_count(const SendWindow *w);           //number of segments held (sent but not yet cumulatively acked)
+
+#endif /* SENDWIN_H */
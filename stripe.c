@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "stripe.h"
+
+/*
+ * Every flow starts with an equal share of the file in whole segments, and claims it in chunks of
+ * STRIPE_CHUNK_SEGMENTS so that what it has not claimed yet can still be taken away. A flow that runs out
+ * steals the back half of the largest unclaimed rest of another flow, so a slow flow holds up the transfer
+ * by at most the chunk it is working on. Only the file's last segment may be short, and SEG() in the sender
+ * needs every segment but a flow's last to be whole, so flow 0 sends that one when it has nothing else left
+ */
+
+Stripe* stripe_create(int64_t file_size, int seg_size, int nflows)
+{
+    Stripe *s = mmap(NULL, sizeof(Stripe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (s == MAP_FAILED)
+        return NULL;
+    memset(s, 0, sizeof(*s));
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&s->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    s->nflows = nflows;
+    s->seg_size = seg_size;
+    s->chunk = STRIPE_CHUNK_SEGMENTS * seg_size;
+    s->tail = file_size % seg_size;
+    s->size = file_size - s->tail;
+
+    int64_t segs = s->size / seg_size;
+    for (int i = 0; i < nflows; i++) { //equal shares, the first segs % nflows flows get one segment more
+        int64_t first = segs / nflows * i + (i < segs % nflows ? i : segs % nflows);
+        int64_t count = segs / nflows + (i < segs % nflows);
+        s->ranges[i].next = first * seg_size;
+        s->ranges[i].end = (first + count) * seg_size;
+    }
+    return s;
+}
+
+/*
+ * steal: move the back half of the largest rest of another flow to flow. Not worth it below two chunks,
+ * the owner is about to finish those anyway
+ */
+static int steal(Stripe *s, int flow)
+{
+    int victim = -1;
+    int64_t most = 0;
+
+    for (int i = 0; i < s->nflows; i++) {
+        int64_t left = s->ranges[i].end - s->ranges[i].next;
+        if (i != flow && left > most) {
+            most = left;
+            victim = i;
+        }
+    }
+    if (victim < 0 || most < 2 * s->chunk)
+        return 0;
+
+    StripeRange *v = &s->ranges[victim];
+    int64_t mid = v->next + (most / s->seg_size / 2) * s->seg_size; //on a segment boundary
+    s->ranges[flow].next = mid;
+    s->ranges[flow].end = v->end;
+    v->end = mid;
+    s->steals++;
+    s->stolen_bytes += s->ranges[flow].end - mid;
+    return 1;
+}
+
+int stripe_claim(Stripe *s, int flow, int64_t *offset)
+{
+    StripeRange *r = &s->ranges[flow];
+    int len = 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (flow == 0 && s->tail_taken) { //the short segment was flow 0's last
+        pthread_mutex_unlock(&s->lock);
+        return 0;
+    }
+    if (r->next == r->end)
+        steal(s, flow);
+    if (r->next < r->end) {
+        len = r->end - r->next < s->chunk ? r->end - r->next : s->chunk;
+        *offset = r->next;
+        r->next += len;
+    } else if (flow == 0 && s->tail > 0 && !s->tail_taken) {
+        len = s->tail;
+        *offset = s->size;
+        s->tail_taken = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return len;
+}
+
+void stripe_destroy(Stripe *s)
+{
+    pthread_mutex_destroy(&s->lock);
+    munmap(s, sizeof(Stripe));
+}
+
+void stripe_print_stats(const Stripe *s)
+{
+    printf("stripes: %d flows, %lld bytes in chunks of %d, %lu steals moved %lu bytes\n",
+           s->nflows, (long long)(s->size + s->tail), s->chunk, s->steals, s->stolen_bytes);
+}
@@ -0,0 +1,37 @@
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define STRIPE_CHUNK_SEGMENTS 256 //a flow claims this many segments of its range at a time, a steal never leaves less than this behind
+#define MAX_FLOWS 64
+
+typedef struct {
+    int64_t next;               //first byte of the range not claimed yet
+    int64_t end;                //one past the last byte of the range
+} StripeRange;
+
+/*
+ * Byte ranges of a file striped over several flows. The flows are separate processes, so this lives in a
+ * shared anonymous mapping and the lock is process shared
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    int nflows;
+    int chunk;                  //bytes claimed at a time, whole segments
+    int seg_size;
+    int64_t size;               //bytes handed out through the ranges, whole segments only
+    int tail;                   //the short last segment of the file, flow 0 sends it after everything else
+    int tail_taken;
+    unsigned long steals;       //ranges split because their flow was slower than the thief
+    unsigned long stolen_bytes;
+    StripeRange ranges[MAX_FLOWS];
+} Stripe;
+
+Stripe* stripe_create(int64_t file_size, int seg_size, int nflows); //NULL when the shared mapping fails
+int stripe_claim(Stripe *s, int flow, int64_t *offset); //next bytes for flow, 0 once nothing is left for it
+void stripe_destroy(Stripe *s);
+void stripe_print_stats(const Stripe *s);
+
+#endif /* STRIPE_H */
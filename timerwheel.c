@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "timerwheel.h"
+#include "common.h"
+
+#define LEVEL_SHIFT(l) ((l) * TW_SLOT_BITS)
+#define SLOT_OF(t, l) ((int)(((t) >> LEVEL_SHIFT(l)) & (TW_SLOTS - 1)))
+
+/*
+ * Hierarchical timer wheel, one tick per microsecond. A timer sits on the level of the highest 6 bit group in
+ * which its deadline differs from now: everything below that group still has to elapse, everything above is
+ * the same. When now reaches the start of its slot the timer is cascaded to a lower level, on level 0 it fires.
+ * Every level keeps a 64 bit occupancy word, so finding the next slot that needs work is a count trailing zeros
+ * and an idle wheel never has to be stepped tick by tick.
+ */
+
+uint64_t tw_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void tw_init(TimerWheel *w, uint64_t now)
+{
+    w->capacity = 256;
+    w->nodes = calloc(w->capacity, sizeof(TimerNode));
+    if (w->nodes == NULL)
+        error("tw_init");
+    w->free_head = 0;
+    for (int i = w->capacity - 1; i > 0; i--) { //chain every node but the unused 0
+        w->nodes[i].next = w->free_head;
+        w->free_head = i;
+    }
+    for (int l = 0; l < TW_LEVELS; l++) {
+        for (int s = 0; s < TW_SLOTS; s++)
+            w->heads[l][s] = 0;
+        w->occupied[l] = 0;
+    }
+    w->now = now;
+    w->count = 0;
+    w->scheduled = 0;
+    w->fired = 0;
+    w->cancelled = 0;
+    w->cascaded = 0;
+}
+
+void tw_free(TimerWheel *w)
+{
+    free(w->nodes);
+    w->nodes = NULL;
+}
+
+static int alloc_node(TimerWheel *w)
+{
+    if (w->free_head == 0) { //double the node array, links are indexes so nothing has to be fixed up
+        int old = w->capacity;
+        TimerNode *grown = realloc(w->nodes, 2 * old * sizeof(TimerNode));
+        if (grown == NULL)
+            error("tw_schedule");
+        w->nodes = grown;
+        w->capacity = 2 * old;
+        for (int i = w->capacity - 1; i >= old; i--) {
+            w->nodes[i].next = w->free_head;
+            w->free_head = i;
+        }
+    }
+    int id = w->free_head;
+    w->free_head = w->nodes[id].next;
+    return id;
+}
+
+static void link_node(TimerWheel *w, int id)
+{
+    TimerNode *n = &w->nodes[id];
+    uint64_t diff = n->expires ^ w->now;
+    int level = diff == 0 ? 0 : (63 - __builtin_clzll(diff)) / TW_SLOT_BITS;
+    if (level >= TW_LEVELS) //only possible across the top level's wrap, the cascade just happens early
+        level = TW_LEVELS - 1;
+    int slot = SLOT_OF(n->expires, level);
+
+    n->level = level;
+    n->slot = slot;
+    n->prev = 0;
+    n->next = w->heads[level][slot];
+    if (n->next != 0)
+        w->nodes[n->next].prev = id;
+    w->heads[level][slot] = id;
+    w->occupied[level] |= 1ULL << slot;
+}
+
+static void unlink_node(TimerWheel *w, int id)
+{
+    TimerNode *n = &w->nodes[id];
+    if (n->prev != 0)
+        w->nodes[n->prev].next = n->next;
+    else
+        w->heads[n->level][n->slot] = n->next;
+    if (n->next != 0)
+        w->nodes[n->next].prev = n->prev;
+    if (w->heads[n->level][n->slot] == 0)
+        w->occupied[n->level] &= ~(1ULL << n->slot);
+}
+
+int tw_schedule(TimerWheel *w, uint64_t expires, long key)
+{
+    int id = alloc_node(w);
+    if (expires <= w->now) //already due, it fires on the next tick
+        expires = w->now + 1;
+    if (expires - w->now > TW_MAX_DELAY)
+        expires = w->now + TW_MAX_DELAY;
+    w->nodes[id].expires = expires;
+    w->nodes[id].key = key;
+    link_node(w, id);
+    w->count++;
+    w->scheduled++;
+    return id;
+}
+
+void tw_cancel(TimerWheel *w, int id)
+{
+    if (id == TW_NONE)
+        return;
+    unlink_node(w, id);
+    w->nodes[id].next = w->free_head;
+    w->free_head = id;
+    w->count--;
+    w->cancelled++;
+}
+
+/*
+ * due_tick: the tick at which slot work on level l is next needed. Slots at or below the level's current
+ * index only exist after the top level wrapped, they belong to the next round of the level above
+ */
+static uint64_t due_tick(const TimerWheel *w, int l)
+{
+    int cur = SLOT_OF(w->now, l);
+    uint64_t above = cur == TW_SLOTS - 1 ? 0 : w->occupied[l] & ~((2ULL << cur) - 1);
+    uint64_t round = w->now >> LEVEL_SHIFT(l + 1);
+    int slot;
+
+    if (above != 0) {
+        slot = __builtin_ctzll(above);
+    } else {
+        slot = __builtin_ctzll(w->occupied[l]);
+        round++;
+    }
+    return (round << LEVEL_SHIFT(l + 1)) | ((uint64_t)slot << LEVEL_SHIFT(l));
+}
+
+uint64_t tw_next_tick(const TimerWheel *w)
+{
+    uint64_t next = UINT64_MAX;
+    for (int l = 0; l < TW_LEVELS; l++) {
+        if (w->occupied[l] == 0)
+            continue;
+        uint64_t t = due_tick(w, l);
+        if (t < next)
+            next = t;
+    }
+    return next;
+}
+
+int tw_advance(TimerWheel *w, uint64_t now, tw_fire_fn fire, void *arg)
+{
+    int fired = 0;
+
+    while (w->count > 0) {
+        uint64_t t = tw_next_tick(w);
+        if (t > now)
+            break;
+        w->now = t;
+
+        //top down, a cascaded timer may land in a lower slot that is due at this very tick
+        for (int l = TW_LEVELS - 1; l > 0; l--) {
+            int s = SLOT_OF(t, l);
+            if ((t & ((1ULL << LEVEL_SHIFT(l)) - 1)) != 0 || !(w->occupied[l] & (1ULL << s)))
+                continue;
+            int id = w->heads[l][s];
+            w->heads[l][s] = 0;
+            w->occupied[l] &= ~(1ULL << s);
+            while (id != 0) {
+                int next = w->nodes[id].next;
+                link_node(w, id); //relative to the new now it belongs on a lower level
+                w->cascaded++;
+                id = next;
+            }
+        }
+
+        int s = SLOT_OF(t, 0);
+        while (w->occupied[0] & (1ULL << s)) { //fire one at a time, the callback may touch this slot
+            int id = w->heads[0][s];
+            long key = w->nodes[id].key;
+            unlink_node(w, id);
+            w->nodes[id].next = w->free_head;
+            w->free_head = id;
+            w->count--;
+            w->fired++;
+            fired++;
+            fire(arg, key);
+        }
+    }
+    if (now > w->now)
+        w->now = now;
+    return fired;
+}
+
+void tw_print_stats(const char *name, const TimerWheel *w)
+{
+    printf("%s: %lu timers scheduled, %lu fired, %lu cancelled, %lu cascades, %d node slots\n",
+           name, w->scheduled, w->fired, w->cancelled, w->cascaded, w->capacity - 1);
+}
@@ -0,0 +1,44 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdint.h>
+
+#define TW_LEVELS 5      //levels of the wheel, each one covers 64 times the range of the one below
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1 << TW_SLOT_BITS) //slots per level, one bit each in the level's occupancy word
+#define TW_MAX_DELAY ((1ULL << (TW_LEVELS * TW_SLOT_BITS)) - 1) //longest delay in ticks (~18 minutes of microseconds), longer ones are clamped
+#define TW_NONE 0        //timer id meaning "no timer", ids handed out are always > 0
+
+typedef struct {
+    uint64_t expires;    //deadline in microseconds of the monotonic clock
+    long key;            //caller's value, handed back when the timer fires
+    int prev, next;      //doubly linked slot list (node indexes, 0 ends it), index based so the node array can grow
+    short level, slot;   //where the node is linked, so cancel is O(1)
+} TimerNode;
+
+typedef struct {
+    TimerNode *nodes;                    //nodes[0] is unused so that 0 can mean "none"
+    int capacity;
+    int free_head;                       //free nodes are chained through next
+    int heads[TW_LEVELS][TW_SLOTS];      //first node of every slot, 0 if empty
+    uint64_t occupied[TW_LEVELS];        //bit s set when slot s of the level has timers
+    uint64_t now;                        //last tick processed, one tick is one microsecond
+    int count;                           //timers pending
+    unsigned long scheduled;             //stats
+    unsigned long fired;
+    unsigned long cancelled;
+    unsigned long cascaded;              //times a timer moved down a level
+} TimerWheel;
+
+typedef void (*tw_fire_fn)(void *arg, long key); //called for every expired timer, may schedule or cancel other timers
+
+uint64_t tw_clock(void);                                        //monotonic clock in microseconds, the wheel's time base
+void tw_init(TimerWheel *w, uint64_t now);
+void tw_free(TimerWheel *w);
+int tw_schedule(TimerWheel *w, uint64_t expires, long key);     //returns the timer id for tw_cancel
+void tw_cancel(TimerWheel *w, int id);                          //TW_NONE is ignored, so callers can cancel unconditionally
+int tw_advance(TimerWheel *w, uint64_t now, tw_fire_fn fire, void *arg); //run everything due up to now, returns how many fired
+uint64_t tw_next_tick(const TimerWheel *w);                     //when the wheel next needs tw_advance, UINT64_MAX if empty
+void tw_print_stats(const char *name, const TimerWheel *w);
+
+#endif /* TIMERWHEEL_H */
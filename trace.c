@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "trace.h"
+#include "common.h"
+
+/*
+ * drain: write out everything published since the last pass. The ring wraps, so that is one or two runs of
+ * records. Once stopping is set the pass that finds the ring empty is the last one, the sender published
+ * its final record before it set stopping
+ */
+static void* drain(void *arg)
+{
+    Trace *t = arg;
+    uint64_t tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+
+    while (1) {
+        bool stopping = atomic_load_explicit(&t->stopping, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+        if (head == tail) {
+            if (stopping) {
+                break;
+            }
+            struct timespec nap = { 0, TRACE_DRAIN_US * 1000 };
+            nanosleep(&nap, NULL);
+            continue;
+        }
+        while (tail < head) {
+            uint64_t first = tail & (TRACE_RING_RECORDS - 1);
+            uint64_t n = head - tail < TRACE_RING_RECORDS - first ? head - tail : TRACE_RING_RECORDS - first;
+            if (fwrite(&t->ring[first], sizeof(TraceRecord), n, t->file) != n) {
+                perror("trace");
+            }
+            tail += n;
+            t->written += n;
+            atomic_store_explicit(&t->tail, tail, memory_order_release); //the sender may reuse these slots now
+        }
+    }
+    return NULL;
+}
+
+int trace_open(Trace *t, const char *path, uint64_t now)
+{
+    struct timeval tv;
+    TraceFileHeader hdr = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord), now, 0 };
+
+    memset(t, 0, sizeof(*t));
+    t->file = fopen(path, "w");
+    if (t->file == NULL) { //a ring that is always full, trace_next hands out no slots
+        atomic_store_explicit(&t->head, TRACE_RING_RECORDS, memory_order_relaxed);
+        return -1;
+    }
+    t->ring = malloc(TRACE_RING_RECORDS * sizeof(TraceRecord));
+    if (t->ring == NULL) {
+        error("trace_open");
+    }
+    gettimeofday(&tv, NULL);
+    hdr.start_wall = tv.tv_sec + tv.tv_usec / 1e6;
+    fwrite(&hdr, sizeof(hdr), 1, t->file);
+    if (pthread_create(&t->thread, NULL, drain, t) != 0) {
+        error("trace_open");
+    }
+    return 0;
+}
+
+void trace_close(Trace *t)
+{
+    if (t->file == NULL) {
+        return;
+    }
+    atomic_store_explicit(&t->stopping, true, memory_order_release);
+    pthread_join(t->thread, NULL);
+    fclose(t->file);
+    free(t->ring);
+    t->file = NULL;
+    t->ring = NULL;
+}
+
+void trace_print_stats(const Trace *t, const char *path)
+{
+    printf("trace: %llu records in %s, %lu dropped (the drain thread fell behind)\n", t->written, path, t->dropped);
+}
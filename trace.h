@@ -0,0 +1,94 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define TRACE_MAGIC 0x52545243 //"RTRC"
+#define TRACE_VERSION 1
+#define TRACE_RING_RECORDS 65536  //power of two, 3 MB of records between the sender and the drain thread
+#define TRACE_DRAIN_US 2000       //the drain thread sleeps this long whenever it found the ring empty
+#define TRACE_RECOVERY 0x80       //or'ed into state while in fast recovery
+
+enum trace_event {
+    TR_CWND,        //the congestion state changed, the only event with the pacing and model fields, a CWND.csv row
+    TR_SEND,        //a new segment went out
+    TR_RETRANSMIT,  //a segment went out again
+    TR_ACK,         //an ack arrived, seq is its ackno
+    TR_RTT,         //rtt sample, seq is the ackno it came with
+    TR_TIMEOUT,     //rto, seq is send_base
+    TR_EVENTS
+};
+
+/*
+ * One event of the sender, fixed size so the ring is an array and the file is the ring's records back to back.
+ * Fields the event has nothing to say about are still the sender's state at that moment
+ */
+typedef struct {
+    uint64_t time;              //microseconds of the monotonic clock (tw_clock)
+    int64_t seq;                //byte offset the event is about
+    float cwnd;                 //segments, with the fraction congestion avoidance adds per ack
+    int32_t ssthresh;
+    uint32_t rtt;               //microseconds, the sample for TR_RTT, else the smoothed rtt
+    uint32_t rto;               //milliseconds
+    uint32_t min_rtt;           //microseconds, TR_CWND only
+    float pacing;               //Mbit/s, TR_CWND only
+    float btl_bw;               //Mbit/s, TR_CWND only, 0 without a model
+    uint16_t burst;             //segments, TR_CWND only, 0 when not pacing
+    uint8_t event;              //enum trace_event
+    uint8_t state;              //congestion state (cc.h), TRACE_RECOVERY in fast recovery
+} TraceRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint64_t start;             //tw_clock when the trace was opened
+    double start_wall;          //the same moment in seconds since the epoch, the decoder turns record times into these
+} TraceFileHeader;              //host byte order, a trace is decoded where it was taken
+
+/*
+ * Single producer, single consumer ring. The sender fills the slot trace_next hands out and publishes it with
+ * trace_commit, it never waits and never takes a lock: when the drain thread has fallen a whole ring behind the
+ * record is dropped and counted. The drain thread writes the published records out in as few fwrites as it can.
+ * head and tail sit on cache lines of their own, and the producer only looks at tail when the ring seems full
+ */
+typedef struct {
+    _Alignas(64) _Atomic uint64_t head;  //records published, only the sender writes it
+    uint64_t tail_seen;                  //the sender's last look at tail
+    unsigned long dropped;
+    _Alignas(64) _Atomic uint64_t tail;  //records written out, only the drain thread writes it
+    _Atomic bool stopping;
+    TraceRecord *ring;
+    FILE *file;
+    pthread_t thread;
+    unsigned long long written;
+} Trace;
+
+int trace_open(Trace *t, const char *path, uint64_t now); //starts the drain thread, -1 if the file can not be created (every record is dropped then)
+void trace_close(Trace *t); //writes out what is left and stops the thread
+void trace_print_stats(const Trace *t, const char *path);
+
+static inline TraceRecord* trace_next(Trace *t) //the slot of the next record, NULL when the ring is full
+{
+    uint64_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+
+    if (head - t->tail_seen >= TRACE_RING_RECORDS) {
+        t->tail_seen = atomic_load_explicit(&t->tail, memory_order_acquire);
+        if (head - t->tail_seen >= TRACE_RING_RECORDS) {
+            t->dropped++;
+            return NULL;
+        }
+    }
+    return &t->ring[head & (TRACE_RING_RECORDS - 1)];
+}
+
+static inline void trace_commit(Trace *t) //publish the record trace_next handed out
+{
+    atomic_store_explicit(&t->head, atomic_load_explicit(&t->head, memory_order_relaxed) + 1, memory_order_release);
+}
+
+#endif /* TRACE_H */
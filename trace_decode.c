@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace.h"
+#include "cc.h"
+
+/*
+ * trace_decode: turn a sender's binary trace (CWND.trace) back into the CWND.csv plot.py reads, one row per TR_CWND
+ * record, where the sender used to write a row itself. With -e every event is listed instead
+ */
+
+static const char *event_names[TR_EVENTS] = { "cwnd", "send", "retransmit", "ack", "rtt", "timeout" };
+
+static const char* state_name(int state)
+{
+    return state & TRACE_RECOVERY ? "FAST_RECOVERY" : cc_state_name(state);
+}
+
+int main(int argc, char **argv)
+{
+    bool events = false;
+    TraceFileHeader hdr;
+    TraceRecord r;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "e")) != -1) {
+        switch (opt) {
+            case 'e':
+                events = true;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-e] TRACE [CSV]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (argc - optind < 1 || argc - optind > 2) {
+        fprintf(stderr, "usage: %s [-e] TRACE [CSV]\n", argv[0]);
+        exit(1);
+    }
+    FILE *in = fopen(argv[optind], "r");
+    if (in == NULL) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    FILE *out = argc - optind == 2 ? fopen(argv[optind + 1], "w") : stdout;
+    if (out == NULL) {
+        perror(argv[optind + 1]);
+        exit(1);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || hdr.magic != TRACE_MAGIC || hdr.version != TRACE_VERSION ||
+        hdr.record_size != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s is not a trace this decoder can read\n", argv[optind]);
+        exit(1);
+    }
+    unsigned long n = 0;
+    while (fread(&r, sizeof(r), 1, in) == 1) {
+        double timestamp = hdr.start_wall + ((double)r.time - (double)hdr.start) / 1e6;
+        n++;
+        if (events) {
+            fprintf(out, "%.6f %-10s seq %lld cwnd %.2f ssthresh %d rtt %.3f ms rto %u ms %s\n", timestamp,
+                    r.event < TR_EVENTS ? event_names[r.event] : "?", (long long)r.seq, r.cwnd, r.ssthresh,
+                    r.rtt / 1000.0, r.rto, state_name(r.state));
+        } else if (r.event == TR_CWND) { //the columns of the sender's old log_to_csv
+            fprintf(out, "%.6f,%.2f,%d,%.3f,%d,%.3f,%.3f,%s\n", timestamp, r.cwnd, r.ssthresh,
+                    r.pacing, r.burst, r.btl_bw, r.min_rtt / 1000.0, state_name(r.state));
+        }
+    }
+    fclose(in);
+    if (out != stdout) {
+        fclose(out);
+    }
+    fprintf(stderr, "%lu records\n", n);
+    return 0;
+}
@@ -99,7 +99,7 @@ void vector_display(const Vector *vec) {
     for (int i = 0; i < vec->v_size; i++) {
         tcp_packet* pkt = vec->data[i];
         if (pkt != NULL) {
-            printf("%d", pkt->hdr.seqno);
+            printf("%lld", (long long)pkt->hdr.seqno);
         } else {
             printf("NULL");
         }
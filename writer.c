@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "writer.h"
+#include "common.h"
+
+#define RING_ENTRIES WRITER_DEPTH //one submission slot per staging buffer is all we ever need
+
+/* thin wrappers, glibc has no io_uring functions and we do not want to depend on liburing */
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/*
+ * uring_init: create the ring and map the submission queue, completion queue and sqe array
+ */
+static int uring_init(Writer *w)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    w->ring_fd = uring_setup(RING_ENTRIES, &p);
+    if (w->ring_fd < 0)
+        return -1;
+
+    w->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    w->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    w->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    w->sq_ring = mmap(NULL, w->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ring_fd, IORING_OFF_SQ_RING);
+    w->cq_ring = mmap(NULL, w->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ring_fd, IORING_OFF_CQ_RING);
+    w->sqes = mmap(NULL, w->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ring_fd, IORING_OFF_SQES);
+    if (w->sq_ring == MAP_FAILED || w->cq_ring == MAP_FAILED || w->sqes == MAP_FAILED) {
+        close(w->ring_fd);
+        return -1;
+    }
+
+    w->sq_head = (unsigned *)((char *)w->sq_ring + p.sq_off.head);
+    w->sq_tail = (unsigned *)((char *)w->sq_ring + p.sq_off.tail);
+    w->sq_mask = (unsigned *)((char *)w->sq_ring + p.sq_off.ring_mask);
+    w->sq_array = (unsigned *)((char *)w->sq_ring + p.sq_off.array);
+    w->cq_head = (unsigned *)((char *)w->cq_ring + p.cq_off.head);
+    w->cq_tail = (unsigned *)((char *)w->cq_ring + p.cq_off.tail);
+    w->cq_mask = (unsigned *)((char *)w->cq_ring + p.cq_off.ring_mask);
+    w->cqes = (struct io_uring_cqe *)((char *)w->cq_ring + p.cq_off.cqes);
+    return 0;
+}
+
+static void uring_submit(Writer *w, int idx)
+{
+    WriteBuf *b = &w->bufs[idx];
+    unsigned tail = *w->sq_tail;
+    unsigned slot = tail & *w->sq_mask;
+    struct io_uring_sqe *sqe = &w->sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = w->fd;
+    sqe->addr = (unsigned long)(b->data + b->done);
+    sqe->len = b->len - b->done;
+    sqe->off = b->offset + b->done;
+    sqe->user_data = idx; //so the completion tells us which buffer is free again
+    w->sq_array[slot] = slot;
+    __atomic_store_n(w->sq_tail, tail + 1, __ATOMIC_RELEASE); //publish the entry before telling the kernel
+
+    while (uring_enter(w->ring_fd, 1, 0, 0) < 0) {
+        if (errno != EINTR && errno != EAGAIN)
+            error("io_uring_enter");
+    }
+    w->submits++;
+}
+
+/*
+ * uring_reap: handle every completion that is ready, if wait is set block until at least one arrives
+ */
+static void uring_reap(Writer *w, int wait)
+{
+    if (wait) {
+        while (uring_enter(w->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+            if (errno != EINTR)
+                error("io_uring_enter");
+        }
+    }
+
+    unsigned head = *w->cq_head;
+    unsigned tail = __atomic_load_n(w->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &w->cqes[head & *w->cq_mask];
+        int idx = cqe->user_data;
+        WriteBuf *b = &w->bufs[idx];
+        head++;
+
+        if (cqe->res < 0) {
+            errno = -cqe->res;
+            error("io_uring write");
+        }
+        b->done += cqe->res;
+        if (b->done < b->len) { //short write, queue the rest of the same buffer again
+            __atomic_store_n(w->cq_head, head, __ATOMIC_RELEASE);
+            uring_submit(w, idx);
+            continue;
+        }
+        w->bytes += b->len;
+        w->in_flight -= b->len;
+        w->depth--;
+        b->busy = 0;
+    }
+    __atomic_store_n(w->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * writer_thread: fallback backend, pops queued buffers and writes them, buffers that follow each other
+ * in the file are gathered into a single pwritev
+ */
+static void* writer_thread(void *arg)
+{
+    Writer *w = arg;
+    struct iovec iov[WRITER_DEPTH];
+    int idxs[WRITER_DEPTH];
+
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+        while (w->q_count == 0 && !w->stopping)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (w->q_count == 0 && w->stopping)
+            break;
+
+        int n = 0;
+        off_t start = w->bufs[w->queue[w->q_head]].offset;
+        off_t end = start;
+        while (w->q_count > 0 && n < WRITER_DEPTH) { //take the run of adjacent buffers at the head of the queue
+            int idx = w->queue[w->q_head];
+            if (w->bufs[idx].offset != end)
+                break;
+            idxs[n] = idx;
+            iov[n].iov_base = w->bufs[idx].data;
+            iov[n].iov_len = w->bufs[idx].len;
+            end += w->bufs[idx].len;
+            n++;
+            w->q_head = (w->q_head + 1) % WRITER_DEPTH;
+            w->q_count--;
+        }
+        pthread_mutex_unlock(&w->lock);
+
+        int count = n; //n shrinks below while we step over written iovecs
+        size_t total = end - start;
+        size_t written = 0;
+        while (written < total) { //pwritev may write less than asked, move the iovecs forward and retry
+            ssize_t r = pwritev(w->fd, iov, n, start + written);
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+                error("pwritev");
+            }
+            written += r;
+            while (n > 0 && r >= (ssize_t)iov[0].iov_len) {
+                r -= iov[0].iov_len;
+                memmove(iov, iov + 1, (n - 1) * sizeof(struct iovec));
+                n--;
+            }
+            if (n > 0) {
+                iov[0].iov_base = (char *)iov[0].iov_base + r;
+                iov[0].iov_len -= r;
+            }
+        }
+
+        pthread_mutex_lock(&w->lock);
+        for (int i = 0; i < count; i++) {
+            WriteBuf *b = &w->bufs[idxs[i]];
+            w->bytes += b->len;
+            w->in_flight -= b->len;
+            w->depth--;
+            b->busy = 0;
+        }
+        w->submits++;
+        pthread_cond_broadcast(&w->cond); //wake the receive loop if it is waiting for a free buffer
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+int writer_init(Writer *w, int fd, int mode)
+{
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+    w->current = -1;
+    w->ring_fd = -1;
+    for (int i = 0; i < WRITER_DEPTH; i++) {
+        w->bufs[i].data = malloc(WRITER_CHUNK);
+        if (w->bufs[i].data == NULL)
+            error("writer_init");
+    }
+
+    if (mode == WRITER_URING && uring_init(w) < 0) { //no io_uring (old kernel or blocked by seccomp), use the thread
+        perror("io_uring not available, using writer thread");
+        mode = WRITER_THREAD;
+    }
+    w->mode = mode;
+
+    if (mode == WRITER_THREAD) {
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        if (pthread_create(&w->thread, NULL, writer_thread, w) != 0)
+            error("pthread_create");
+    }
+    return mode;
+}
+
+static void submit(Writer *w, int idx)
+{
+    WriteBuf *b = &w->bufs[idx];
+    b->busy = 1;
+    b->done = 0;
+
+    if (w->mode == WRITER_THREAD)
+        pthread_mutex_lock(&w->lock);
+    w->depth++;
+    w->in_flight += b->len;
+    if (w->depth > w->max_depth) w->max_depth = w->depth;
+    if (w->in_flight > w->max_in_flight) w->max_in_flight = w->in_flight;
+
+    if (w->mode == WRITER_URING) {
+        uring_submit(w, idx);
+    } else {
+        w->queue[(w->q_head + w->q_count) % WRITER_DEPTH] = idx;
+        w->q_count++;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+/*
+ * get_free_buffer: pick an idle staging buffer, only if every one of them is queued do we wait for the disk
+ */
+static int get_free_buffer(Writer *w)
+{
+    if (w->mode == WRITER_URING)
+        uring_reap(w, 0); //cheap, just looks at the completion ring
+
+    while (1) {
+        if (w->mode == WRITER_THREAD)
+            pthread_mutex_lock(&w->lock);
+        for (int i = 0; i < WRITER_DEPTH; i++) {
+            if (!w->bufs[i].busy && i != w->current) {
+                if (w->mode == WRITER_THREAD)
+                    pthread_mutex_unlock(&w->lock);
+                return i;
+            }
+        }
+        w->stalls++;
+        if (w->mode == WRITER_URING) {
+            uring_reap(w, 1);
+        } else {
+            pthread_cond_wait(&w->cond, &w->lock);
+            pthread_mutex_unlock(&w->lock);
+        }
+    }
+}
+
+void writer_flush(Writer *w)
+{
+    if (w->current >= 0 && w->bufs[w->current].len > 0) {
+        int idx = w->current;
+        w->current = -1;
+        submit(w, idx);
+    }
+}
+
+/*
+ * writer_write: stage len bytes for offset, data that continues the current buffer is appended to it,
+ * anything else (or a full buffer) sends the current buffer off and starts a new one
+ */
+void writer_write(Writer *w, off_t offset, const void *data, size_t len)
+{
+    const char *src = data;
+    while (len > 0) {
+        if (w->current >= 0) {
+            WriteBuf *cur = &w->bufs[w->current];
+            if (cur->offset + (off_t)cur->len != offset || cur->len == WRITER_CHUNK)
+                writer_flush(w);
+        }
+        if (w->current < 0) {
+            w->current = get_free_buffer(w);
+            w->bufs[w->current].offset = offset;
+            w->bufs[w->current].len = 0;
+        }
+
+        WriteBuf *cur = &w->bufs[w->current];
+        size_t n = WRITER_CHUNK - cur->len < len ? WRITER_CHUNK - cur->len : len;
+        memcpy(cur->data + cur->len, src, n);
+        cur->len += n;
+        src += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+/*
+ * writer_sync: the journal may only record data the kernel has, the staged and queued buffers are waited for
+ */
+void writer_sync(Writer *w)
+{
+    writer_flush(w);
+    if (w->mode == WRITER_URING) {
+        while (w->depth > 0)
+            uring_reap(w, 1);
+    } else {
+        pthread_mutex_lock(&w->lock);
+        while (w->depth > 0)
+            pthread_cond_wait(&w->cond, &w->lock);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+/*
+ * writer_finish: submit what is left, wait until the backend drained everything and fsync once, this is
+ * the only place the receiver waits for the disk
+ */
+void writer_finish(Writer *w)
+{
+    writer_flush(w);
+
+    if (w->mode == WRITER_URING) {
+        while (w->depth > 0)
+            uring_reap(w, 1);
+        munmap(w->sqes, w->sqes_size);
+        munmap(w->sq_ring, w->sq_ring_size);
+        munmap(w->cq_ring, w->cq_ring_size);
+        close(w->ring_fd);
+    } else {
+        pthread_mutex_lock(&w->lock);
+        w->stopping = 1;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+    }
+
+    if (fsync(w->fd) < 0)
+        perror("fsync");
+    for (int i = 0; i < WRITER_DEPTH; i++)
+        free(w->bufs[i].data);
+}
+
+void writer_print_stats(const Writer *w)
+{
+    printf("writer (%s): %llu bytes in %lu writes, max queue depth %d/%d, max bytes in flight %zu, %lu stalls\n",
+           w->mode == WRITER_URING ? "io_uring" : "thread", w->bytes, w->submits,
+           w->max_depth, WRITER_DEPTH, w->max_in_flight, w->stalls);
+}
@@ -0,0 +1,64 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#define WRITER_CHUNK (1024 * 1024) //size of each staging buffer, adjacent segments are coalesced up to this
+#define WRITER_DEPTH 32            //max number of staging buffers queued or in flight at once
+
+enum writer_mode {
+    WRITER_URING,  //io_uring, writes are submitted to the kernel and reaped later
+    WRITER_THREAD, //fallback, a background thread does the pwritev calls
+};
+
+typedef struct {
+    char *data;    //WRITER_CHUNK bytes of staging space
+    off_t offset;  //file offset of data[0]
+    size_t len;    //bytes staged so far
+    size_t done;   //bytes already written (a short write is resumed from here)
+    int busy;      //1 while queued or in flight
+} WriteBuf;
+
+typedef struct {
+    int fd;                         //output file
+    int mode;                       //WRITER_URING or WRITER_THREAD
+    WriteBuf bufs[WRITER_DEPTH];
+    int current;                    //buffer being filled by the receive loop, -1 if none
+
+    //io_uring state, set up with the raw syscalls so we do not need liburing
+    int ring_fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+
+    //thread fallback state, a fifo of buffer indexes protected by lock
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int queue[WRITER_DEPTH];
+    int q_head, q_count;
+    int stopping;
+
+    //stats, depth and in_flight are what we size WRITER_DEPTH / WRITER_CHUNK with
+    int depth;                      //buffers queued or in flight right now
+    int max_depth;
+    size_t in_flight;               //bytes queued or in flight right now
+    size_t max_in_flight;
+    unsigned long submits;          //number of write requests handed to the backend
+    unsigned long stalls;           //number of times the receive loop had to wait for a free buffer
+    unsigned long long bytes;       //total bytes written
+} Writer;
+
+int writer_init(Writer *w, int fd, int mode); //returns the mode actually in use (uring falls back to thread)
+void writer_write(Writer *w, off_t offset, const void *data, size_t len); //copies data, never blocks on the disk unless all buffers are busy
+void writer_flush(Writer *w); //submit the partially filled staging buffer
+void writer_sync(Writer *w); //submit everything and wait until it is written (not fsynced), the writer stays usable
+void writer_finish(Writer *w); //wait for everything, fsync once and release the writer
+void writer_print_stats(const Writer *w);
+
+#endif /* WRITER_H */
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include "zstream.h"
+#include "lz.h"
+#include "common.h"
+
+void zw_init(ZWriter *z, int block)
+{
+    memset(z, 0, sizeof(*z));
+    z->block = block;
+    z->raw = malloc(block);
+    z->frame = malloc(sizeof(zframe_header) + block); //a block that does not shrink is stored, so this is the most a frame takes
+    if (z->raw == NULL || z->frame == NULL)
+        error("zw_init");
+}
+
+void zw_free(ZWriter *z)
+{
+    free(z->raw);
+    free(z->frame);
+    z->raw = NULL;
+    z->frame = NULL;
+}
+
+void zw_pack(ZWriter *z, int64_t offset, int len)
+{
+    zframe_header hdr;
+    char *payload = z->frame + sizeof(hdr);
+    int wire_len = lz_compress(z->raw, len, payload, len - 1); //anything that is not at least a byte smaller is stored
+
+    if (wire_len == 0) {
+        memcpy(payload, z->raw, len);
+        wire_len = len;
+        hdr.method = Z_STORED;
+        z->stored++;
+    } else {
+        hdr.method = Z_LZ;
+    }
+    hdr.offset = htobe64(offset);
+    hdr.raw_len = htonl(len);
+    hdr.wire_len = htonl(wire_len);
+    memcpy(z->frame, &hdr, sizeof(hdr));
+    z->frame_len = sizeof(hdr) + wire_len;
+    z->frame_pos = 0;
+    z->frame_offset = offset;
+    z->blocks++;
+    z->raw_bytes += len;
+    z->wire_bytes += z->frame_len;
+}
+
+int zw_read(ZWriter *z, char *dst, int len)
+{
+    int n = z->frame_len - z->frame_pos;
+
+    if (n > len)
+        n = len;
+    memcpy(dst, z->frame + z->frame_pos, n);
+    z->frame_pos += n;
+    return n;
+}
+
+void zw_print_stats(const ZWriter *z, double secs)
+{
+    printf("compression: %llu file bytes in %llu stream bytes (%.1f%%), %lu blocks of %d KB, %lu sent stored\n",
+           z->raw_bytes, z->wire_bytes, z->raw_bytes ? 100.0 * z->wire_bytes / z->raw_bytes : 0.0,
+           z->blocks, z->block / 1024, z->stored);
+    if (secs > 0) { //what the application sees against what the link carried
+        printf("throughput: effective %.1f Mbit/s, wire %.1f Mbit/s\n", z->raw_bytes * 8 / secs / 1e6, z->wire_bytes * 8 / secs / 1e6);
+    }
+}
+
+void zr_init(ZReader *r)
+{
+    memset(r, 0, sizeof(*r));
+}
+
+void zr_free(ZReader *r)
+{
+    free(r->payload);
+    free(r->raw);
+    r->payload = NULL;
+    r->raw = NULL;
+}
+
+static bool grow(char **buf, int *cap, int need)
+{
+    if (need <= *cap)
+        return true;
+    char *p = realloc(*buf, need);
+    if (p == NULL)
+        return false;
+    *buf = p;
+    *cap = need;
+    return true;
+}
+
+/*
+ * zr_feed: a frame's header and payload may be cut anywhere, they are collected until the frame is whole
+ */
+int zr_feed(ZReader *r, const char *data, int len, bool *complete)
+{
+    int used = 0;
+
+    *complete = false;
+    if (r->broken) {
+        return len;
+    }
+    if (r->hdr_have < (int)sizeof(zframe_header)) {
+        used = (int)sizeof(zframe_header) - r->hdr_have;
+        if (used > len)
+            used = len;
+        memcpy((char *)&r->hdr + r->hdr_have, data, used);
+        r->hdr_have += used;
+        if (r->hdr_have < (int)sizeof(zframe_header))
+            return used;
+        r->offset = be64toh(r->hdr.offset);
+        r->raw_len = ntohl(r->hdr.raw_len);
+        r->wire_len = ntohl(r->hdr.wire_len);
+        r->method = r->hdr.method;
+        r->payload_have = 0;
+        if (r->offset < 0 || r->raw_len <= 0 || r->raw_len > ZBLOCK_MAX || r->wire_len <= 0 || r->wire_len > r->raw_len ||
+            (r->method == Z_STORED && r->wire_len != r->raw_len) || r->method > Z_LZ ||
+            !grow(&r->payload, &r->payload_cap, r->wire_len)) {
+            r->broken = true;
+            r->corrupt++;
+            return len;
+        }
+    }
+    int n = r->wire_len - r->payload_have;
+    if (n > len - used)
+        n = len - used;
+    memcpy(r->payload + r->payload_have, data + used, n);
+    r->payload_have += n;
+    if (r->payload_have == r->wire_len) {
+        *complete = true;
+        r->hdr_have = 0; //the next byte starts the next frame
+    }
+    return used + n;
+}
+
+const char* zr_decode(ZReader *r, char *dst)
+{
+    if (dst == NULL) {
+        if (!grow(&r->raw, &r->raw_cap, r->raw_len))
+            error("zr_decode");
+        dst = r->raw;
+    }
+    if (r->method == Z_STORED) {
+        memcpy(dst, r->payload, r->raw_len);
+        r->stored++;
+    } else if (lz_decompress(r->payload, r->wire_len, dst, r->raw_len) < 0) {
+        r->corrupt++;
+        return NULL;
+    }
+    r->frames++;
+    r->raw_bytes += r->raw_len;
+    r->wire_bytes += sizeof(zframe_header) + r->wire_len;
+    return dst;
+}
+
+void zr_print_stats(const ZReader *r)
+{
+    printf("compressed stream: %lu frames (%lu stored), %llu stream bytes expanded to %llu, %lu corrupt\n",
+           r->frames, r->stored, r->wire_bytes, r->raw_bytes, r->corrupt);
+}
@@ -0,0 +1,75 @@
+#ifndef ZSTREAM_H
+#define ZSTREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ZBLOCK_DEFAULT 64   //KB of the file compressed at a time, -z picks another size
+#define ZBLOCK_MAX (1024 * 1024)
+
+enum zmethod {
+    Z_STORED, //the block did not shrink, it is sent as is
+    Z_LZ,     //lz_compress
+};
+
+/*
+ * A compressed transfer sends a stream of frames instead of the file: every block of the file is compressed
+ * on its own and goes out as header + payload, cut into segments like any other byte stream. The header says
+ * where the block goes, so the receiver expands each frame as soon as its last byte arrives in order and
+ * writes it by offset. A frame never depends on another one, a lost segment only holds up its own block
+ */
+typedef struct __attribute__((packed)) {
+    uint64_t offset;   //file offset of the block
+    uint32_t raw_len;  //its size in the file
+    uint32_t wire_len; //payload bytes following the header
+    uint8_t method;    //enum zmethod
+} zframe_header;       //network byte order
+
+//sender side: the file is read a block at a time and packed into a frame, segments are cut from the frame
+typedef struct {
+    int block;                  //raw bytes per block
+    char *raw;                  //block read from the file
+    char *frame;                //header and payload of the frame being sent
+    int frame_len;
+    int frame_pos;              //bytes of it already cut into segments
+    int64_t frame_offset;       //file offset of its block
+    unsigned long blocks;       //stats
+    unsigned long stored;       //blocks that did not shrink
+    unsigned long long raw_bytes;
+    unsigned long long wire_bytes;
+} ZWriter;
+
+void zw_init(ZWriter *z, int block);
+void zw_free(ZWriter *z);
+void zw_pack(ZWriter *z, int64_t offset, int len); //frame the len bytes read into z->raw, compressed unless that does not make them smaller
+int zw_read(ZWriter *z, char *dst, int len);   //cut the next bytes of the frame, 0 when it is used up
+void zw_print_stats(const ZWriter *z, double secs);
+
+//receiver side: the in order payload is fed in, every frame that is complete is expanded
+typedef struct {
+    zframe_header hdr;
+    int hdr_have;               //header bytes collected so far
+    int64_t offset;             //of the frame being collected, valid once its header is complete
+    int raw_len;
+    int wire_len;
+    int method;
+    char *payload;
+    int payload_have;
+    int payload_cap;
+    char *raw;                  //expanded block when the caller has nowhere to put it
+    int raw_cap;
+    bool broken;                //a frame header made no sense, nothing after it can be trusted
+    unsigned long frames;       //stats
+    unsigned long stored;
+    unsigned long corrupt;
+    unsigned long long raw_bytes;
+    unsigned long long wire_bytes;
+} ZReader;
+
+void zr_init(ZReader *r);
+void zr_free(ZReader *r);
+int zr_feed(ZReader *r, const char *data, int len, bool *complete); //bytes taken, at most up to the end of one frame
+const char* zr_decode(ZReader *r, char *dst); //expand the complete frame into dst (raw_len bytes) or, dst NULL, a buffer of its own. NULL if corrupt
+void zr_print_stats(const ZReader *r);
+
+#endif /* ZSTREAM_H */